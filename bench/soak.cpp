@@ -0,0 +1,386 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// Soak test: N simulated devices download concurrently through the regular DownloadCommand.
+// Devices are synthetic recorded sessions served by SessionReplay, so no hardware is needed and
+// library size, latency, bandwidth and error rate are configurable.
+
+#include "download_command.h"
+#include "session_trace.h"
+#include "trace.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace {
+
+constexpr double BYTES_IN_MEGABYTE = 1024 * 1024;
+constexpr const char* SOURCE_ROOT = "/DCIM";
+
+struct SoakOptions {
+    size_t devices {4};
+    size_t folders {4};
+    size_t files_per_folder {100};
+    uint64_t file_size {2 * 1024 * 1024};
+    std::chrono::microseconds latency {std::chrono::milliseconds(5)};
+    double bandwidth {40 * BYTES_IN_MEGABYTE}; // Bytes per second of a single device
+    double error_rate {0};
+    double limit_rate {0}; // Shared limit of all devices, bytes per second
+    bool async_write {false};
+    bool no_delay {false}; // Replay without the device timing, only the overhead of phcopy is measured
+    bool incremental {false};
+    size_t workers {0}; // Workers shared by all devices, zero for a scheduler per device
+    std::chrono::milliseconds sample_interval {1000};
+    std::filesystem::path work_folder;
+};
+
+struct Sample {
+    double seconds;
+    uint64_t bytes;
+    long rss_kb;
+    size_t fds;
+};
+
+SessionRecord make_record(SessionCall call, const std::string& path) {
+    SessionRecord record;
+    record.call = call;
+    record.ok = true;
+    record.path = path;
+    return record;
+}
+
+// Layout of the simulated device: /DCIM/1NNAPPLE/IMG_NNNN.JPG
+bool write_session(const std::filesystem::path& file, size_t device_idx, const SoakOptions& options) {
+    std::mt19937 random(static_cast<uint32_t>(device_idx));
+    std::uniform_real_distribution<double> chance(0, 1);
+
+    std::ofstream out(file, std::ios::trunc);
+
+    auto root = make_record(SessionCall::LIST_FOLDERS, "/");
+    root.names.emplace_back("DCIM");
+    SessionRecorder::write_record(out, root);
+
+    auto dcim_folders = make_record(SessionCall::LIST_FOLDERS, SOURCE_ROOT);
+    SessionRecorder::write_record(out, make_record(SessionCall::LIST_FILES, SOURCE_ROOT));
+
+    size_t file_number = 1;
+    for (size_t folder_idx = 0; folder_idx < options.folders; folder_idx++) {
+        auto folder_name = std::to_string(100 + folder_idx) + "APPLE";
+        auto folder = std::string(SOURCE_ROOT) + "/" + folder_name;
+        dcim_folders.names.push_back(folder_name);
+
+        SessionRecorder::write_record(out, make_record(SessionCall::LIST_FOLDERS, folder));
+        auto files = make_record(SessionCall::LIST_FILES, folder);
+        for (size_t i = 0; i < options.files_per_folder; i++, file_number++) {
+            std::ostringstream name;
+            name << "IMG_" << std::setw(4) << std::setfill('0') << file_number << ".JPG";
+            files.names.push_back(name.str());
+
+            auto path = folder + "/" + name.str();
+            auto info = make_record(SessionCall::FILE_INFO, path);
+            info.duration = options.latency;
+            info.info.size = options.file_size;
+            info.info.mtime = 1600000000 + static_cast<std::time_t>(file_number);
+            info.info.type = "image/jpeg";
+            SessionRecorder::write_record(out, info);
+
+            auto get = make_record(SessionCall::GET_FILE, path);
+            get.ok = chance(random) >= options.error_rate;
+            get.duration = options.latency + std::chrono::microseconds(static_cast<int64_t>(
+                                                     static_cast<double>(options.file_size) / options.bandwidth * 1e6));
+            get.info.size = options.file_size;
+            SessionRecorder::write_record(out, get);
+        }
+        files.duration = options.latency;
+        SessionRecorder::write_record(out, files);
+    }
+    dcim_folders.duration = options.latency;
+    SessionRecorder::write_record(out, dcim_folders);
+
+    return static_cast<bool>(out);
+}
+
+uint64_t folder_size(const std::filesystem::path& folder) {
+    uint64_t size = 0;
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec)) {
+            size += it->file_size(ec);
+        }
+    }
+    return size;
+}
+
+long current_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return std::strtol(line.c_str() + 6, nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+size_t open_fds() {
+    std::error_code ec;
+    size_t count = 0;
+    for (std::filesystem::directory_iterator it("/proc/self/fd", ec), end; !ec && it != end; it.increment(ec)) {
+        count++;
+    }
+    return count;
+}
+
+// Durations of download_asset spans from the trace, i.e. latency of every photo including waits for the limiter
+std::vector<int64_t> asset_latencies(const std::filesystem::path& trace_file) {
+    std::vector<int64_t> result;
+    std::ifstream in(trace_file);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find("\"name\":\"download_asset\"") == std::string::npos) {
+            continue;
+        }
+        auto pos = line.find("\"dur\":");
+        if (pos != std::string::npos) {
+            result.push_back(std::strtoll(line.c_str() + pos + 6, nullptr, 10));
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+double percentile_ms(const std::vector<int64_t>& sorted, double percentile) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    auto idx = static_cast<size_t>(percentile * static_cast<double>(sorted.size() - 1));
+    return static_cast<double>(sorted[idx]) / 1000.0;
+}
+
+std::optional<SoakOptions> parse_options(int argc, char* argv[]) {
+    po::options_description desc("phcopy_soak options");
+    // clang-format off
+    desc.add_options()
+            ("help,h", "Print this help")
+            ("devices", po::value<size_t>()->default_value(4), "Number of simulated devices")
+            ("folders", po::value<size_t>()->default_value(4), "Folders per device")
+            ("files", po::value<size_t>()->default_value(100), "Files per folder")
+            ("file-size", po::value<double>()->default_value(2), "File size, MB")
+            ("latency", po::value<double>()->default_value(5), "Latency of every device call, ms")
+            ("bandwidth", po::value<double>()->default_value(40), "Transfer speed of a device, MB/s")
+            ("error-rate", po::value<double>()->default_value(0), "Share of failing transfers, 0..1")
+            ("limit-rate", po::value<double>()->default_value(0), "Shared limit of all devices, MB/s")
+            ("async-write", "Download with --async-write")
+            ("incremental", "Download with --incremental")
+            ("workers", po::value<size_t>()->default_value(0), "Workers shared by the devices, implies --incremental")
+            ("no-delay", "Replay without latency and bandwidth limits to measure the per-file overhead")
+            ("interval", po::value<double>()->default_value(1), "Sampling interval, seconds")
+            ("work-folder", po::value<std::string>(), "Folder for sessions and downloads, temporary by default");
+    // clang-format on
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help") > 0) {
+        std::cout << desc << std::endl;
+        return std::nullopt;
+    }
+
+    SoakOptions options;
+    options.devices = std::max<size_t>(vm["devices"].as<size_t>(), 1);
+    options.folders = vm["folders"].as<size_t>();
+    options.files_per_folder = vm["files"].as<size_t>();
+    options.file_size = static_cast<uint64_t>(vm["file-size"].as<double>() * BYTES_IN_MEGABYTE);
+    options.latency = std::chrono::microseconds(static_cast<int64_t>(vm["latency"].as<double>() * 1000));
+    options.bandwidth = std::max(vm["bandwidth"].as<double>(), 0.001) * BYTES_IN_MEGABYTE;
+    options.error_rate = vm["error-rate"].as<double>();
+    options.limit_rate = vm["limit-rate"].as<double>() * BYTES_IN_MEGABYTE;
+    options.async_write = vm.count("async-write") > 0;
+    options.no_delay = vm.count("no-delay") > 0;
+    options.workers = vm["workers"].as<size_t>();
+    options.incremental = vm.count("incremental") > 0 || options.workers > 0;
+    options.sample_interval = std::chrono::milliseconds(static_cast<int64_t>(vm["interval"].as<double>() * 1000));
+    if (vm.count("work-folder") > 0) {
+        options.work_folder = vm["work-folder"].as<std::string>();
+    } else {
+        options.work_folder = std::filesystem::temp_directory_path() / ("phcopy-soak-" + std::to_string(getpid()));
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    auto parsed = parse_options(argc, argv);
+    if (!parsed) {
+        return 0;
+    }
+    const SoakOptions& options = *parsed;
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.work_folder, ec);
+    if (ec) {
+        std::cerr << "Can't create " << options.work_folder << ": " << ec.message() << std::endl;
+        return 1;
+    }
+
+    std::vector<std::filesystem::path> sessions, destinations;
+    for (size_t i = 0; i < options.devices; i++) {
+        sessions.push_back(options.work_folder / ("device-" + std::to_string(i) + ".session"));
+        destinations.push_back(options.work_folder / ("device-" + std::to_string(i)));
+        std::filesystem::create_directories(destinations.back(), ec);
+        if (!write_session(sessions.back(), i, options)) {
+            std::cerr << "Can't write session " << sessions.back() << std::endl;
+            return 1;
+        }
+    }
+
+    auto trace_file = options.work_folder / "trace.json";
+#ifdef PHCOPY_TRACING
+    Tracer::instance().start(trace_file);
+#endif
+
+    // Progress of the commands would interleave, only the report is printed
+    std::ostream report(std::cerr.rdbuf());
+    std::ofstream null_stream;
+    auto* cout_buffer = std::cout.rdbuf(null_stream.rdbuf());
+    auto* cerr_buffer = std::cerr.rdbuf(null_stream.rdbuf());
+
+    std::shared_ptr<RateLimiter> global_limit;
+    if (options.limit_rate > 0) {
+        auto rate = static_cast<uint64_t>(options.limit_rate);
+        global_limit = std::make_shared<RateLimiter>(rate, rate);
+    }
+
+    std::shared_ptr<TaskScheduler> scheduler;
+    if (options.workers > 0) {
+        scheduler = std::make_shared<TaskScheduler>(options.workers);
+    }
+
+    std::vector<Sample> samples;
+    std::mutex samples_mutex;
+    std::condition_variable finished_cv;
+    bool finished = false;
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread monitor([&]() {
+        std::unique_lock<std::mutex> lock(samples_mutex);
+        while (!finished_cv.wait_for(lock, options.sample_interval, [&]() { return finished; })) {
+            lock.unlock();
+            // Only the destinations count, the work folder also holds the sessions and the trace
+            uint64_t written = 0;
+            for (const auto& destination : destinations) {
+                written += folder_size(destination);
+            }
+            Sample sample {std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+                           written,
+                           current_rss_kb(),
+                           open_fds()};
+            report << std::fixed << std::setprecision(1) << "t=" << sample.seconds << "s written="
+                   << static_cast<double>(sample.bytes) / BYTES_IN_MEGABYTE << "MB rss=" << sample.rss_kb / 1024
+                   << "MB fds=" << sample.fds << std::endl;
+            lock.lock();
+            samples.push_back(sample);
+        }
+    });
+
+    std::vector<std::thread> devices;
+    for (size_t i = 0; i < options.devices; i++) {
+        devices.emplace_back([&, i]() {
+            DownloadOptions download_options;
+            download_options.recursive = true;
+            download_options.async_write = options.async_write;
+            download_options.incremental = options.incremental;
+            download_options.scheduler = scheduler;
+            download_options.throttle.set_global_limits(global_limit, nullptr);
+
+            SessionTraceOptions session;
+            session.replay_file = sessions[i];
+            session.replay_speed = options.no_delay ? 0.0 : 1.0;
+            session.listing_cache = false;
+
+            DownloadCommand command(0, SOURCE_ROOT, destinations[i], download_options);
+            command.set_session_trace(session);
+            command.execute();
+        });
+    }
+    for (auto& device : devices) {
+        device.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    {
+        std::lock_guard<std::mutex> lock(samples_mutex);
+        finished = true;
+    }
+    finished_cv.notify_all();
+    monitor.join();
+
+    std::cout.rdbuf(cout_buffer);
+    std::cerr.rdbuf(cerr_buffer);
+    Tracer::instance().stop();
+
+    uint64_t written = 0;
+    size_t files = 0;
+    for (const auto& destination : destinations) {
+        written += folder_size(destination);
+        for (std::filesystem::recursive_directory_iterator it(destination, ec), end; !ec && it != end;
+             it.increment(ec)) {
+            files += it->is_regular_file(ec) ? 1 : 0;
+        }
+    }
+
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    size_t max_fds = 0;
+    for (const auto& sample : samples) {
+        max_fds = std::max(max_fds, sample.fds);
+    }
+
+    // Devices run in parallel, so this is the time one device spends on a file
+    double per_file_us =
+            files > 0 ? elapsed.count() * 1e6 * static_cast<double>(options.devices) / static_cast<double>(files) : 0;
+    size_t planned = options.devices * options.folders * options.files_per_folder;
+    report << std::fixed << std::setprecision(2) << "\nDevices: " << options.devices << "\nFiles: " << files
+           << " of " << planned << "\nWritten: " << static_cast<double>(written) / BYTES_IN_MEGABYTE << " MB in "
+           << elapsed.count() << " s\nThroughput: " << static_cast<double>(written) / BYTES_IN_MEGABYTE / elapsed.count()
+           << " MB/s\nTime per file: " << per_file_us << " us\nMax RSS: " << usage.ru_maxrss / 1024 << " MB\nMax open fds: " << max_fds << std::endl;
+
+    auto latencies = asset_latencies(trace_file);
+    if (latencies.empty()) {
+        report << "Latency: not available, build with ENABLE_TRACING" << std::endl;
+    } else {
+        report << "Latency per photo, ms: p50=" << percentile_ms(latencies, 0.5)
+               << " p95=" << percentile_ms(latencies, 0.95) << " p99=" << percentile_ms(latencies, 0.99)
+               << " max=" << percentile_ms(latencies, 1.0) << std::endl;
+    }
+
+    return files == planned || options.error_rate > 0 ? 0 : 2;
+}
@@ -0,0 +1,141 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "asset_group.h"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+
+namespace {
+
+std::string to_upper(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::toupper(c); });
+    return str;
+}
+
+bool is_still_image(const std::string& ext) {
+    return ext == ".HEIC" || ext == ".JPG" || ext == ".JPEG" || ext == ".PNG" || ext == ".DNG";
+}
+
+bool is_video(const std::string& ext) {
+    return ext == ".MOV" || ext == ".MP4";
+}
+
+// Edited copies and original adjustments are named IMG_E1234 / IMG_O1234: a single marker letter
+// between the last underscore and the sequence number.
+bool strip_edit_marker(std::string& stem) {
+    auto underscore = stem.rfind('_');
+    if (underscore == std::string::npos || underscore + 2 >= stem.size()) {
+        return false;
+    }
+
+    char marker = stem[underscore + 1];
+    if (marker != 'E' && marker != 'O') {
+        return false;
+    }
+
+    bool digits = std::all_of(
+            stem.begin() + underscore + 2, stem.end(), [](unsigned char c) { return std::isdigit(c); });
+    if (!digits) {
+        return false;
+    }
+
+    stem.erase(underscore + 1, 1);
+    return true;
+}
+
+} // namespace
+
+void AssetFilter::exclude(AssetFileKind kind) noexcept {
+    excluded_mask |= 1u << static_cast<unsigned>(kind);
+}
+
+bool AssetFilter::is_excluded(AssetFileKind kind) const noexcept {
+    return (excluded_mask & (1u << static_cast<unsigned>(kind))) != 0;
+}
+
+bool AssetFilter::apply(Asset& asset) const {
+    if (excluded_mask != 0) {
+        auto pos = std::remove_if(asset.files.begin(), asset.files.end(), [this](const AssetFile& file) {
+            return is_excluded(file.kind);
+        });
+        asset.files.erase(pos, asset.files.end());
+    }
+
+    return !asset.files.empty();
+}
+
+bool AssetFilter::parse_kind(const std::string& name, AssetFileKind& kind_out) noexcept {
+    if (name == "live") {
+        kind_out = AssetFileKind::LIVE_VIDEO;
+    } else if (name == "edited") {
+        kind_out = AssetFileKind::EDITED;
+    } else if (name == "sidecar") {
+        kind_out = AssetFileKind::SIDECAR;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+std::vector<Asset> group_assets(const std::vector<std::filesystem::path>& files) {
+    struct Entry {
+        const std::filesystem::path* path;
+        std::string ext;
+        bool edited;
+    };
+
+    std::vector<Asset> assets;
+    std::vector<std::vector<Entry>> entries;
+    std::unordered_map<std::string, size_t> index;
+
+    for (const auto& file : files) {
+        std::string stem = to_upper(file.stem().string());
+        bool edited = strip_edit_marker(stem);
+
+        auto [pos, inserted] = index.try_emplace(stem, assets.size());
+        if (inserted) {
+            assets.push_back(Asset {stem, {}});
+            entries.emplace_back();
+        }
+        entries[pos->second].push_back(Entry {&file, to_upper(file.extension().string()), edited});
+    }
+
+    for (size_t i = 0; i < assets.size(); i++) {
+        bool has_still = std::any_of(entries[i].begin(), entries[i].end(), [](const Entry& entry) {
+            return !entry.edited && is_still_image(entry.ext);
+        });
+
+        for (const auto& entry : entries[i]) {
+            AssetFileKind kind = AssetFileKind::PRIMARY;
+            if (entry.ext == ".AAE") {
+                kind = AssetFileKind::SIDECAR;
+            } else if (entry.edited) {
+                kind = AssetFileKind::EDITED;
+            } else if (has_still && is_video(entry.ext)) {
+                kind = AssetFileKind::LIVE_VIDEO;
+            }
+            assets[i].files.emplace_back(*entry.path, kind);
+        }
+
+        std::stable_sort(assets[i].files.begin(), assets[i].files.end(), [](const AssetFile& a, const AssetFile& b) {
+            return a.kind < b.kind;
+        });
+    }
+
+    return assets;
+}
@@ -0,0 +1,66 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_ASSET_GROUP_H
+#define PHCOPY_ASSET_GROUP_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Role of a file inside an asset. iPhone stores one photo as several files sharing a stem:
+// IMG_1234.HEIC (primary), IMG_1234.MOV (Live Photo video), IMG_E1234.HEIC (edited copy)
+// and IMG_1234.AAE (adjustments sidecar).
+enum class AssetFileKind { PRIMARY, LIVE_VIDEO, EDITED, SIDECAR };
+
+struct AssetFile {
+    std::filesystem::path path;
+    AssetFileKind kind;
+
+    AssetFile(std::filesystem::path path, AssetFileKind kind) : path(std::move(path)), kind(kind) {}
+};
+
+struct Asset {
+    std::string key;
+    std::vector<AssetFile> files;
+};
+
+struct AssetTask {
+    Asset asset;
+    std::filesystem::path destination;
+
+    AssetTask(Asset asset, std::filesystem::path destination)
+      : asset(std::move(asset)), destination(std::move(destination)) {}
+};
+
+class AssetFilter {
+public:
+    void exclude(AssetFileKind kind) noexcept;
+    bool is_excluded(AssetFileKind kind) const noexcept;
+
+    // Removes excluded files from the asset. Returns false if nothing is left to transfer.
+    bool apply(Asset& asset) const;
+
+    static bool parse_kind(const std::string& name, AssetFileKind& kind_out) noexcept;
+
+private:
+    unsigned excluded_mask {0};
+};
+
+// Clusters files of a single folder into assets. Order of assets follows the order of their first file in the list,
+// inside an asset the primary file goes first.
+std::vector<Asset> group_assets(const std::vector<std::filesystem::path>& files);
+
+#endif // PHCOPY_ASSET_GROUP_H
@@ -0,0 +1,374 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "async_writer.h"
+
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#ifdef PHCOPY_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace {
+
+constexpr size_t WRITER_THREADS = 4;
+
+int open_temp(const std::filesystem::path& temp_file) {
+    int fd = open(temp_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Can't create file " << temp_file << ": " << strerror(errno) << std::endl;
+    }
+    return fd;
+}
+
+// Closes the synced temporary file and moves it to the final name
+bool finish_file(int fd, const std::filesystem::path& temp_file, const std::filesystem::path& destination_file) {
+    if (close(fd) < 0 || rename(temp_file.c_str(), destination_file.c_str()) < 0) {
+        std::cerr << "Can't write file " << destination_file << ": " << strerror(errno) << std::endl;
+        unlink(temp_file.c_str());
+        return false;
+    }
+    return true;
+}
+
+class ThreadPoolWriter : public AsyncWriter {
+public:
+    explicit ThreadPoolWriter(size_t max_in_flight) : pool(WRITER_THREADS, max_in_flight) {}
+
+    const char* name() const noexcept override {
+        return "threads";
+    }
+
+    void submit(const FileData& data, const std::filesystem::path& destination_file, Completion on_done) override {
+        pool.submit([this, data, destination_file, on_done = std::move(on_done)]() {
+            bool ok = write_file_synced(data, destination_file);
+            if (!ok) {
+                failed = true;
+            }
+            if (on_done) {
+                on_done(ok);
+            }
+        });
+    }
+
+    bool wait() override {
+        pool.wait();
+        return !failed;
+    }
+
+private:
+    std::atomic<bool> failed {false};
+    ThreadPool pool;
+};
+
+#ifdef PHCOPY_HAVE_LIBURING
+
+// Writes are chained with the fsync of the file in one submission, a separate thread reaps the completions,
+// closes and renames the files.
+class UringWriter : public AsyncWriter {
+public:
+    static std::unique_ptr<AsyncWriter> create(size_t max_in_flight) {
+        std::unique_ptr<UringWriter> writer(new UringWriter(max_in_flight));
+        int ret = io_uring_queue_init(RING_ENTRIES, &writer->ring, 0);
+        if (ret < 0) {
+            // Kernel without io_uring or disabled by the administrator
+            return nullptr;
+        }
+        writer->reaper = std::thread(&UringWriter::reap, writer.get());
+        return writer;
+    }
+
+    ~UringWriter() override {
+        if (!reaper.joinable()) {
+            return;
+        }
+
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(ring_mutex);
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            if (sqe == nullptr) {
+                io_uring_submit(&ring);
+                sqe = io_uring_get_sqe(&ring);
+            }
+            if (sqe == nullptr) {
+                // The kernel doesn't take submissions, the reaper can't be woken up. The ring is leaked
+                // rather than freed under the blocked reaper.
+                std::cerr << "io_uring writer can't be stopped" << std::endl;
+                reaper.detach();
+                return;
+            }
+            // Completion without an operation stops the reaper
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data(sqe, nullptr);
+            io_uring_submit(&ring);
+        }
+        reaper.join();
+        io_uring_queue_exit(&ring);
+    }
+
+    const char* name() const noexcept override {
+        return "io_uring";
+    }
+
+    void submit(const FileData& data, const std::filesystem::path& destination_file, Completion on_done) override {
+        size_t chunks = std::max<size_t>((data.size + MAX_WRITE_SIZE - 1) / MAX_WRITE_SIZE, 1);
+        if (chunks + 1 > RING_ENTRIES) {
+            // Doesn't fit into one chain
+            bool ok = write_file_synced(data, destination_file);
+            report(ok, on_done);
+            return;
+        }
+
+        acquire_slot();
+
+        auto op = std::make_unique<Operation>();
+        op->data = data;
+        op->destination = destination_file;
+        op->temp = partial_file_path(destination_file);
+        op->on_done = std::move(on_done);
+        op->fd = open_temp(op->temp);
+        if (op->fd < 0) {
+            release_slot();
+            report(false, op->on_done);
+            return;
+        }
+        op->pending = chunks + 1;
+
+        std::unique_lock<std::mutex> lock(ring_mutex);
+        if (io_uring_sq_space_left(&ring) < op->pending) {
+            io_uring_submit(&ring);
+        }
+        if (io_uring_sq_space_left(&ring) < op->pending) {
+            lock.unlock();
+            std::cerr << "io_uring submission queue is full, can't write file " << destination_file << std::endl;
+            fail(std::move(op));
+            return;
+        }
+
+        // write -> write -> ... -> fsync, a failed or short write cancels the rest of the chain
+        std::vector<io_uring_sqe*> sqes;
+        sqes.reserve(op->pending);
+        for (size_t i = 0; i < chunks; i++) {
+            size_t offset = i * MAX_WRITE_SIZE;
+            auto size = static_cast<unsigned>(std::min(MAX_WRITE_SIZE, op->data.size - offset));
+            io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_write(sqe, op->fd, op->data.data + offset, size, offset);
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe_set_data(sqe, op.get());
+            sqes.push_back(sqe);
+        }
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_fsync(sqe, op->fd, 0);
+        io_uring_sqe_set_data(sqe, op.get());
+        sqes.push_back(sqe);
+
+        int ret = io_uring_submit(&ring);
+        if (ret < 0) {
+            // Nothing was consumed, but the entries stay queued for the next submit. Without SQPOLL the kernel
+            // reads them only on submit, so they are turned into no-ops which don't refer to the operation.
+            for (auto* queued : sqes) {
+                io_uring_prep_nop(queued);
+                queued->flags = 0;
+                io_uring_sqe_set_data(queued, &DISCARDED);
+            }
+            lock.unlock();
+            std::cerr << "io_uring submit failed: " << strerror(-ret) << std::endl;
+            fail(std::move(op));
+            return;
+        }
+        // Owned by the reaper from now on
+        op.release();
+    }
+
+    bool wait() override {
+        std::unique_lock<std::mutex> lock(slots_mutex);
+        slot_released.wait(lock, [this]() { return in_flight == 0; });
+        return !failed;
+    }
+
+private:
+    static constexpr unsigned RING_ENTRIES = 256;
+    static constexpr size_t MAX_WRITE_SIZE = 1024 * 1024 * 1024;
+
+    struct Operation {
+        FileData data;
+        std::filesystem::path destination;
+        std::filesystem::path temp;
+        Completion on_done;
+        int fd {-1};
+        size_t pending {0};
+        uint64_t written {0};
+        bool failed {false};
+    };
+
+    // Marks the no-ops left from a failed submit
+    static inline char DISCARDED = 0;
+
+    explicit UringWriter(size_t max_in_flight) : max_in_flight(std::max<size_t>(max_in_flight, 1)) {}
+
+    void reap() {
+        while (true) {
+            io_uring_cqe* cqe = nullptr;
+            int ret = io_uring_wait_cqe(&ring, &cqe);
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                std::cerr << "io_uring wait failed: " << strerror(-ret) << std::endl;
+                return;
+            }
+
+            auto* op = static_cast<Operation*>(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            if (op == nullptr) {
+                return;
+            }
+            if (static_cast<void*>(op) == &DISCARDED) {
+                continue;
+            }
+
+            if (res < 0) {
+                op->failed = true;
+            } else {
+                op->written += static_cast<uint64_t>(res);
+            }
+            if (--op->pending == 0) {
+                complete(std::unique_ptr<Operation>(op));
+            }
+        }
+    }
+
+    void complete(std::unique_ptr<Operation> op) {
+        PHCOPY_TRACE_SCOPE("uring_complete", op->destination);
+
+        bool ok = false;
+        if (!op->failed && op->written == op->data.size) {
+            ok = finish_file(op->fd, op->temp, op->destination);
+        } else {
+            // Short writes or errors are retried synchronously once, the reason is reported from there
+            close(op->fd);
+            unlink(op->temp.c_str());
+            ok = write_file_synced(op->data, op->destination);
+        }
+
+        report(ok, op->on_done);
+        op.reset();
+        release_slot();
+    }
+
+    // Operation which never reached the kernel
+    void fail(std::unique_ptr<Operation> op) {
+        close(op->fd);
+        unlink(op->temp.c_str());
+        report(false, op->on_done);
+        op.reset();
+        release_slot();
+    }
+
+    void report(bool ok, const Completion& on_done) {
+        if (!ok) {
+            failed = true;
+        }
+        if (on_done) {
+            on_done(ok);
+        }
+    }
+
+    void acquire_slot() {
+        std::unique_lock<std::mutex> lock(slots_mutex);
+        slot_released.wait(lock, [this]() { return in_flight < max_in_flight; });
+        in_flight++;
+    }
+
+    void release_slot() {
+        {
+            std::lock_guard<std::mutex> lock(slots_mutex);
+            in_flight--;
+        }
+        slot_released.notify_all();
+    }
+
+    io_uring ring {};
+    std::mutex ring_mutex;
+    std::mutex slots_mutex;
+    std::condition_variable slot_released;
+    size_t in_flight {0};
+    size_t max_in_flight;
+    std::atomic<bool> failed {false};
+    std::thread reaper;
+};
+
+#endif // PHCOPY_HAVE_LIBURING
+
+} // namespace
+
+std::unique_ptr<AsyncWriter> AsyncWriter::create(size_t max_in_flight) {
+#ifdef PHCOPY_HAVE_LIBURING
+    if (auto writer = UringWriter::create(max_in_flight)) {
+        return writer;
+    }
+#endif
+    return std::make_unique<ThreadPoolWriter>(max_in_flight);
+}
+
+bool write_file_synced(const FileData& data, const std::filesystem::path& destination_file) {
+    PHCOPY_TRACE_SCOPE("write_file_synced", destination_file);
+
+    auto temp_file = partial_file_path(destination_file);
+    int fd = open_temp(temp_file);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < data.size) {
+        ssize_t ret = write(fd, data.data + written, data.size - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            std::cerr << "Can't write file " << destination_file << ": " << strerror(errno) << std::endl;
+            close(fd);
+            unlink(temp_file.c_str());
+            return false;
+        }
+        written += static_cast<size_t>(ret);
+    }
+
+    if (fsync(fd) < 0) {
+        std::cerr << "Can't sync file " << destination_file << ": " << strerror(errno) << std::endl;
+        close(fd);
+        unlink(temp_file.c_str());
+        return false;
+    }
+
+    return finish_file(fd, temp_file, destination_file);
+}
@@ -0,0 +1,51 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_ASYNC_WRITER_H
+#define PHCOPY_ASYNC_WRITER_H
+
+#include "file_data.h"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+
+// Writes downloaded files in the background, so a slow disk doesn't stall the thread driving the device.
+// Every file is written to a temporary name next to the destination, synced and renamed into place,
+// so an interrupted write never leaves a partial file under the final name.
+class AsyncWriter {
+public:
+    using Completion = std::function<void(bool ok)>;
+
+    // io_uring when built with liburing and supported by the kernel, worker threads otherwise
+    static std::unique_ptr<AsyncWriter> create(size_t max_in_flight);
+
+    virtual ~AsyncWriter() = default;
+
+    virtual const char* name() const noexcept = 0;
+
+    // Blocks while max_in_flight files are being written. on_done is called from a writer thread.
+    virtual void submit(const FileData& data,
+                        const std::filesystem::path& destination_file,
+                        Completion on_done = {}) = 0;
+
+    // Waits for all submitted files. Returns false if any write has failed so far.
+    virtual bool wait() = 0;
+};
+
+// Synchronous version of the same write, used by the thread pool writer and as a fallback
+bool write_file_synced(const FileData& data, const std::filesystem::path& destination_file);
+
+#endif // PHCOPY_ASYNC_WRITER_H
@@ -15,15 +15,52 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "command.h"
 
+#include "device_cache.h"
+#include "listing_cache.h"
+#include "session_trace.h"
+#include "trace.h"
+
+#include <iomanip>
 #include <iostream>
 
 Command::Command() : info(context) {}
 
 void Command::execute() {
+    if (!session_trace.replay_file.empty()) {
+        // No device is used
+        return;
+    }
+
     load_camera_info();
 }
 
+void Command::set_session_trace(SessionTraceOptions options) {
+    session_trace = std::move(options);
+}
+
+void Command::set_device_selection(DeviceSelection selection) {
+    device_selection = std::move(selection);
+}
+
+void Command::set_event_listener(std::shared_ptr<TransferEventListener> listener) {
+    events = listener ? std::make_shared<EventQueue>(std::move(listener)) : nullptr;
+}
+
+void Command::post_event(TransferEvent event) const {
+    if (events) {
+        events->post(std::move(event));
+    }
+}
+
+void Command::flush_events() const {
+    if (events) {
+        events->flush();
+    }
+}
+
 void Command::load_camera_info() {
+    PHCOPY_TRACE_SCOPE("load_camera_info");
+
     if (!info.load_cameras_abilities()) {
         throw std::runtime_error("Failed to load camera capabilities");
     }
@@ -40,6 +77,53 @@ GPhotoInfo& Command::get_gphoto_info() {
     return info;
 }
 
+void Command::print_storages(const std::vector<StorageInfo>& storages, std::ostream& out) {
+    constexpr double KB_IN_GB = 1024.0 * 1024.0;
+
+    auto flags = out.flags();
+    auto precision = out.precision();
+
+    uint64_t capacity = 0;
+    uint64_t free_kb = 0;
+    size_t counted = 0;
+    for (const auto& storage : storages) {
+        out << "Storage " << storage.base_dir;
+        if (!storage.description.empty() || !storage.label.empty()) {
+            out << " (" << (storage.description.empty() ? storage.label : storage.description) << ")";
+        }
+        out << ": " << std::fixed << std::setprecision(1);
+        if (storage.has_free) {
+            out << storage.free_kb / KB_IN_GB << " GB free";
+        } else {
+            out << "free space unknown";
+        }
+        if (storage.has_capacity) {
+            out << " of " << storage.capacity_kb / KB_IN_GB << " GB";
+        }
+        out << std::endl;
+
+        // Storages which report only one of the fields would skew the used space
+        if (storage.has_free && storage.has_capacity) {
+            capacity += storage.capacity_kb;
+            free_kb += storage.free_kb;
+            counted++;
+        }
+    }
+
+    if (counted > 1) {
+        out << "Total: " << (capacity - free_kb) / KB_IN_GB << " GB used of " << capacity / KB_IN_GB << " GB"
+            << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+std::filesystem::path Command::storage_path(const StorageInfo& storage, const std::filesystem::path& path) {
+    auto relative = path.relative_path();
+    std::filesystem::path base = storage.base_dir;
+    return relative.empty() ? base : base / relative;
+}
+
 CameraList* Command::autodetect_cameras() const {
     CameraList* list = nullptr;
     gp_list_new(&list);
@@ -54,6 +138,42 @@ CameraList* Command::autodetect_cameras() const {
 }
 
 GPhotoCamera Command::open_camera(size_t idx) {
+    PHCOPY_TRACE_SCOPE("open_camera");
+
+    if (!session_trace.replay_file.empty()) {
+        if (!replay) {
+            replay = SessionReplay::load(session_trace.replay_file, session_trace.replay_speed);
+            if (!replay) {
+                throw std::runtime_error {"Failed to load recorded session"};
+            }
+        }
+        GPhotoCamera camera(replay);
+        camera.set_event_queue(events);
+        return camera;
+    }
+
+    if (!session_trace.record_file.empty() && !recorder) {
+        recorder = SessionRecorder::create(session_trace.record_file);
+        if (!recorder) {
+            throw std::runtime_error {"Failed to create session recording"};
+        }
+    }
+
+    bool selected = !device_selection.serial.empty() || !device_selection.port.empty();
+    GPhotoCamera camera = selected ? open_selected_camera() : open_detected_camera(idx);
+    camera.set_event_queue(events);
+
+    if (recorder) {
+        camera.set_recorder(recorder);
+    } else if (session_trace.listing_cache) {
+        // Recordings must contain the real device calls, so the cache is used only without them
+        camera.set_listing_cache(ListingCache::open(camera.get_serial_number(), camera.get_storage_info()));
+    }
+
+    return camera;
+}
+
+GPhotoCamera Command::open_detected_camera(size_t idx) {
     CameraList* list = autodetect_cameras();
 
     if (list == nullptr) {
@@ -73,11 +193,66 @@ GPhotoCamera Command::open_camera(size_t idx) {
 
     try {
         GPhotoCamera camera(name, port, context, info);
+        // Remembered, so the device can be selected by serial number or port next time without autodetection
+        DeviceCache::store({camera.get_serial_number(), name, port});
         gp_list_free(list);
-
         return camera;
     } catch (std::runtime_error& e) {
         gp_list_free(list);
         throw;
     }
 }
+
+GPhotoCamera Command::open_selected_camera() {
+    const auto& serial = device_selection.serial;
+    const auto& port = device_selection.port;
+
+    // A known device is opened at its last port without probing the others
+    auto cached = serial.empty() ? DeviceCache::find_by_port(port) : DeviceCache::find_by_serial(serial);
+    if (cached && (port.empty() || cached->port == port)) {
+        PHCOPY_TRACE_SCOPE("open_cached_camera");
+        if (auto camera = try_open_camera(cached->model, cached->port, serial)) {
+            return std::move(*camera);
+        }
+    }
+
+    CameraList* list = autodetect_cameras();
+    if (list == nullptr) {
+        throw std::runtime_error {"No cameras available"};
+    }
+    std::unique_ptr<CameraList, int (*)(CameraList*)> list_owner(list, gp_list_free);
+
+    int devices_num = gp_list_count(list);
+    for (int i = 0; i < devices_num; i++) {
+        const char *name, *device_port;
+        gp_list_get_name(list, i, &name);
+        gp_list_get_value(list, i, &device_port);
+        if (!port.empty() && port != device_port) {
+            continue;
+        }
+
+        if (auto camera = try_open_camera(name, device_port, serial)) {
+            DeviceCache::store({camera->get_serial_number(), name, device_port});
+            return std::move(*camera);
+        }
+    }
+
+    throw std::runtime_error {"No device with the selected serial number or port"};
+}
+
+std::optional<GPhotoCamera> Command::try_open_camera(const std::string& model,
+                                                     const std::string& port,
+                                                     const std::string& serial) {
+    try {
+        GPhotoCamera camera(model.c_str(), port.c_str(), context, info);
+        if (!camera.connect()) {
+            return std::nullopt;
+        }
+        if (!serial.empty() && camera.get_serial_number() != serial) {
+            return std::nullopt;
+        }
+        return camera;
+    } catch (std::runtime_error&) {
+        return std::nullopt;
+    }
+}
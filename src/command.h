@@ -19,13 +19,42 @@
 #include "context.h"
 #include "gphoto_info.h"
 #include "gphoto_camera.h"
+#include "transfer_events.h"
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct SessionTraceOptions {
+    std::filesystem::path record_file; // Record all camera calls of the session into the file
+    std::filesystem::path replay_file; // Serve camera calls from the recorded session instead of a device
+    double replay_speed {1.0};         // Replay N times faster than recorded, 0 for no delays
+    std::filesystem::path trace_file;  // Timeline of spans in Chrome trace event format
+    bool listing_cache {true};         // Reuse folder listings of unchanged storages from previous runs
+};
+
+// Device opened instead of the one with the index of the command, if either is set
+struct DeviceSelection {
+    std::string port;   // Open the device at the port
+    std::string serial; // Open the device with the serial number
+};
 
 class Command {
 public:
     Command();
+    virtual ~Command() = default;
 
     virtual void execute();
 
+    void set_session_trace(SessionTraceOptions options);
+    void set_device_selection(DeviceSelection selection);
+
+    // Progress and errors are reported to the listener instead of being printed
+    void set_event_listener(std::shared_ptr<TransferEventListener> listener);
+
 protected:
     void load_camera_info();
     Context& get_context();
@@ -33,9 +62,34 @@ protected:
     CameraList* autodetect_cameras() const;
     GPhotoCamera open_camera(size_t idx);
 
+    // Events are dropped without a listener
+    void post_event(TransferEvent event) const;
+    // Waits until the listener has received all events, e.g. before printing directly
+    void flush_events() const;
+
+    // Capacity and free space of every storage
+    static void print_storages(const std::vector<StorageInfo>& storages, std::ostream& out);
+
+    // Path inside the storage, leading separators of the path are ignored
+    static std::filesystem::path storage_path(const StorageInfo& storage, const std::filesystem::path& path);
+
 private:
+    // Device number idx of the autodetected list
+    GPhotoCamera open_detected_camera(size_t idx);
+    // Device chosen by serial number or port, directly if it's cached and probing all ports otherwise
+    GPhotoCamera open_selected_camera();
+    // nullopt if no device answers at the port or it has another serial number
+    std::optional<GPhotoCamera> try_open_camera(const std::string& model,
+                                                const std::string& port,
+                                                const std::string& serial);
+
     Context context;
     GPhotoInfo info {context};
+    SessionTraceOptions session_trace;
+    DeviceSelection device_selection;
+    std::shared_ptr<SessionRecorder> recorder;
+    std::shared_ptr<SessionReplay> replay;
+    std::shared_ptr<EventQueue> events;
 };
 
 
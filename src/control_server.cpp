@@ -0,0 +1,248 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "control_server.h"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr char WAKE_CANCEL = 'c';
+constexpr char WAKE_PAUSE = 'p';
+constexpr char WAKE_RESUME = 'r';
+constexpr char WAKE_STOP = 'q';
+
+constexpr int HANDLED_SIGNALS[] = {SIGINT, SIGTERM, SIGUSR1, SIGUSR2};
+
+// Signal handlers only forward the request to the server thread through the pipe
+std::atomic<int> signal_fd {-1};
+
+void notify(int fd, char code) {
+    while (write(fd, &code, 1) < 0 && errno == EINTR) {
+    }
+}
+
+// A socket left behind by a crashed run makes bind fail. It is removed only if nothing accepts connections
+// on it, so a second instance doesn't take over the socket of a running one.
+void remove_stale_socket(const sockaddr_un& address) {
+    struct stat st {};
+    if (lstat(address.sun_path, &st) < 0 || !S_ISSOCK(st.st_mode)) {
+        return;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return;
+    }
+    bool stale = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 &&
+                 errno == ECONNREFUSED;
+    close(fd);
+
+    if (stale) {
+        unlink(address.sun_path);
+    }
+}
+
+} // namespace
+
+ControlServer::ControlServer(std::shared_ptr<TransferControl> control) : control(std::move(control)) {}
+
+ControlServer::~ControlServer() {
+    if (thread.joinable()) {
+        notify(wake_fds[1], WAKE_STOP);
+        thread.join();
+    }
+
+    int expected = wake_fds[1];
+    if (signal_fd.compare_exchange_strong(expected, -1)) {
+        for (int signal : HANDLED_SIGNALS) {
+            std::signal(signal, SIG_DFL);
+        }
+    }
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_file.c_str());
+    }
+    for (int fd : wake_fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool ControlServer::start(const std::filesystem::path& socket_path) {
+    if (pipe(wake_fds) < 0) {
+        std::cerr << "Can't create pipe: " << strerror(errno) << std::endl;
+        return false;
+    }
+    fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    if (!socket_path.empty()) {
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        if (socket_path.native().size() >= sizeof(address.sun_path)) {
+            std::cerr << "Control socket path is too long: " << socket_path << std::endl;
+            return false;
+        }
+        strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+        remove_stale_socket(address);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            listen(listen_fd, 4) < 0) {
+            std::cerr << "Can't listen on control socket " << socket_path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        socket_file = socket_path;
+    }
+
+    signal_fd = wake_fds[1];
+    for (int signal : HANDLED_SIGNALS) {
+        std::signal(signal, &ControlServer::on_signal);
+    }
+
+    thread = std::thread(&ControlServer::serve, this);
+    return true;
+}
+
+void ControlServer::on_signal(int signal) {
+    int fd = signal_fd;
+    if (fd < 0) {
+        return;
+    }
+
+    if (signal == SIGUSR1) {
+        notify(fd, WAKE_PAUSE);
+    } else if (signal == SIGUSR2) {
+        notify(fd, WAKE_RESUME);
+    } else {
+        // Let the next one terminate the process if the cancellation gets stuck
+        std::signal(signal, SIG_DFL);
+        notify(fd, WAKE_CANCEL);
+    }
+}
+
+void ControlServer::serve() {
+    struct Client {
+        int fd;
+        std::string input;
+    };
+    std::vector<Client> clients;
+
+    while (true) {
+        std::vector<pollfd> fds;
+        fds.push_back({wake_fds[0], POLLIN, 0});
+        if (listen_fd >= 0) {
+            fds.push_back({listen_fd, POLLIN, 0});
+        }
+        size_t clients_pos = fds.size();
+        for (const auto& client : clients) {
+            fds.push_back({client.fd, POLLIN, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Control server failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char codes[16];
+            ssize_t count = read(wake_fds[0], codes, sizeof(codes));
+            for (ssize_t i = 0; i < count; i++) {
+                if (codes[i] == WAKE_STOP) {
+                    for (const auto& client : clients) {
+                        close(client.fd);
+                    }
+                    return;
+                }
+                execute(codes[i] == WAKE_CANCEL ? "cancel" : codes[i] == WAKE_PAUSE ? "pause" : "resume");
+            }
+        }
+
+        if (listen_fd >= 0 && (fds[1].revents & POLLIN)) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                clients.push_back({fd, {}});
+            }
+        }
+
+        // Iterate backwards, so closed clients can be erased
+        for (size_t i = fds.size(); i-- > clients_pos;) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            auto& client = clients[i - clients_pos];
+
+            char buffer[256];
+            ssize_t count = read(client.fd, buffer, sizeof(buffer));
+            if (count > 0) {
+                client.input.append(buffer, static_cast<size_t>(count));
+                for (auto end = client.input.find('\n'); end != std::string::npos; end = client.input.find('\n')) {
+                    auto reply = execute(client.input.substr(0, end)) + "\n";
+                    client.input.erase(0, end + 1);
+                    send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+                }
+            }
+            if (count <= 0 || client.input.size() > 4096) {
+                close(client.fd);
+                clients.erase(clients.begin() + static_cast<std::ptrdiff_t>(i - clients_pos));
+            }
+        }
+    }
+}
+
+std::string ControlServer::execute(const std::string& line) {
+    auto command = line.substr(0, line.find(' '));
+    auto argument = command.size() < line.size() ? line.substr(command.size() + 1) : std::string {};
+    if (!argument.empty() && argument.back() == '\r') {
+        argument.pop_back();
+    }
+    if (!command.empty() && command.back() == '\r') {
+        command.pop_back();
+    }
+
+    if (command == "pause") {
+        control->pause();
+        std::cerr << "Download paused" << std::endl;
+    } else if (command == "resume") {
+        control->resume();
+        std::cerr << "Download resumed" << std::endl;
+    } else if (command == "cancel") {
+        control->cancel();
+        std::cerr << "Cancelling download..." << std::endl;
+    } else if (command == "prioritize" && !argument.empty()) {
+        control->prioritize(argument);
+    } else if (command == "status") {
+        return control->is_cancelled() ? "OK cancelled" : control->is_paused() ? "OK paused" : "OK running";
+    } else {
+        return "ERROR unknown command";
+    }
+    return "OK";
+}
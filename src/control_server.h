@@ -0,0 +1,58 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_CONTROL_SERVER_H
+#define PHCOPY_CONTROL_SERVER_H
+
+#include "transfer_control.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Applies external requests to a TransferControl while it is alive.
+//
+// Signals: SIGINT and SIGTERM cancel the download (a second one terminates the process),
+// SIGUSR1 pauses and SIGUSR2 resumes it.
+//
+// The optional control socket is a unix stream socket accepting one command per line:
+//   pause | resume | cancel | prioritize FOLDER | status
+// Every command is answered with a line starting with OK or ERROR.
+class ControlServer {
+public:
+    explicit ControlServer(std::shared_ptr<TransferControl> control);
+    ~ControlServer();
+
+    ControlServer(const ControlServer&) = delete;
+    ControlServer& operator=(const ControlServer&) = delete;
+
+    // Installs the signal handlers and starts listening on socket_file if it's not empty
+    bool start(const std::filesystem::path& socket_file);
+
+private:
+    void serve();
+    std::string execute(const std::string& line);
+
+    static void on_signal(int signal);
+
+    std::shared_ptr<TransferControl> control;
+    std::filesystem::path socket_file;
+    int listen_fd {-1};
+    int wake_fds[2] {-1, -1};
+    std::thread thread;
+};
+
+#endif // PHCOPY_CONTROL_SERVER_H
@@ -0,0 +1,203 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "delete_queue.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t VERIFY_BUFFER_SIZE = 1024 * 1024;
+
+bool sync_path(const std::filesystem::path& path, int flags) {
+    int fd = open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool result = fsync(fd) == 0;
+    close(fd);
+    return result;
+}
+
+} // namespace
+
+DeleteQueue::DeleteQueue(size_t batch_size)
+  : batch_size(std::max<size_t>(batch_size, 1)), verifier_thread(&DeleteQueue::verifier, this) {}
+
+DeleteQueue::~DeleteQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    verifier_thread.join();
+}
+
+void DeleteQueue::add(DeleteCandidate candidate) {
+    current_asset.push_back(std::move(candidate));
+}
+
+void DeleteQueue::commit_asset() {
+    if (current_asset.empty()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending += current_asset.size();
+        unverified.push_back(std::move(current_asset));
+    }
+    current_asset.clear();
+    changed.notify_all();
+}
+
+void DeleteQueue::drop_asset() {
+    current_asset.clear();
+}
+
+bool DeleteQueue::is_batch_ready() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return verified_files >= batch_size;
+}
+
+void DeleteQueue::delete_verified(const GPhotoCamera& camera) {
+    std::deque<AssetFiles> assets;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        assets.swap(verified);
+        verified_files = 0;
+    }
+    if (assets.empty()) {
+        return;
+    }
+
+    PHCOPY_TRACE_SCOPE("delete_batch");
+
+    size_t finished = 0;
+    for (const auto& asset : assets) {
+        finished += asset.size();
+        for (const auto& candidate : asset) {
+            if (!camera.delete_file(candidate.source)) {
+                // Keep the rest of the asset, at least the copies are complete
+                break;
+            }
+            deleted++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    pending -= finished;
+}
+
+void DeleteQueue::flush(const GPhotoCamera& camera) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return unverified.empty() && !verifying; });
+    }
+    delete_verified(camera);
+}
+
+size_t DeleteQueue::pending_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+size_t DeleteQueue::deleted_count() const noexcept {
+    return deleted;
+}
+
+void DeleteQueue::verifier() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this]() { return stopping || !unverified.empty(); });
+        if (unverified.empty()) {
+            return;
+        }
+
+        auto asset = std::move(unverified.front());
+        unverified.pop_front();
+        verifying = true;
+        lock.unlock();
+
+        bool result = true;
+        {
+            PHCOPY_TRACE_SCOPE("verify_asset", asset.front().source);
+            for (const auto& candidate : asset) {
+                for (const auto& file : candidate.destination_files) {
+                    result = result && verify_copy(candidate, file);
+                }
+            }
+        }
+        if (!result) {
+            std::cerr << "Copy of " << asset.front().source << " doesn't match, keeping it on the device" << std::endl;
+        }
+
+        lock.lock();
+        verifying = false;
+        if (result) {
+            verified_files += asset.size();
+            verified.push_back(std::move(asset));
+        } else {
+            pending -= asset.size();
+        }
+        changed.notify_all();
+    }
+}
+
+bool DeleteQueue::verify_copy(const DeleteCandidate& candidate, const std::filesystem::path& file) {
+    // The copy and its name must survive a power loss before the original is gone
+    if (!sync_path(file.parent_path(), O_RDONLY | O_DIRECTORY)) {
+        return false;
+    }
+
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat {};
+    if (fsync(fd) != 0 || fstat(fd, &file_stat) != 0 || static_cast<uint64_t>(file_stat.st_size) != candidate.size) {
+        close(fd);
+        return false;
+    }
+
+    // Drop the synced pages from the cache, so the copy is read back from the disk and a bad write or
+    // a full disk can't pass for a verified file
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    std::vector<char> buffer(VERIFY_BUFFER_SIZE);
+    Sha256 sha;
+    bool result = true;
+    while (true) {
+        ssize_t ret = read(fd, buffer.data(), buffer.size());
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            result = ret == 0;
+            break;
+        }
+        sha.update(buffer.data(), static_cast<size_t>(ret));
+    }
+    close(fd);
+
+    return result && sha.finish() == candidate.digest;
+}
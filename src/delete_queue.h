@@ -0,0 +1,88 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_DELETE_QUEUE_H
+#define PHCOPY_DELETE_QUEUE_H
+
+#include "gphoto_camera.h"
+#include "sha256.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct DeleteCandidate {
+    std::filesystem::path source;                         // File on the device
+    uint64_t size {0};                                    // Size reported by the device
+    Sha256::Digest digest {};                             // Checksum of the transferred data
+    std::vector<std::filesystem::path> destination_files; // Every copy which must match before deletion
+};
+
+// Files to remove from the device once their copies are verified. Files are collected per asset and an asset
+// is deleted only as a whole, so a Live Photo never loses its video while the still remains on the device.
+// Committed assets are verified by a background thread while the transfer goes on: every copy is synced
+// together with its folder and read back from the disk. Deletes of the verified assets are issued in batches
+// between transfers, in the same camera session.
+class DeleteQueue {
+public:
+    explicit DeleteQueue(size_t batch_size);
+    ~DeleteQueue();
+
+    DeleteQueue(const DeleteQueue&) = delete;
+    DeleteQueue& operator=(const DeleteQueue&) = delete;
+
+    // Adds a file of the asset being downloaded
+    void add(DeleteCandidate candidate);
+    void commit_asset();
+    void drop_asset();
+
+    // A batch of verified files is waiting for deletion
+    bool is_batch_ready() const;
+
+    // Deletes the assets verified so far from the device
+    void delete_verified(const GPhotoCamera& camera);
+
+    // Waits until all committed assets are verified and deletes them from the device
+    void flush(const GPhotoCamera& camera);
+
+    size_t pending_count() const;
+    size_t deleted_count() const noexcept;
+
+private:
+    using AssetFiles = std::vector<DeleteCandidate>;
+
+    void verifier();
+    static bool verify_copy(const DeleteCandidate& candidate, const std::filesystem::path& file);
+
+    size_t batch_size;
+    AssetFiles current_asset;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<AssetFiles> unverified;
+    std::deque<AssetFiles> verified;
+    size_t verified_files {0};
+    bool verifying {false};
+    bool stopping {false};
+    size_t pending {0}; // Committed files neither deleted nor rejected yet
+    size_t deleted {0};
+    std::thread verifier_thread;
+};
+
+#endif // PHCOPY_DELETE_QUEUE_H
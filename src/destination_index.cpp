@@ -0,0 +1,109 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "destination_index.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+// Folder preparation is bound by filesystem latency, not by CPU
+constexpr size_t MAX_PREPARE_THREADS = 16;
+
+} // namespace
+
+bool DestinationIndex::prepare(std::vector<std::filesystem::path> folders, bool create) {
+    PHCOPY_TRACE_SCOPE("prepare_destinations");
+
+    std::sort(folders.begin(), folders.end());
+    folders.erase(std::unique(folders.begin(), folders.end()), folders.end());
+
+    std::vector<std::unordered_set<std::string>> entries(folders.size());
+    std::vector<char> prepared(folders.size());
+    std::atomic<size_t> next {0};
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < folders.size(); i = next++) {
+            prepared[i] = prepare_folder(folders[i], create, entries[i]);
+        }
+    };
+
+    size_t threads_count = std::min(folders.size(), MAX_PREPARE_THREADS);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threads_count; i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    bool result = true;
+    for (size_t i = 0; i < folders.size(); i++) {
+        if (prepared[i]) {
+            folders_entries[folders[i].string()] = std::move(entries[i]);
+        } else {
+            failed_folders.insert(folders[i].string());
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+bool DestinationIndex::contains(const std::filesystem::path& folder, const std::filesystem::path& filename) const {
+    auto pos = folders_entries.find(folder.string());
+    if (pos == folders_entries.end()) {
+        return false;
+    }
+
+    return pos->second.count(filename.string()) > 0;
+}
+
+bool DestinationIndex::is_prepared(const std::filesystem::path& folder) const {
+    return failed_folders.count(folder.string()) == 0;
+}
+
+bool DestinationIndex::prepare_folder(const std::filesystem::path& folder,
+                                      bool create,
+                                      std::unordered_set<std::string>& entries) {
+    std::error_code ec;
+    if (create) {
+        std::filesystem::create_directories(folder, ec);
+        if (ec) {
+            std::cerr << "Can't create folder " << folder << ": " << ec.message() << std::endl;
+            return false;
+        }
+    } else if (!std::filesystem::exists(folder, ec)) {
+        // Nothing is downloaded there yet
+        return true;
+    }
+
+    for (std::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        entries.insert(it->path().filename().string());
+    }
+
+    if (ec) {
+        std::cerr << "Can't read folder " << folder << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    return true;
+}
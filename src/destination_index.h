@@ -0,0 +1,48 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_DESTINATION_INDEX_H
+#define PHCOPY_DESTINATION_INDEX_H
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// In-memory view of destination folders. Folders are created and read once, in parallel,
+// then existence checks don't touch the filesystem. Useful when the destination is a network share
+// and every stat is a round trip.
+class DestinationIndex {
+public:
+    // Creates missing folders if create is set and reads entries of all of them. Duplicates are allowed.
+    // Returns false if some folder can't be created or read.
+    bool prepare(std::vector<std::filesystem::path> folders, bool create);
+
+    bool contains(const std::filesystem::path& folder, const std::filesystem::path& filename) const;
+
+    // False if the folder couldn't be created or read by prepare
+    bool is_prepared(const std::filesystem::path& folder) const;
+
+private:
+    static bool prepare_folder(const std::filesystem::path& folder,
+                               bool create,
+                               std::unordered_set<std::string>& entries);
+
+    std::unordered_map<std::string, std::unordered_set<std::string>> folders_entries;
+    std::unordered_set<std::string> failed_folders;
+};
+
+#endif // PHCOPY_DESTINATION_INDEX_H
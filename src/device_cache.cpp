@@ -0,0 +1,127 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "device_cache.h"
+
+#include "listing_cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const char DEVICES_FILE[] = "devices";
+
+// "serial<TAB>model<TAB>port" lines
+std::vector<CachedDevice> load_devices(const std::filesystem::path& file) {
+    std::vector<CachedDevice> devices;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto model_pos = line.find('\t');
+        auto port_pos = model_pos == std::string::npos ? model_pos : line.find('\t', model_pos + 1);
+        if (port_pos == std::string::npos) {
+            continue;
+        }
+
+        CachedDevice device;
+        device.serial = line.substr(0, model_pos);
+        device.model = line.substr(model_pos + 1, port_pos - model_pos - 1);
+        device.port = line.substr(port_pos + 1);
+        devices.push_back(std::move(device));
+    }
+    return devices;
+}
+
+bool is_valid_field(const std::string& value) {
+    return value.find_first_of("\t\n") == std::string::npos;
+}
+
+} // namespace
+
+std::optional<CachedDevice> DeviceCache::find_by_serial(const std::string& serial) {
+    auto folder = user_cache_folder();
+    if (folder.empty() || serial.empty()) {
+        return std::nullopt;
+    }
+
+    for (auto& device : load_devices(folder / DEVICES_FILE)) {
+        if (device.serial == serial) {
+            return std::move(device);
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<CachedDevice> DeviceCache::find_by_port(const std::string& port) {
+    auto folder = user_cache_folder();
+    if (folder.empty() || port.empty()) {
+        return std::nullopt;
+    }
+
+    for (auto& device : load_devices(folder / DEVICES_FILE)) {
+        if (device.port == port) {
+            return std::move(device);
+        }
+    }
+    return std::nullopt;
+}
+
+void DeviceCache::store(const CachedDevice& device) {
+    auto folder = user_cache_folder();
+    if (folder.empty() || device.model.empty() || device.port.empty() || !is_valid_field(device.serial) ||
+        !is_valid_field(device.model) || !is_valid_field(device.port)) {
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(folder, ec);
+    if (ec) {
+        return;
+    }
+
+    auto file = folder / DEVICES_FILE;
+    auto devices = load_devices(file);
+    // Devices are stored on every open, the file is rewritten only when the entry changes
+    bool unchanged = std::any_of(devices.begin(), devices.end(), [&](const CachedDevice& cached) {
+        return cached.serial == device.serial && cached.model == device.model && cached.port == device.port;
+    });
+    if (unchanged) {
+        return;
+    }
+
+    auto pos = std::remove_if(devices.begin(), devices.end(), [&](const CachedDevice& cached) {
+        return cached.port == device.port || (!device.serial.empty() && cached.serial == device.serial);
+    });
+    devices.erase(pos, devices.end());
+    devices.push_back(device);
+
+    // Written aside and renamed, so a reader or another instance never sees a truncated file.
+    // The temporary name is per process, several instances may store their devices at once.
+    auto temp_file = file;
+    temp_file += ".tmp." + std::to_string(getpid());
+    std::ofstream out(temp_file, std::ios::trunc);
+    for (const auto& cached : devices) {
+        out << cached.serial << '\t' << cached.model << '\t' << cached.port << '\n';
+    }
+    out.close();
+
+    if (!out || (std::filesystem::rename(temp_file, file, ec), ec)) {
+        std::filesystem::remove(temp_file, ec);
+    }
+}
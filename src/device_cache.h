@@ -0,0 +1,40 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_DEVICE_CACHE_H
+#define PHCOPY_DEVICE_CACHE_H
+
+#include <optional>
+#include <string>
+
+struct CachedDevice {
+    std::string serial; // Empty if the driver doesn't report it
+    std::string model;
+    std::string port;
+};
+
+// Model and port of the devices opened before, so a device selected by its serial number or port
+// is opened directly instead of probing all ports. Entries may be stale, e.g. after the device was
+// plugged into another port, callers verify the device and fall back to autodetection.
+class DeviceCache {
+public:
+    static std::optional<CachedDevice> find_by_serial(const std::string& serial);
+    static std::optional<CachedDevice> find_by_port(const std::string& port);
+
+    // Replaces the entries of the same serial number or port
+    static void store(const CachedDevice& device);
+};
+
+#endif // PHCOPY_DEVICE_CACHE_H
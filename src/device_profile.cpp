@@ -0,0 +1,94 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "device_profile.h"
+
+#include <cstring>
+#include <string_view>
+
+namespace {
+
+constexpr int APPLE_USB_VENDOR = 0x05ac;
+
+// iPhones and iPads expose /store_XXXXXXXX/DCIM/NNNAPPLE/IMG_NNNN.EXT, i.e. files only in the third level
+constexpr int DCIM_STORAGE_DEPTH = 1;
+constexpr int DCIM_ROOT_DEPTH = 2;
+constexpr int DCIM_FOLDER_DEPTH = 3;
+constexpr int DCIM_FILE_DEPTH = 4;
+
+} // namespace
+
+const DeviceProfile DeviceProfile::GENERIC {"generic", Layout::GENERIC};
+const DeviceProfile DeviceProfile::APPLE {"apple", Layout::APPLE_DCIM};
+
+const DeviceProfile& DeviceProfile::detect(const CameraAbilities& abilities) {
+    if (abilities.usb_vendor == APPLE_USB_VENDOR || strncmp(abilities.model, "Apple", 5) == 0) {
+        return APPLE;
+    }
+    return GENERIC;
+}
+
+const char* DeviceProfile::name() const noexcept {
+    return profile_name;
+}
+
+RemotePathKind DeviceProfile::classify(const std::filesystem::path& path) const {
+    int depth = dcim_depth(path);
+    if (depth == DCIM_FILE_DEPTH) {
+        return RemotePathKind::FILE;
+    }
+    if (depth >= DCIM_STORAGE_DEPTH) {
+        return RemotePathKind::FOLDER;
+    }
+    return RemotePathKind::UNKNOWN;
+}
+
+bool DeviceProfile::may_contain_files(const std::filesystem::path& folder) const {
+    int depth = dcim_depth(folder);
+    return depth < 0 || depth == DCIM_FOLDER_DEPTH;
+}
+
+bool DeviceProfile::may_contain_folders(const std::filesystem::path& folder) const {
+    int depth = dcim_depth(folder);
+    return depth < 0 || depth < DCIM_FOLDER_DEPTH;
+}
+
+int DeviceProfile::dcim_depth(const std::filesystem::path& path) const {
+    if (layout != Layout::APPLE_DCIM || !path.has_root_directory()) {
+        return -1;
+    }
+
+    int depth = 0;
+    for (const auto& part : path.relative_path()) {
+        if (part.empty()) {
+            // Trailing separator
+            continue;
+        }
+
+        depth++;
+        std::string_view name = part.native();
+        if (depth == DCIM_STORAGE_DEPTH && name.substr(0, 6) != "store_") {
+            return -1;
+        }
+        if (depth == DCIM_ROOT_DEPTH && name != "DCIM") {
+            return -1;
+        }
+        if (depth > DCIM_FILE_DEPTH) {
+            return -1;
+        }
+    }
+
+    return depth == 0 ? -1 : depth;
+}
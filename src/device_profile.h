@@ -0,0 +1,54 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_DEVICE_PROFILE_H
+#define PHCOPY_DEVICE_PROFILE_H
+
+#include <gphoto2/gphoto2.h>
+
+#include <filesystem>
+
+enum class RemotePathKind { UNKNOWN, FOLDER, FILE };
+
+// Known folder layout of a device family, used to skip listings which can't return anything.
+// Generic devices have no known layout and every folder is listed for both files and subfolders.
+class DeviceProfile {
+public:
+    static const DeviceProfile& detect(const CameraAbilities& abilities);
+
+    const char* name() const noexcept;
+
+    // Tells whether the path is a file or a folder without asking the device, if the layout allows it
+    RemotePathKind classify(const std::filesystem::path& path) const;
+
+    bool may_contain_files(const std::filesystem::path& folder) const;
+    bool may_contain_folders(const std::filesystem::path& folder) const;
+
+private:
+    enum class Layout { GENERIC, APPLE_DCIM };
+
+    constexpr DeviceProfile(const char* name, Layout layout) : profile_name(name), layout(layout) {}
+
+    static const DeviceProfile GENERIC;
+    static const DeviceProfile APPLE;
+
+    // Depth of the path inside the DCIM layout, or -1 if the path is outside of it
+    int dcim_depth(const std::filesystem::path& path) const;
+
+    const char* profile_name;
+    Layout layout;
+};
+
+#endif // PHCOPY_DEVICE_PROFILE_H
@@ -0,0 +1,68 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "diff_command.h"
+
+#include "snapshot.h"
+
+#include <iostream>
+
+DiffCommand::DiffCommand(size_t device_idx, std::filesystem::path old_snapshot, std::filesystem::path new_snapshot)
+  : device_idx(device_idx), old_snapshot(std::move(old_snapshot)), new_snapshot(std::move(new_snapshot)) {}
+
+void DiffCommand::execute() {
+    try {
+        auto old_tree = Snapshot::load(old_snapshot);
+        if (!old_tree) {
+            return;
+        }
+
+        std::optional<Snapshot> new_tree;
+        if (new_snapshot.empty()) {
+            Command::execute();
+
+            GPhotoCamera camera = open_camera(device_idx);
+            new_tree = Snapshot::capture(camera, old_tree->get_root());
+        } else {
+            new_tree = Snapshot::load(new_snapshot);
+            if (!new_tree) {
+                return;
+            }
+        }
+
+        size_t added = 0, modified = 0, removed = 0;
+        std::string output;
+        for (const auto& diff : diff_snapshots(*old_tree, *new_tree)) {
+            switch (diff.kind) {
+                case DiffKind::ADDED:
+                    added++;
+                    break;
+                case DiffKind::MODIFIED:
+                    modified++;
+                    break;
+                case DiffKind::REMOVED:
+                    removed++;
+                    continue;
+            }
+            output += diff.entry->path;
+            output += '\n';
+        }
+
+        std::cout << output << std::flush;
+        std::cerr << "Added: " << added << ", modified: " << modified << ", removed: " << removed << std::endl;
+    } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
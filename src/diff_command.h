@@ -0,0 +1,37 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_DIFF_COMMAND_H
+#define PHCOPY_DIFF_COMMAND_H
+
+#include "command.h"
+
+#include <filesystem>
+
+// Compares a snapshot with another snapshot or with the live device. New and modified files
+// are printed one per line, so the output can be passed to download --files-from.
+class DiffCommand : public Command {
+public:
+    DiffCommand(size_t device_idx, std::filesystem::path old_snapshot, std::filesystem::path new_snapshot);
+
+    void execute() override;
+
+private:
+    size_t device_idx;
+    std::filesystem::path old_snapshot;
+    std::filesystem::path new_snapshot; // Empty for comparing with the device
+};
+
+#endif // PHCOPY_DIFF_COMMAND_H
@@ -15,125 +15,953 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "download_command.h"
 
+#include "control_server.h"
+#include "trace.h"
+
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+constexpr double MIN_MEASURED_SECONDS = 10;
+// Assets downloaded by one task of the incremental download, idle workers steal the rest of the folder
+constexpr size_t INCREMENTAL_BATCH_ASSETS = 16;
+
+std::string format_size(uint64_t bytes) {
+    constexpr const char* UNITS[] = {"B", "KB", "MB", "GB", "TB"};
+
+    auto value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024 && unit + 1 < std::size(UNITS)) {
+        value /= 1024;
+        unit++;
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << ' ' << UNITS[unit];
+    return out.str();
+}
+
+} // namespace
 
 DownloadCommand::DownloadCommand(size_t device_idx,
                                  std::filesystem::path source,
                                  std::filesystem::path destination,
-                                 bool recursive,
-                                 bool skip_existing)
+                                 DownloadOptions options)
   : device_idx(device_idx),
     source(std::move(source)),
     destination(std::move(destination)),
-    recursive(recursive),
-    skip_existing(skip_existing) {}
+    options(std::move(options)) {}
 
 void DownloadCommand::execute() {
     try {
         Command::execute();
 
         GPhotoCamera camera = open_camera(device_idx);
-        if (source.has_filename()) {
-            // might be the file
-            auto source_parent = source.parent_path();
-
-            auto folders = camera.list_folders(source_parent);
-            auto folders_pos = std::find(folders.begin(), folders.end(), source);
-            if (folders_pos != folders.end()) {
-                // source is a folder
-                do_download_folder(camera, source, destination);
-            } else {
-                auto files = camera.list_files(source_parent);
-                auto files_pos = std::find(files.begin(), files.end(), source);
+        profile = &DeviceProfile::detect(camera.get_abilities());
+        device_key = camera.get_serial_number();
+        if (device_key.empty()) {
+            device_key = camera.get_abilities().model;
+        }
+
+        control = std::make_shared<TransferControl>();
+        control->attach(get_context());
+        ControlServer control_server(control);
+        if (!control_server.start(options.control_socket)) {
+            return;
+        }
 
-                if (files_pos == files.end()) {
-                    std::cerr << "Can't find file " << source << std::endl;
+        if (!options.transforms.empty()) {
+            transform_stage = std::make_unique<TransformStage>(options.transforms);
+        }
+        if (options.pack) {
+            pack_writer = std::make_unique<PackWriter>(destination, options.max_pack_size);
+        }
+        if (options.async_write) {
+            async_writer = AsyncWriter::create(options.max_async_writes);
+        }
+        if (options.delete_after_verify) {
+            delete_queue = std::make_unique<DeleteQueue>(options.delete_batch_size);
+        }
+        if (!options.mirrors.empty() || !options.manifest_file.empty()) {
+            for (const auto& mirror : options.mirrors) {
+                if (!std::filesystem::is_directory(mirror)) {
+                    std::cerr << "Folder doesn't exist: " << mirror << std::endl;
+                    return;
+                }
+            }
+
+            std::shared_ptr<Manifest> manifest;
+            if (!options.manifest_file.empty() && !options.dry_run) {
+                manifest = Manifest::create(options.manifest_file, target_paths(destination));
+                if (!manifest) {
                     return;
                 }
+            }
+            fan_out = std::make_unique<FanOutWriter>(
+                    options.mirrors.size() + 1, options.max_queued_writes, std::move(manifest));
+        }
+
+        if (!options.plan_file.empty() && !options.dry_run) {
+            auto plan = TransferPlan::load(options.plan_file);
+            if (plan) {
+                for (const auto& planned : plan->get_files()) {
+                    known_sizes[planned.source.string()] = planned.size;
+                }
+                do_download_plan(camera, *plan);
+            }
+        } else if (options.all_storages) {
+            do_download_storages(camera);
+        } else if (!options.files_from.empty()) {
+            do_download_list(camera);
+        } else if (source.has_filename()) {
+            // might be the file, known layouts tell it without asking the device
+            auto kind = profile->classify(source);
+            if (kind == RemotePathKind::UNKNOWN) {
+                kind = probe_source(camera);
+            }
 
-                // source is a file
-                do_download_file(camera, source, destination);
+            if (kind == RemotePathKind::FOLDER) {
+                do_download_folder(camera, source, destination);
+            } else if (kind == RemotePathKind::FILE) {
+                std::vector<AssetTask> assets;
+                Asset asset {source.filename().string(), {AssetFile {source, AssetFileKind::PRIMARY}}};
+                assets.emplace_back(std::move(asset), destination);
+                download_assets(camera, assets);
             }
         } else {
             // source is definitely a folder
             do_download_folder(camera, source, destination);
         }
+
+        flush_events();
+        if (control->is_cancelled()) {
+            std::cerr << "Download cancelled" << std::endl;
+        }
+        if (fan_out && !fan_out->wait()) {
+            std::cerr << "Some of the files were not written to all destinations" << std::endl;
+        }
+        if (async_writer && !async_writer->wait()) {
+            std::cerr << "Some of the files were not written" << std::endl;
+        }
+        if (transform_stage && !transform_stage->finish(target_paths(destination))) {
+            std::cerr << "Some of the files were not processed" << std::endl;
+        }
+        if (pack_writer && !pack_writer->finish()) {
+            std::cerr << "Failed to finish pack in " << destination << std::endl;
+        }
+        if (delete_queue) {
+            if (control->is_cancelled()) {
+                std::cerr << delete_queue->pending_count() << " verified files were left on the device" << std::endl;
+            } else {
+                flush_deletes(camera);
+            }
+            std::cout << "Deleted from the device: " << delete_queue->deleted_count() << " files" << std::endl;
+        }
     } catch (std::runtime_error& e) {
+        flush_events();
         std::cerr << e.what() << std::endl;
     }
 }
 
-void DownloadCommand::do_download_file(const GPhotoCamera& camera,
+RemotePathKind DownloadCommand::probe_source(const GPhotoCamera& camera) const {
+    auto source_parent = source.parent_path();
+
+    auto folders = camera.list_folders(source_parent);
+    if (std::find(folders.begin(), folders.end(), source) != folders.end()) {
+        return RemotePathKind::FOLDER;
+    }
+
+    auto files = camera.list_files(source_parent);
+    if (std::find(files.begin(), files.end(), source) != files.end()) {
+        return RemotePathKind::FILE;
+    }
+
+    std::cerr << "Can't find file " << source << std::endl;
+    return RemotePathKind::UNKNOWN;
+}
+
+DownloadCommand::Layout DownloadCommand::select_layout() const {
+    if (pack_writer) {
+        return Layout::PACK;
+    }
+    if (fan_out) {
+        return Layout::FAN_OUT;
+    }
+    if (async_writer) {
+        return Layout::ASYNC;
+    }
+    // Keep the file in memory, so the transforms and the verification don't have to read it back from the disk
+    if (transform_stage || delete_queue) {
+        return Layout::BUFFERED;
+    }
+    return Layout::DIRECT;
+}
+
+uint64_t DownloadCommand::transfer_assets(const GPhotoCamera& camera,
+                                          std::vector<AssetTask>& assets,
+                                          size_t& file_idx,
+                                          size_t files_count,
+                                          const std::unordered_map<std::string, uint64_t>& sizes) const {
+    switch (select_layout()) {
+        case Layout::DIRECT:
+            return transfer_assets<Layout::DIRECT>(camera, assets, file_idx, files_count, sizes);
+        case Layout::BUFFERED:
+            return transfer_assets<Layout::BUFFERED>(camera, assets, file_idx, files_count, sizes);
+        case Layout::ASYNC:
+            return transfer_assets<Layout::ASYNC>(camera, assets, file_idx, files_count, sizes);
+        case Layout::FAN_OUT:
+            return transfer_assets<Layout::FAN_OUT>(camera, assets, file_idx, files_count, sizes);
+        case Layout::PACK:
+            return transfer_assets<Layout::PACK>(camera, assets, file_idx, files_count, sizes);
+    }
+    return 0;
+}
+
+template <DownloadCommand::Layout LAYOUT>
+uint64_t DownloadCommand::transfer_assets(const GPhotoCamera& camera,
+                                          std::vector<AssetTask>& assets,
+                                          size_t& file_idx,
+                                          size_t files_count,
+                                          const std::unordered_map<std::string, uint64_t>& sizes) const {
+    bool throttle = options.throttle.is_enabled();
+    if (delete_queue) {
+        return throttle ? transfer_assets<LAYOUT, true, true>(camera, assets, file_idx, files_count, sizes)
+                        : transfer_assets<LAYOUT, true, false>(camera, assets, file_idx, files_count, sizes);
+    }
+    return throttle ? transfer_assets<LAYOUT, false, true>(camera, assets, file_idx, files_count, sizes)
+                    : transfer_assets<LAYOUT, false, false>(camera, assets, file_idx, files_count, sizes);
+}
+
+template <DownloadCommand::Layout LAYOUT, bool VERIFY, bool THROTTLE>
+uint64_t DownloadCommand::transfer_assets(const GPhotoCamera& camera,
+                                          std::vector<AssetTask>& assets,
+                                          size_t& file_idx,
+                                          size_t files_count,
+                                          const std::unordered_map<std::string, uint64_t>& sizes) const {
+    uint64_t transferred = 0;
+    for (auto pos = assets.begin(); pos != assets.end() && !control->is_cancelled(); ++pos) {
+        apply_priorities(pos, assets.end());
+        if (!do_download_asset<LAYOUT, VERIFY, THROTTLE>(camera, *pos, file_idx, files_count)) {
+            continue;
+        }
+        for (const auto& file : pos->asset.files) {
+            auto size = sizes.find(file.path.string());
+            if (size != sizes.end()) {
+                transferred += size->second;
+            }
+        }
+    }
+
+    wait_writes();
+    settle_assets();
+    return transferred;
+}
+
+template <DownloadCommand::Layout LAYOUT, bool VERIFY, bool THROTTLE>
+bool DownloadCommand::do_download_file(const GPhotoCamera& camera,
                                        const std::filesystem::path& src,
-                                       const std::filesystem::path& dst) const {
-    std::cout << "Downloading " << src << "... " << std::flush;
+                                       const std::filesystem::path& dst,
+                                       const std::vector<std::filesystem::path>& targets,
+                                       PendingAsset& pending,
+                                       size_t file_idx,
+                                       size_t files_count) const {
+    post_event(TransferEvent::file_started(src.string(), file_idx, files_count));
     auto filename = src.filename();
+
     auto dest_path = dst / filename;
-    if (skip_existing && std::filesystem::exists(dest_path)) {
-        std::cout << "SKIPPED" << std::endl;
+
+    bool result = false;
+    bool background = false; // The result is reported by the writer once the file is written
+    uint64_t size = 0;
+    if constexpr (LAYOUT == Layout::DIRECT) {
+        result = camera.get_file(src, dest_path);
+        if (result) {
+            std::error_code ec;
+            size = std::filesystem::file_size(dest_path, ec);
+        }
+    } else {
+        auto data = camera.get_file_data(src);
+        if constexpr (LAYOUT == Layout::PACK) {
+            auto info = data ? camera.get_file_info(src) : std::nullopt;
+            result = data && pack_writer->add(pack_path(dest_path), *data, info ? info->mtime : std::time(nullptr));
+        } else if constexpr (LAYOUT == Layout::FAN_OUT) {
+            // Fetched once, written to all destinations in the background
+            result = data.has_value();
+            if (result) {
+                std::vector<std::filesystem::path> destination_files;
+                destination_files.reserve(targets.size());
+                for (const auto& folder : targets) {
+                    destination_files.push_back(folder / filename);
+                }
+                background = true;
+                fan_out->submit(src.generic_string(),
+                                *data,
+                                std::move(destination_files),
+                                background_write(pending, src, file_idx, files_count, data->size));
+            }
+        } else if constexpr (LAYOUT == Layout::ASYNC) {
+            // The next file is fetched while this one is written
+            result = data.has_value();
+            if (result) {
+                background = true;
+                async_writer->submit(
+                        *data, dest_path, background_write(pending, src, file_idx, files_count, data->size));
+            }
+        } else {
+            result = data && write_file_data(*data, dest_path);
+        }
+
+        if (result) {
+            size = data->size;
+            if constexpr (LAYOUT != Layout::PACK) {
+                if (transform_stage) {
+                    // Run once the asset is written completely, so a failed asset leaves no derived outputs
+                    std::vector<std::filesystem::path> destination_files;
+                    if (targets.empty()) {
+                        destination_files.push_back(dest_path);
+                    }
+                    for (const auto& folder : targets) {
+                        destination_files.push_back(folder / filename);
+                    }
+                    pending.transforms.push_back({*data, std::move(destination_files)});
+                }
+                if constexpr (VERIFY) {
+                    stage_delete(camera, src, *data, targets, pending);
+                }
+            }
+        }
+    }
+
+    if (!background) {
+        post_event(TransferEvent::file_done(src.string(), file_idx, files_count, result, size));
+    }
+
+    if constexpr (THROTTLE) {
+        if (result) {
+            options.throttle.account_file(size);
+        }
+    }
+    return result;
+}
+
+std::function<void(bool)> DownloadCommand::background_write(PendingAsset& pending,
+                                                            const std::filesystem::path& src,
+                                                            size_t file_idx,
+                                                            size_t files_count,
+                                                            uint64_t size) const {
+    pending.writes->remaining++;
+    return [this, writes = pending.writes, source = src.string(), file_idx, files_count, size](bool ok) {
+        if (!ok) {
+            writes->failed = true;
+        }
+        post_event(TransferEvent::file_done(source, file_idx, files_count, ok, size));
+        writes->remaining--;
+    };
+}
+
+void DownloadCommand::stage_delete(const GPhotoCamera& camera,
+                                   const std::filesystem::path& src,
+                                   const FileData& data,
+                                   const std::vector<std::filesystem::path>& targets,
+                                   PendingAsset& pending) const {
+    PHCOPY_TRACE_SCOPE("stage_delete", src);
+
+    auto info = camera.get_file_info(src);
+    if (!info || info->size != data.size) {
+        pending.deletable = false;
+        post_event(TransferEvent::error(src.string(),
+                                        GP_OK,
+                                        "Size of \"" + src.string() +
+                                                "\" doesn't match the device, its asset won't be deleted"));
         return;
     }
 
-    bool result = camera.get_file(src, dst / filename);
+    DeleteCandidate candidate;
+    candidate.source = src;
+    candidate.size = data.size;
+    Sha256 sha;
+    sha.update(data.data, data.size);
+    candidate.digest = sha.finish();
+    for (const auto& folder : targets) {
+        candidate.destination_files.push_back(folder / src.filename());
+    }
+    pending.deletes.push_back(std::move(candidate));
+}
+
+void DownloadCommand::flush_deletes(const GPhotoCamera& camera) const {
+    // Copies must be on the disk before they are read back
+    wait_writes();
+    settle_assets();
+    delete_queue->flush(camera);
+}
+
+void DownloadCommand::settle_assets() const {
+    while (!pending_assets.empty() && pending_assets.front().writes->remaining == 0) {
+        auto asset = std::move(pending_assets.front());
+        pending_assets.pop_front();
+
+        if (asset.writes->failed) {
+            rollback_asset(asset);
+            continue;
+        }
+
+        for (const auto& transform : asset.transforms) {
+            transform_stage->submit(transform.data, transform.destination_files);
+        }
+        if (delete_queue && asset.deletable) {
+            for (auto& candidate : asset.deletes) {
+                delete_queue->add(std::move(candidate));
+            }
+            delete_queue->commit_asset();
+        }
+    }
+}
+
+void DownloadCommand::rollback_asset(const PendingAsset& asset) const {
+    for (const auto& path : asset.created) {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+    }
+    if (transform_stage) {
+        transform_stage->discard(asset.created);
+    }
+    post_event(TransferEvent::error(asset.first_file.string(),
+                                    GP_OK,
+                                    "Asset " + asset.key + " in \"" + asset.destination.string() +
+                                            "\" was not downloaded completely"));
+}
 
-    std::cout << (result ? "DONE" : "FAILED") << std::endl;
+void DownloadCommand::wait_writes() const {
+    if (fan_out) {
+        fan_out->wait();
+    }
+    if (async_writer) {
+        async_writer->wait();
+    }
+}
+
+template <DownloadCommand::Layout LAYOUT, bool VERIFY, bool THROTTLE>
+bool DownloadCommand::do_download_asset(const GPhotoCamera& camera,
+                                        const AssetTask& task,
+                                        size_t& file_idx,
+                                        size_t files_count) const {
+    PHCOPY_TRACE_SCOPE("download_asset", task.asset.key);
+
+    if constexpr (LAYOUT == Layout::PACK) {
+        if (!pack_writer->begin_group()) {
+            file_idx += task.asset.files.size();
+            return false;
+        }
+    }
+
+    // Mirror folders are resolved once per asset rather than per file
+    std::vector<std::filesystem::path> targets;
+    if constexpr (LAYOUT == Layout::FAN_OUT || VERIFY) {
+        targets = target_paths(task.destination);
+    }
+
+    // A failed asset is removed only where this run created it, copies of its files from earlier runs stay.
+    // Writes in the background may fail for any file and destination.
+    PendingAsset pending;
+    pending.key = task.asset.key;
+    pending.first_file = task.asset.files.front().path;
+    pending.destination = task.destination;
+    std::vector<std::filesystem::path> rollback_targets;
+    if constexpr (LAYOUT != Layout::PACK) {
+        if (task.asset.files.size() > 1 || LAYOUT == Layout::FAN_OUT || LAYOUT == Layout::ASYNC) {
+            rollback_targets = targets.empty() ? target_paths(task.destination) : targets;
+        }
+    }
+
+    size_t done = 0;
+    for (const auto& file : task.asset.files) {
+        if (!control->wait_if_paused()) {
+            break;
+        }
+
+        for (const auto& folder : rollback_targets) {
+            auto path = folder / file.path.filename();
+            std::error_code ec;
+            if (!std::filesystem::exists(path, ec)) {
+                pending.created.push_back(std::move(path));
+            }
+        }
+
+        if (!do_download_file<LAYOUT, VERIFY, THROTTLE>(
+                    camera, file.path, task.destination, targets, pending, ++file_idx, files_count)) {
+            break;
+        }
+        done++;
+    }
+
+    bool completed = done == task.asset.files.size();
+    if constexpr (LAYOUT == Layout::PACK) {
+        completed = completed && pack_writer->commit_group();
+        if (!completed) {
+            // Don't leave a partial group in the destination
+            pack_writer->rollback_group();
+        }
+    }
+
+    if (!completed) {
+        // Writes of the fetched files may be still queued, the earlier assets are settled first to keep the order
+        wait_writes();
+        settle_assets();
+        rollback_asset(pending);
+
+        size_t attempted = std::min(done + 1, task.asset.files.size());
+        file_idx += task.asset.files.size() - attempted;
+        return false;
+    }
+
+    pending_assets.push_back(std::move(pending));
+    settle_assets();
+    if constexpr (VERIFY) {
+        // Copies are verified in the background, only the deletes are issued between transfers
+        if (delete_queue->is_batch_ready()) {
+            delete_queue->delete_verified(camera);
+        }
+    }
+    return true;
 }
 
 void DownloadCommand::do_download_folder(const GPhotoCamera& camera,
                                          const std::filesystem::path& src,
                                          const std::filesystem::path& dst) const {
-    std::vector<FolderPair> files;
+    std::vector<AssetTask> assets;
+    size_t files_count = 0;
 
     if (!std::filesystem::exists(dst)) {
         std::cerr << "Folder doesn't exist: " << dst << std::endl;
         return;
     }
 
-    print_enumerating_files(files.size(), false);
-    enumerate_files(camera, src, dst, files);
-    print_enumerating_files(files.size(), true);
+    // The plan of a dry run needs all files. Folder tasks neither skip packed files nor keep the groups of
+    // concurrent assets apart in one pack.
+    if (options.incremental && !options.dry_run && !options.pack) {
+        do_download_incremental(camera, src, dst);
+        return;
+    }
+
+    report_enumeration(files_count, false);
+    {
+        PHCOPY_TRACE_SCOPE("enumerate", src);
+        enumerate_files(camera, src, dst, assets, files_count);
+    }
+    report_enumeration(files_count, true);
+
+    download_assets(camera, assets);
+}
+
+void DownloadCommand::do_download_incremental(const GPhotoCamera& camera,
+                                              const std::filesystem::path& src,
+                                              const std::filesystem::path& dst) const {
+    // Tasks of one device never run in parallel, so a private scheduler needs only one worker
+    auto scheduler = options.scheduler ? options.scheduler : std::make_shared<TaskScheduler>(1);
+
+    IncrementalRun run(*scheduler);
+    report_enumeration(run.files_count, false);
+    spawn_folder(camera, run, src, dst);
+    run.group.wait();
+    report_enumeration(run.files_count, true);
+}
+
+void DownloadCommand::spawn_folder(const GPhotoCamera& camera,
+                                   IncrementalRun& run,
+                                   const std::filesystem::path& folder,
+                                   const std::filesystem::path& dst) const {
+    run.scheduler.spawn(run.group, [this, &camera, &run, folder, dst]() {
+        if (control->is_cancelled()) {
+            return;
+        }
+
+        std::vector<AssetTask> assets;
+        std::vector<std::filesystem::path> folder_list;
+        {
+            PHCOPY_TRACE_SCOPE("enumerate", folder);
+            if (profile->may_contain_files(folder)) {
+                add_folder_assets(camera.list_files(folder), dst, assets, run.files_count);
+            }
+            if (options.recursive && profile->may_contain_folders(folder)) {
+                folder_list = camera.list_folders(folder);
+            }
+        }
+        report_enumeration(run.files_count, false);
+
+        // The worker takes the newest task first: the files of this folder in order, then the subfolders
+        for (auto dir = folder_list.rbegin(); dir != folder_list.rend(); ++dir) {
+            spawn_folder(camera, run, *dir, dst / *(--dir->end()));
+        }
+        if (assets.empty()) {
+            return;
+        }
+
+        DestinationIndex index;
+        if (!index.prepare(target_paths(dst), true)) {
+            return;
+        }
+        if (options.skip_existing) {
+            auto pos = std::remove_if(assets.begin(), assets.end(), [&](const AssetTask& task) {
+                return is_downloaded(task, index);
+            });
+            assets.erase(pos, assets.end());
+        }
+
+        size_t batches_count = (assets.size() + INCREMENTAL_BATCH_ASSETS - 1) / INCREMENTAL_BATCH_ASSETS;
+        for (size_t i = batches_count; i-- > 0;) {
+            auto begin = assets.begin() + static_cast<ptrdiff_t>(i * INCREMENTAL_BATCH_ASSETS);
+            auto end = assets.begin() + static_cast<ptrdiff_t>(std::min((i + 1) * INCREMENTAL_BATCH_ASSETS,
+                                                                        assets.size()));
+            run.scheduler.spawn(run.group, [this, &camera, &run, batch = std::vector<AssetTask>(begin, end)]() mutable {
+                transfer_assets(camera, batch, run.file_idx, run.files_count, {});
+            });
+        }
+    });
+}
+
+void DownloadCommand::do_download_list(const GPhotoCamera& camera) const {
+    std::ifstream list(options.files_from);
+    if (!list) {
+        std::cerr << "Can't open file list " << options.files_from << std::endl;
+        return;
+    }
+
+    if (!std::filesystem::exists(destination)) {
+        std::cerr << "Folder doesn't exist: " << destination << std::endl;
+        return;
+    }
+
+    // Files are grouped by folder so assets can be built the same way as during enumeration
+    std::vector<std::pair<std::filesystem::path, std::vector<std::filesystem::path>>> folders;
+    std::unordered_map<std::string, size_t> folders_index;
+
+    std::string line;
+    while (std::getline(list, line)) {
+        if (line.empty()) {
+            continue;
+        }
+
+        std::filesystem::path file {line};
+        auto relative = file.parent_path().lexically_relative(source);
+        if (relative.empty() || *relative.begin() == "..") {
+            std::cerr << "File is outside of " << source << ": " << file << std::endl;
+            continue;
+        }
+
+        auto [pos, inserted] = folders_index.try_emplace(relative.string(), folders.size());
+        if (inserted) {
+            auto dst = relative == "." ? destination : destination / relative;
+            folders.emplace_back(std::move(dst), std::vector<std::filesystem::path> {});
+        }
+        folders[pos->second].second.push_back(std::move(file));
+    }
+
+    std::vector<AssetTask> assets;
+    size_t files_count = 0;
+    for (const auto& [dst, files] : folders) {
+        add_folder_assets(files, dst, assets, files_count);
+    }
+
+    download_assets(camera, assets);
+}
+
+void DownloadCommand::do_download_storages(const GPhotoCamera& camera) const {
+    auto storages = camera.get_storage_info();
+    if (storages.empty()) {
+        std::cerr << "The device doesn't report its storages" << std::endl;
+        return;
+    }
+    print_storages(storages, std::cout);
+
+    if (!std::filesystem::exists(destination)) {
+        std::cerr << "Folder doesn't exist: " << destination << std::endl;
+        return;
+    }
+
+    // One connection serves all storages, so they are enumerated one after another, but the transfer
+    // covers the whole device as a single list
+    std::vector<AssetTask> assets;
+    size_t files_count = 0;
+    report_enumeration(files_count, false);
+    for (const auto& storage : storages) {
+        auto storage_folder = std::filesystem::path {storage.base_dir}.filename();
+        PHCOPY_TRACE_SCOPE("enumerate", storage.base_dir);
+        enumerate_files(camera, storage_path(storage, source), destination / storage_folder, assets, files_count);
+    }
+    report_enumeration(files_count, true);
+
+    download_assets(camera, assets);
+}
+
+void DownloadCommand::do_download_plan(const GPhotoCamera& camera, const TransferPlan& plan) const {
+    // Files of a folder are next to each other in the plan, so assets are rebuilt per run of the same folder
+    std::vector<AssetTask> assets;
+    size_t files_count = 0;
+    std::vector<std::filesystem::path> files;
+    const auto& planned_files = plan.get_files();
+    for (size_t i = 0; i < planned_files.size(); i++) {
+        files.push_back(planned_files[i].source);
+
+        const auto& folder = planned_files[i].destination_folder;
+        if (i + 1 == planned_files.size() || planned_files[i + 1].destination_folder != folder) {
+            add_folder_assets(files, folder, assets, files_count);
+            files.clear();
+        }
+    }
+
+    download_assets(camera, assets);
+}
+
+void DownloadCommand::download_assets(const GPhotoCamera& camera, std::vector<AssetTask>& assets) const {
+    if (pack_writer) {
+        std::unordered_set<std::string> packed;
+        if (options.skip_existing && !pack_writer->load_existing(packed)) {
+            return;
+        }
+
+        auto pos = std::remove_if(assets.begin(), assets.end(), [&](const AssetTask& task) {
+            return std::all_of(task.asset.files.begin(), task.asset.files.end(), [&](const AssetFile& file) {
+                return packed.count(pack_path(task.destination / file.path.filename())) > 0;
+            });
+        });
+        assets.erase(pos, assets.end());
+    } else {
+        // All destination folders are created and read at once, so per file checks are done in memory
+        std::vector<std::filesystem::path> folders;
+        folders.reserve(assets.size() * (options.mirrors.size() + 1));
+        for (const auto& task : assets) {
+            for (auto& folder : target_paths(task.destination)) {
+                folders.push_back(std::move(folder));
+            }
+        }
+
+        // A dry run must not change the destination
+        DestinationIndex index;
+        bool prepared = index.prepare(std::move(folders), !options.dry_run);
+
+        // Folders which can't be created or read leave out only their own assets
+        auto pos = std::remove_if(assets.begin(), assets.end(), [&](const AssetTask& task) {
+            if (!prepared) {
+                auto targets = target_paths(task.destination);
+                bool available = std::all_of(targets.begin(), targets.end(), [&](const std::filesystem::path& folder) {
+                    return index.is_prepared(folder);
+                });
+                if (!available) {
+                    return true;
+                }
+            }
+            return options.skip_existing && is_downloaded(task, index);
+        });
+        assets.erase(pos, assets.end());
+    }
+
+    size_t files_count = 0;
+    for (const auto& task : assets) {
+        files_count += task.asset.files.size();
+    }
+
+    auto plan = plan_transfer(camera, assets);
+    bool fits = check_plan(plan);
+    if (options.dry_run) {
+        if (!options.plan_file.empty() && plan.save(options.plan_file)) {
+            std::cout << "Plan saved to " << options.plan_file << std::endl;
+        }
+        return;
+    }
+    if (!fits) {
+        return;
+    }
+
+    std::unordered_map<std::string, uint64_t> sizes;
+    for (const auto& planned : plan.get_files()) {
+        sizes[planned.source.string()] = planned.size;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t file_idx = 0;
+    uint64_t transferred = transfer_assets(camera, assets, file_idx, files_count, sizes);
+    flush_events();
+
+    // Short runs are dominated by the setup and would spoil the estimate
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (transferred > 0 && elapsed.count() >= MIN_MEASURED_SECONDS && !control->is_cancelled()) {
+        ThroughputHistory::store(device_key, static_cast<double>(transferred) / elapsed.count());
+    }
+}
+
+TransferPlan DownloadCommand::plan_transfer(const GPhotoCamera& camera, const std::vector<AssetTask>& assets) const {
+    PHCOPY_TRACE_SCOPE("plan_transfer");
+
+    TransferPlan plan;
+    std::vector<std::filesystem::path> files;
+    for (const auto& task : assets) {
+        files.clear();
+        for (const auto& file : task.asset.files) {
+            files.push_back(file.path);
+        }
+
+        // Files of an asset share a folder, drivers answer them from the same cache
+        std::vector<std::optional<FileInfo>> infos;
+        bool known = std::all_of(files.begin(), files.end(), [&](const std::filesystem::path& file) {
+            return known_sizes.count(file.string()) > 0;
+        });
+        if (!known) {
+            infos = camera.get_files_info(files);
+        }
+
+        for (size_t i = 0; i < files.size(); i++) {
+            PlannedFile planned;
+            planned.source = files[i];
+            planned.destination_folder = task.destination;
+            if (known) {
+                planned.size = known_sizes.at(files[i].string());
+            } else if (infos[i]) {
+                planned.size = infos[i]->size;
+            }
+            plan.add(std::move(planned));
+        }
+    }
+
+    return plan;
+}
+
+bool DownloadCommand::check_plan(const TransferPlan& plan) const {
+    auto total = plan.total_size();
+    std::cout << "Planned: " << plan.get_files().size() << " files, " << format_size(total) << std::endl;
+
+    if (auto throughput = ThroughputHistory::load(device_key)) {
+        auto seconds = static_cast<uint64_t>(static_cast<double>(total) / *throughput);
+        std::cout << "Estimated time: " << seconds / 3600 << "h " << seconds / 60 % 60 << "m " << seconds % 60
+                  << "s at " << format_size(static_cast<uint64_t>(*throughput)) << "/s" << std::endl;
+    }
+
+    // Every destination receives a full copy. Packs and the plain files of one destination take the same space.
+    // Destinations sharing a file system need the sum of their copies there.
+    struct FileSystemNeed {
+        std::filesystem::path target; // First destination on the file system, for the message
+        uint64_t id {0};
+        uint64_t available {0};
+        uint64_t needed {0};
+    };
+    std::vector<FileSystemNeed> needs;
+    for (const auto& target : target_paths(destination)) {
+        auto space = file_system_space(target);
+        if (!space) {
+            std::cerr << "Can't get free space of " << target << std::endl;
+            continue;
+        }
+
+        auto pos = std::find_if(needs.begin(), needs.end(), [&](const FileSystemNeed& need) {
+            return need.id == space->id;
+        });
+        if (pos == needs.end()) {
+            needs.push_back({target, space->id, space->available, 0});
+            pos = needs.end() - 1;
+        }
+        pos->needed += total;
+    }
+
+    bool fits = true;
+    for (const auto& need : needs) {
+        if (need.available < need.needed) {
+            std::cerr << "Not enough space in " << need.target << ": " << format_size(need.needed) << " needed, "
+                      << format_size(need.available) << " available" << std::endl;
+            fits = false;
+        }
+    }
+
+    return fits;
+}
+
+void DownloadCommand::apply_priorities(std::vector<AssetTask>::iterator pending_begin,
+                                       std::vector<AssetTask>::iterator pending_end) const {
+    // The latest request ends up at the front, assets within a folder keep their order
+    for (const auto& folder : control->take_priorities()) {
+        auto moved = std::stable_partition(pending_begin, pending_end, [&](const AssetTask& task) {
+            auto relative = task.asset.files.front().path.parent_path().lexically_relative(folder);
+            return !relative.empty() && *relative.begin() != "..";
+        });
+        std::cerr << "Prioritized " << (moved - pending_begin) << " assets from " << folder << std::endl;
+    }
+}
 
-    for (size_t i = 0; i < files.size(); i++) {
-        const FolderPair& file_task = files[i];
-        if (!std::filesystem::exists(file_task.destination)) {
-            std::filesystem::create_directories(file_task.destination);
+void DownloadCommand::add_folder_assets(const std::vector<std::filesystem::path>& files_list,
+                                        const std::filesystem::path& dst,
+                                        std::vector<AssetTask>& assets,
+                                        size_t& files_count) const {
+    for (auto& asset : group_assets(files_list)) {
+        if (!options.asset_filter.apply(asset)) {
+            continue;
         }
 
-        std::cout << "[" << (i + 1) << "/" << files.size() << "]: ";
-        do_download_file(camera, file_task.source, file_task.destination);
+        files_count += asset.files.size();
+        assets.emplace_back(std::move(asset), dst);
     }
 }
 
 void DownloadCommand::enumerate_files(const GPhotoCamera& camera,
                                       const std::filesystem::path& folder,
                                       const std::filesystem::path& dst,
-                                      std::vector<FolderPair>& files) const {
-    auto files_list = camera.list_files(folder);
-    for (const auto& file_entry : files_list) {
-        bool append = true;
-        if (skip_existing) {
-            append = !std::filesystem::exists(dst / file_entry.filename());
-        }
+                                      std::vector<AssetTask>& assets,
+                                      size_t& files_count) const {
+    if (control->is_cancelled()) {
+        return;
+    }
 
-        if (append) {
-            files.emplace_back(file_entry, dst);
-        }
+    // Known layouts have files and subfolders in different levels, so one of the listings can be skipped
+    if (profile->may_contain_files(folder)) {
+        auto files_list = camera.list_files(folder);
+        add_folder_assets(files_list, dst, assets, files_count);
     }
 
-    print_enumerating_files(files.size(), false);
-    if (recursive) {
+    report_enumeration(files_count, false);
+    if (options.recursive && profile->may_contain_folders(folder)) {
         auto folder_list = camera.list_folders(folder);
         for (const auto& dir : folder_list) {
             auto dir_name = *(--dir.end());
-            enumerate_files(camera, dir, dst / dir_name, files);
+            enumerate_files(camera, dir, dst / dir_name, assets, files_count);
         }
     }
 }
 
-void DownloadCommand::print_enumerating_files(size_t files_count, bool finish) {
-    std::cout << "\rEnumerating files: " << files_count << std::flush;
+bool DownloadCommand::is_downloaded(const AssetTask& task, const DestinationIndex& index) const {
+    // An asset is skipped only as a whole. If some of its files are missing in any of the destinations,
+    // all of them are fetched again and written everywhere.
+    auto folders = target_paths(task.destination);
+    return std::all_of(task.asset.files.begin(), task.asset.files.end(), [&](const AssetFile& file) {
+        return std::all_of(folders.begin(), folders.end(), [&](const std::filesystem::path& folder) {
+            return index.contains(folder, file.path.filename());
+        });
+    });
+}
+
+std::vector<std::filesystem::path> DownloadCommand::target_paths(const std::filesystem::path& path) const {
+    std::vector<std::filesystem::path> paths {path};
+    if (options.mirrors.empty()) {
+        return paths;
+    }
+
+    auto relative = path.lexically_relative(destination);
+    for (const auto& mirror : options.mirrors) {
+        paths.push_back(relative == "." ? mirror : mirror / relative);
+    }
+    return paths;
+}
+
+std::string DownloadCommand::pack_path(const std::filesystem::path& destination_file) const {
+    return destination_file.lexically_relative(destination).generic_string();
+}
+
+void DownloadCommand::report_enumeration(size_t files_count, bool finish) const {
+    post_event(TransferEvent::enumeration(files_count, finish));
     if (finish) {
-        puts("\n");
+        flush_events();
     }
 }
@@ -18,42 +18,245 @@
 
 #include "command.h"
 
+#include <atomic>
+#include <deque>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
-#include "folder_pair.h"
+#include "asset_group.h"
+#include "async_writer.h"
+#include "delete_queue.h"
+#include "destination_index.h"
+#include "device_profile.h"
+#include "fan_out_writer.h"
+#include "file_transform.h"
+#include "pack_writer.h"
+#include "rate_limiter.h"
+#include "task_scheduler.h"
+#include "transfer_plan.h"
+#include "transfer_control.h"
+
+struct DownloadOptions {
+    bool recursive {false};
+    bool skip_existing {false};
+    AssetFilter asset_filter;
+    std::filesystem::path files_from; // Work list of remote files, e.g. output of the diff command
+    TransferThrottle throttle;
+    std::vector<std::shared_ptr<FileTransform>> transforms;
+    bool pack {false}; // Store files in pack-NNNNNN.tar archives with offset indexes instead of separate files
+    uint64_t max_pack_size {0};
+    std::vector<std::filesystem::path> mirrors; // Additional destinations receiving the same files
+    std::filesystem::path manifest_file;        // Per destination result of every file
+    size_t max_queued_writes {8};               // Files buffered in memory per destination
+    std::filesystem::path control_socket;       // Unix socket accepting pause/resume/cancel/prioritize
+    bool delete_after_verify {false};           // Delete files from the device once all copies are verified
+    size_t delete_batch_size {32};
+    bool async_write {false};                   // Write files in the background instead of on the transfer thread
+    size_t max_async_writes {16};               // Files held in memory while being written
+    bool all_storages {false};                  // Download the source path from every storage of the device
+    bool dry_run {false};                       // Only plan the transfer and report its size and duration
+    std::filesystem::path plan_file;            // Plan saved by the dry run and used by the real run
+    bool incremental {false};                   // Download every folder as soon as it's listed, without the plan
+    std::shared_ptr<TaskScheduler> scheduler;   // Workers shared by the sessions of the process, own one if empty
+};
 
 class DownloadCommand : public Command {
 public:
     DownloadCommand(size_t device_idx,
                     std::filesystem::path source,
                     std::filesystem::path destination,
-                    bool recursive,
-                    bool skip_existing);
+                    DownloadOptions options);
 
     void execute() override;
 
 private:
-    void do_download_file(const GPhotoCamera& camera,
+    // How fetched files reach the destinations. It's chosen once per run, the transfer loop is
+    // instantiated for every layout so the per-file path doesn't check the options.
+    enum class Layout {
+        DIRECT,   // The camera writes straight into the destination file
+        BUFFERED, // Fetched into memory, written on the transfer thread
+        ASYNC,    // Fetched into memory, written by the async writer
+        FAN_OUT,  // Fetched into memory, written to every destination by the fan-out writer
+        PACK,     // Appended to the pack
+    };
+
+    Layout select_layout() const;
+
+    // Writes of an asset done in the background, counted down by the writer completions
+    struct AssetWrites {
+        std::atomic<size_t> remaining {0};
+        std::atomic<bool> failed {false};
+    };
+
+    // Asset fetched completely, whose files may be still written in the background. It's committed
+    // once all writes succeed and rolled back if any of them fails.
+    struct PendingTransform {
+        FileData data;
+        std::vector<std::filesystem::path> destination_files; // The file in every destination, primary first
+    };
+
+    struct PendingAsset {
+        std::string key;
+        std::filesystem::path first_file;
+        std::filesystem::path destination;
+        std::shared_ptr<AssetWrites> writes {std::make_shared<AssetWrites>()};
+        std::vector<std::filesystem::path> created; // Files which were not in the destinations before
+        std::vector<DeleteCandidate> deletes;
+        std::vector<PendingTransform> transforms; // Submitted once all writes of the asset succeeded
+        bool deletable {true}; // False if some file couldn't be staged, the asset stays on the device then
+    };
+
+    // Downloads the assets in order and returns the planned size of the completed ones. file_idx is the number
+    // of files passed before, it's advanced by the assets.
+    uint64_t transfer_assets(const GPhotoCamera& camera,
+                             std::vector<AssetTask>& assets,
+                             size_t& file_idx,
+                             size_t files_count,
+                             const std::unordered_map<std::string, uint64_t>& sizes) const;
+
+    template <Layout LAYOUT>
+    uint64_t transfer_assets(const GPhotoCamera& camera,
+                             std::vector<AssetTask>& assets,
+                             size_t& file_idx,
+                             size_t files_count,
+                             const std::unordered_map<std::string, uint64_t>& sizes) const;
+
+    template <Layout LAYOUT, bool VERIFY, bool THROTTLE>
+    uint64_t transfer_assets(const GPhotoCamera& camera,
+                             std::vector<AssetTask>& assets,
+                             size_t& file_idx,
+                             size_t files_count,
+                             const std::unordered_map<std::string, uint64_t>& sizes) const;
+
+    // targets are the destination folders of the asset, filled only for the fan-out layout and verification
+    template <Layout LAYOUT, bool VERIFY, bool THROTTLE>
+    bool do_download_file(const GPhotoCamera& camera,
                           const std::filesystem::path& src,
-                          const std::filesystem::path& dst) const;
+                          const std::filesystem::path& dst,
+                          const std::vector<std::filesystem::path>& targets,
+                          PendingAsset& pending,
+                          size_t file_idx,
+                          size_t files_count) const;
+
+    // Completion of a file written in the background: posts its result and counts down the writes of the asset
+    std::function<void(bool)> background_write(PendingAsset& pending,
+                                               const std::filesystem::path& src,
+                                               size_t file_idx,
+                                               size_t files_count,
+                                               uint64_t size) const;
+
+    // Adds the file to the deletes of the asset if the device agrees on its size, otherwise keeps the whole asset
+    void stage_delete(const GPhotoCamera& camera,
+                      const std::filesystem::path& src,
+                      const FileData& data,
+                      const std::vector<std::filesystem::path>& targets,
+                      PendingAsset& pending) const;
+
+    // Commits or rolls back, in order, the pending assets whose writes are done
+    void settle_assets() const;
+
+    // Removes the files the asset created with their transform outputs and reports it
+    void rollback_asset(const PendingAsset& asset) const;
+
+    void flush_deletes(const GPhotoCamera& camera) const;
+
+    template <Layout LAYOUT, bool VERIFY, bool THROTTLE>
+    bool do_download_asset(const GPhotoCamera& camera,
+                           const AssetTask& task,
+                           size_t& file_idx,
+                           size_t files_count) const;
 
     void do_download_folder(const GPhotoCamera& camera,
                             const std::filesystem::path& src,
                             const std::filesystem::path& dst) const;
 
+    // Enumeration state of an incremental download. The tasks of a device are serialized by the group.
+    struct IncrementalRun {
+        explicit IncrementalRun(TaskScheduler& scheduler) : scheduler(scheduler) {}
+
+        TaskScheduler& scheduler;
+        TaskGroup group {true};
+        size_t files_count {0}; // Found so far
+        size_t file_idx {0};
+    };
+
+    // Lists folders as tasks and downloads the files of every folder right after it's listed
+    void do_download_incremental(const GPhotoCamera& camera,
+                                 const std::filesystem::path& src,
+                                 const std::filesystem::path& dst) const;
+
+    // Spawns downloads of the folder files in batches and listings of its subfolders
+    void spawn_folder(const GPhotoCamera& camera,
+                      IncrementalRun& run,
+                      const std::filesystem::path& folder,
+                      const std::filesystem::path& dst) const;
+
+    void do_download_list(const GPhotoCamera& camera) const;
+
+    // Enumerates the source in all storages and downloads them as one plan into DESTINATION/STORAGE
+    void do_download_storages(const GPhotoCamera& camera) const;
+
+    // Lists the parent of the source to find out whether it's a file or a folder
+    RemotePathKind probe_source(const GPhotoCamera& camera) const;
+
+    // Downloads the files of a plan saved by a dry run, without enumerating the device
+    void do_download_plan(const GPhotoCamera& camera, const TransferPlan& plan) const;
+
+    void download_assets(const GPhotoCamera& camera, std::vector<AssetTask>& assets) const;
+
+    // Sizes of all files, from the loaded plan or the device
+    TransferPlan plan_transfer(const GPhotoCamera& camera, const std::vector<AssetTask>& assets) const;
+
+    // Prints the totals and the projected duration. Returns false if some destination can't hold the files.
+    bool check_plan(const TransferPlan& plan) const;
+
+    // Waits until all files written so far are on the disk
+    void wait_writes() const;
+
+    // Moves pending assets from the folders prioritized since the last call to the front
+    void apply_priorities(std::vector<AssetTask>::iterator pending_begin,
+                          std::vector<AssetTask>::iterator pending_end) const;
+
+    void add_folder_assets(const std::vector<std::filesystem::path>& files_list,
+                           const std::filesystem::path& dst,
+                           std::vector<AssetTask>& assets,
+                           size_t& files_count) const;
+
     void enumerate_files(const GPhotoCamera& camera,
                          const std::filesystem::path& folder,
                          const std::filesystem::path& dst,
-                         std::vector<FolderPair>& files) const;
+                         std::vector<AssetTask>& assets,
+                         size_t& files_count) const;
+
+    bool is_downloaded(const AssetTask& task, const DestinationIndex& index) const;
+
+    // The same folder or file in every destination, the primary one first
+    std::vector<std::filesystem::path> target_paths(const std::filesystem::path& path) const;
+
+    // Name of the file inside the packs
+    std::string pack_path(const std::filesystem::path& destination_file) const;
 
-    static void print_enumerating_files(size_t files_count, bool finish);
+    // Posts the enumeration progress, the finishing call waits until it's delivered
+    void report_enumeration(size_t files_count, bool finish) const;
 
     size_t device_idx;
     std::filesystem::path source;
     std::filesystem::path destination;
-    bool recursive;
-    bool skip_existing;
+    DownloadOptions options;
+    std::unique_ptr<TransformStage> transform_stage;
+    std::unique_ptr<PackWriter> pack_writer;
+    std::unique_ptr<FanOutWriter> fan_out;
+    std::shared_ptr<TransferControl> control;
+    std::unique_ptr<DeleteQueue> delete_queue;
+    std::unique_ptr<AsyncWriter> async_writer;
+    const DeviceProfile* profile {nullptr};
+    std::string device_key; // Serial number or model, the key of the throughput history
+    std::unordered_map<std::string, uint64_t> known_sizes;
+    mutable std::deque<PendingAsset> pending_assets; // Used only by the code driving the transfer
 };
 
 
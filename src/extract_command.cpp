@@ -0,0 +1,129 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "extract_command.h"
+
+#include "pack_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+} // namespace
+
+ExtractCommand::ExtractCommand(std::filesystem::path pack_folder, std::string path, std::filesystem::path destination)
+  : pack_folder(std::move(pack_folder)), path(std::move(path)), destination(std::move(destination)) {}
+
+void ExtractCommand::execute() {
+    auto entries = load_pack_index(pack_folder);
+    if (!entries) {
+        return;
+    }
+
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    std::filesystem::path base = std::filesystem::path(path).parent_path();
+
+    size_t extracted = 0, failed = 0;
+    for (const auto& entry : *entries) {
+        bool matches = entry.path == path || (entry.path.size() > path.size() &&
+                                              entry.path.compare(0, path.size(), path) == 0 &&
+                                              entry.path[path.size()] == '/');
+        if (!matches) {
+            continue;
+        }
+
+        auto destination_file = destination / std::filesystem::path(entry.path).lexically_relative(base);
+        std::error_code ec;
+        std::filesystem::create_directories(destination_file.parent_path(), ec);
+
+        std::cout << "Extracting " << entry.path << "... " << std::flush;
+        bool result = extract_file(entry.pack, entry.offset, entry.size, destination_file);
+        std::cout << (result ? "DONE" : "FAILED") << std::endl;
+        if (result) {
+            extracted++;
+        } else {
+            failed++;
+        }
+    }
+
+    if (extracted == 0 && failed == 0) {
+        std::cerr << "Can't find " << path << " in " << pack_folder << std::endl;
+    }
+}
+
+bool ExtractCommand::extract_file(const std::filesystem::path& pack,
+                                  uint64_t offset,
+                                  uint64_t size,
+                                  const std::filesystem::path& destination_file) {
+    int in_fd = open(pack.c_str(), O_RDONLY);
+    if (in_fd < 0) {
+        std::cerr << "Can't open " << pack << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    int out_fd = open(destination_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (out_fd < 0) {
+        std::cerr << "Can't create file " << destination_file << ": " << strerror(errno) << std::endl;
+        close(in_fd);
+        return false;
+    }
+
+    std::vector<char> buffer(std::min<uint64_t>(size, COPY_BUFFER_SIZE));
+    bool result = true;
+    while (size > 0 && result) {
+        ssize_t read_size = pread(in_fd, buffer.data(), std::min<uint64_t>(size, buffer.size()), offset);
+        if (read_size <= 0) {
+            if (read_size < 0 && errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Can't read " << pack << ": " << (read_size < 0 ? strerror(errno) : "unexpected end")
+                      << std::endl;
+            result = false;
+            break;
+        }
+
+        for (ssize_t written = 0; written < read_size;) {
+            ssize_t ret = write(out_fd, buffer.data() + written, read_size - written);
+            if (ret < 0 && errno != EINTR) {
+                std::cerr << "Can't write file " << destination_file << ": " << strerror(errno) << std::endl;
+                result = false;
+                break;
+            }
+            written += std::max<ssize_t>(ret, 0);
+        }
+
+        offset += read_size;
+        size -= read_size;
+    }
+
+    close(in_fd);
+    if (close(out_fd) < 0) {
+        result = false;
+    }
+    if (!result) {
+        remove(destination_file.c_str());
+    }
+    return result;
+}
@@ -0,0 +1,41 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_EXTRACT_COMMAND_H
+#define PHCOPY_EXTRACT_COMMAND_H
+
+#include "command.h"
+
+#include <filesystem>
+
+// Pulls files out of packs written by download --pack. Path selects a single file or a whole folder.
+class ExtractCommand : public Command {
+public:
+    ExtractCommand(std::filesystem::path pack_folder, std::string path, std::filesystem::path destination);
+
+    void execute() override;
+
+private:
+    static bool extract_file(const std::filesystem::path& pack,
+                             uint64_t offset,
+                             uint64_t size,
+                             const std::filesystem::path& destination_file);
+
+    std::filesystem::path pack_folder;
+    std::string path;
+    std::filesystem::path destination;
+};
+
+#endif // PHCOPY_EXTRACT_COMMAND_H
@@ -0,0 +1,129 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "fan_out_writer.h"
+
+#include <algorithm>
+
+FanOutWriter::FanOutWriter(size_t targets_count, size_t max_queued, std::shared_ptr<Manifest> manifest)
+  : max_queued(std::max<size_t>(max_queued, 1)), manifest(std::move(manifest)) {
+    for (size_t i = 0; i < targets_count; i++) {
+        targets.push_back(std::make_unique<Target>());
+    }
+    for (size_t i = 0; i < targets_count; i++) {
+        targets[i]->thread = std::thread(&FanOutWriter::writer, this, i);
+    }
+}
+
+FanOutWriter::~FanOutWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    for (auto& target : targets) {
+        target->has_work.notify_all();
+    }
+    for (auto& target : targets) {
+        target->thread.join();
+    }
+}
+
+void FanOutWriter::submit(const std::string& source,
+                          const FileData& data,
+                          std::vector<std::filesystem::path> destination_files,
+                          Completion on_done) {
+    auto state = std::make_shared<FileState>();
+    state->source = source;
+    state->data = data;
+    state->destination_files = std::move(destination_files);
+    state->results.assign(targets.size(), false);
+    state->remaining = targets.size();
+    state->on_done = std::move(on_done);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // Backpressure: wait until every destination has room, i.e. for the slowest one
+    progress.wait(lock, [this]() {
+        for (const auto& target : targets) {
+            if (target->queue.size() >= max_queued) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    for (auto& target : targets) {
+        target->queue.push_back(state);
+        target->has_work.notify_one();
+    }
+}
+
+bool FanOutWriter::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    progress.wait(lock, [this]() {
+        for (const auto& target : targets) {
+            if (!target->queue.empty() || target->busy) {
+                return false;
+            }
+        }
+        return true;
+    });
+
+    return !failed;
+}
+
+void FanOutWriter::writer(size_t target_idx) {
+    Target& target = *targets[target_idx];
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        target.has_work.wait(lock, [&]() { return stopping || !target.queue.empty(); });
+        if (target.queue.empty()) {
+            return;
+        }
+
+        auto state = target.queue.front();
+        target.queue.pop_front();
+        target.busy = true;
+        lock.unlock();
+        progress.notify_all();
+
+        bool result = write_file_data(state->data, state->destination_files[target_idx]);
+
+        lock.lock();
+        state->results[target_idx] = result;
+        if (!result) {
+            failed = true;
+        }
+        bool last = --state->remaining == 0;
+        lock.unlock();
+
+        // The other writers are done with the state, so the callbacks run without blocking them.
+        // The target stays busy meanwhile, so the caller sees the result of every waited file.
+        if (last) {
+            if (manifest) {
+                manifest->add(state->source, state->data.size, state->results);
+            }
+            // Release the buffer as soon as the last destination is written
+            state->data = FileData {};
+            if (state->on_done) {
+                state->on_done(std::all_of(state->results.begin(), state->results.end(), [](bool ok) { return ok; }));
+            }
+        }
+
+        lock.lock();
+        target.busy = false;
+        progress.notify_all();
+    }
+}
@@ -0,0 +1,83 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_FAN_OUT_WRITER_H
+#define PHCOPY_FAN_OUT_WRITER_H
+
+#include "file_data.h"
+#include "manifest.h"
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes every downloaded file to several destinations at once from the same in-memory buffer.
+// Each destination has its own writer thread and queue. submit blocks while the queue of the slowest
+// destination is full, so memory use stays bounded and the total time follows the slowest disk.
+class FanOutWriter {
+public:
+    FanOutWriter(size_t targets_count, size_t max_queued, std::shared_ptr<Manifest> manifest);
+    ~FanOutWriter();
+
+    FanOutWriter(const FanOutWriter&) = delete;
+    FanOutWriter& operator=(const FanOutWriter&) = delete;
+
+    using Completion = std::function<void(bool ok)>;
+
+    // destination_files[i] is the path of the file in the i-th destination. on_done is called from a writer thread
+    // once all destinations are written, ok only if every one of them succeeded.
+    void submit(const std::string& source,
+                const FileData& data,
+                std::vector<std::filesystem::path> destination_files,
+                Completion on_done = {});
+
+    // Waits for all queued writes. Returns false if any write has failed so far.
+    bool wait();
+
+private:
+    struct FileState {
+        std::string source;
+        FileData data;
+        std::vector<std::filesystem::path> destination_files;
+        std::vector<bool> results;
+        size_t remaining {0};
+        Completion on_done;
+    };
+
+    struct Target {
+        std::deque<std::shared_ptr<FileState>> queue;
+        std::condition_variable has_work;
+        bool busy {false};
+        std::thread thread;
+    };
+
+    void writer(size_t target_idx);
+
+    std::mutex mutex;
+    std::condition_variable progress;
+    std::vector<std::unique_ptr<Target>> targets;
+    size_t max_queued;
+    std::shared_ptr<Manifest> manifest;
+    bool failed {false};
+    bool stopping {false};
+};
+
+#endif // PHCOPY_FAN_OUT_WRITER_H
@@ -0,0 +1,65 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "file_data.h"
+
+#include "trace.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+std::filesystem::path partial_file_path(const std::filesystem::path& destination_file) {
+    auto result = destination_file;
+    result += ".part";
+    return result;
+}
+
+bool write_file_data(const FileData& data, const std::filesystem::path& destination_file) {
+    PHCOPY_TRACE_SCOPE("write_file", destination_file);
+
+    auto temp_file = partial_file_path(destination_file);
+    int fd = open(temp_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Can't create file " << destination_file << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < data.size) {
+        ssize_t ret = write(fd, data.data + written, data.size - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            std::cerr << "Can't write file " << destination_file << ": " << strerror(errno) << std::endl;
+            close(fd);
+            remove(temp_file.c_str());
+            return false;
+        }
+        written += static_cast<size_t>(ret);
+    }
+
+    if (close(fd) < 0 || rename(temp_file.c_str(), destination_file.c_str()) < 0) {
+        std::cerr << "Can't write file " << destination_file << ": " << strerror(errno) << std::endl;
+        remove(temp_file.c_str());
+        return false;
+    }
+
+    return true;
+}
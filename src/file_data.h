@@ -0,0 +1,37 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_FILE_DATA_H
+#define PHCOPY_FILE_DATA_H
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+// Contents of a remote file held in memory. Copies share the same buffer, which is released
+// together with the last copy.
+struct FileData {
+    std::shared_ptr<const void> owner; // CameraFile or other object holding the buffer
+    const char* data {nullptr};
+    size_t size {0};
+};
+
+// Files are written under this name and renamed once complete, so a failed write never damages
+// a file that was already in the destination
+std::filesystem::path partial_file_path(const std::filesystem::path& destination_file);
+
+bool write_file_data(const FileData& data, const std::filesystem::path& destination_file);
+
+#endif // PHCOPY_FILE_DATA_H
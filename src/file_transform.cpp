@@ -0,0 +1,159 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "file_transform.h"
+
+#include "metadata_index.h"
+#include "sha256.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+void FileTransform::discard(const std::vector<std::filesystem::path>&) const {}
+
+bool FileTransform::finish(const std::vector<std::filesystem::path>&) {
+    return true;
+}
+
+const char* Sha256Transform::name() const noexcept {
+    return "sha256";
+}
+
+bool Sha256Transform::process(const FileData& data,
+                              const std::vector<std::filesystem::path>& destination_files) const {
+    Sha256 hash;
+    hash.update(data.data, data.size);
+    auto digest = Sha256::to_hex(hash.finish());
+
+    bool result = true;
+    for (const auto& destination_file : destination_files) {
+        auto output_file = destination_file;
+        output_file += ".sha256";
+
+        std::ofstream output(output_file, std::ios::trunc);
+        output << digest << "  " << destination_file.filename().string() << '\n';
+        if (!output) {
+            std::cerr << "Can't write " << output_file << std::endl;
+            result = false;
+        }
+    }
+    return result;
+}
+
+void Sha256Transform::discard(const std::vector<std::filesystem::path>& destination_files) const {
+    for (const auto& destination_file : destination_files) {
+        auto output_file = destination_file;
+        output_file += ".sha256";
+        std::error_code ec;
+        std::filesystem::remove(output_file, ec);
+    }
+}
+
+const char* MetadataTransform::name() const noexcept {
+    return "metadata";
+}
+
+bool MetadataTransform::process(const FileData& data,
+                                const std::vector<std::filesystem::path>& destination_files) const {
+    // Sidecars and formats without metadata are just left out of the index
+    auto metadata = parse_media_metadata(data.data, data.size);
+    if (metadata && !destination_files.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        collected.emplace_back(destination_files.front(), std::move(*metadata));
+    }
+    return true;
+}
+
+void MetadataTransform::discard(const std::vector<std::filesystem::path>& destination_files) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pos = std::remove_if(collected.begin(), collected.end(), [&](const auto& record) {
+        return std::find(destination_files.begin(), destination_files.end(), record.first) != destination_files.end();
+    });
+    collected.erase(pos, collected.end());
+}
+
+bool MetadataTransform::finish(const std::vector<std::filesystem::path>& destinations) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (collected.empty() || destinations.empty()) {
+        return true;
+    }
+
+    // Files are submitted with their paths in the primary destination, mirrors have the same layout
+    std::vector<MetadataRecord> records;
+    records.reserve(collected.size());
+    for (auto& [file, metadata] : collected) {
+        records.push_back({file.lexically_relative(destinations.front()).generic_string(), std::move(metadata)});
+    }
+    collected.clear();
+
+    bool result = true;
+    for (const auto& destination : destinations) {
+        result = MetadataIndex::update(destination / METADATA_INDEX_FILE, records) && result;
+    }
+    return result;
+}
+
+std::shared_ptr<FileTransform> make_transform(const std::string& name) {
+    if (name == "sha256") {
+        return std::make_shared<Sha256Transform>();
+    }
+    if (name == "metadata") {
+        return std::make_shared<MetadataTransform>();
+    }
+
+    return nullptr;
+}
+
+TransformStage::TransformStage(std::vector<std::shared_ptr<FileTransform>> transforms)
+  : transforms(std::move(transforms)) {}
+
+void TransformStage::submit(const FileData& data, const std::vector<std::filesystem::path>& destination_files) {
+    for (const auto& transform : transforms) {
+        // Tasks hold a copy of the data, the buffer is released when the last transform is done
+        pool.submit([this, transform, data, destination_files]() {
+            PHCOPY_TRACE_SCOPE(transform->name(), destination_files.front());
+            if (!transform->process(data, destination_files)) {
+                std::cerr << "Transform " << transform->name() << " failed for " << destination_files.front()
+                          << std::endl;
+                failed = true;
+            }
+        });
+    }
+}
+
+void TransformStage::discard(const std::vector<std::filesystem::path>& destination_files) {
+    for (const auto& transform : transforms) {
+        transform->discard(destination_files);
+    }
+}
+
+bool TransformStage::wait() {
+    pool.wait();
+    return !failed.exchange(false);
+}
+
+bool TransformStage::finish(const std::vector<std::filesystem::path>& destinations) {
+    bool result = wait();
+    for (const auto& transform : transforms) {
+        PHCOPY_TRACE_SCOPE(transform->name());
+        if (!transform->finish(destinations)) {
+            std::cerr << "Transform " << transform->name() << " failed to save its results" << std::endl;
+            result = false;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,94 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_FILE_TRANSFORM_H
+#define PHCOPY_FILE_TRANSFORM_H
+
+#include "file_data.h"
+#include "media_metadata.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Produces derived outputs (hash, thumbnail, re-encoded copy...) from the in-memory contents of a
+// downloaded file, so the original doesn't have to be read back from the disk.
+class FileTransform {
+public:
+    virtual ~FileTransform() = default;
+
+    virtual const char* name() const noexcept = 0;
+
+    // Called from worker threads, possibly for several files at once. destination_files are the copies of the file
+    // in every destination, the primary one first.
+    virtual bool process(const FileData& data, const std::vector<std::filesystem::path>& destination_files) const = 0;
+
+    // Drops the outputs of files which were removed from the destinations
+    virtual void discard(const std::vector<std::filesystem::path>& destination_files) const;
+
+    // Called once all files are processed. destinations are the download folders, the primary one first.
+    virtual bool finish(const std::vector<std::filesystem::path>& destinations);
+};
+
+// Writes sha256sum compatible FILE.sha256 next to every copy of the file
+class Sha256Transform : public FileTransform {
+public:
+    const char* name() const noexcept override;
+    bool process(const FileData& data, const std::vector<std::filesystem::path>& destination_files) const override;
+    void discard(const std::vector<std::filesystem::path>& destination_files) const override;
+};
+
+// Collects capture time, location and camera model of the files into metadata.idx of every destination
+class MetadataTransform : public FileTransform {
+public:
+    const char* name() const noexcept override;
+    bool process(const FileData& data, const std::vector<std::filesystem::path>& destination_files) const override;
+    void discard(const std::vector<std::filesystem::path>& destination_files) const override;
+    bool finish(const std::vector<std::filesystem::path>& destinations) override;
+
+private:
+    mutable std::mutex mutex;
+    mutable std::vector<std::pair<std::filesystem::path, MediaMetadata>> collected;
+};
+
+std::shared_ptr<FileTransform> make_transform(const std::string& name);
+
+// Runs transforms of downloaded files on a thread pool sized to the cores, in parallel with the next transfers
+class TransformStage {
+public:
+    explicit TransformStage(std::vector<std::shared_ptr<FileTransform>> transforms);
+
+    void submit(const FileData& data, const std::vector<std::filesystem::path>& destination_files);
+
+    // Drops the outputs of the files, which must not be submitted anymore
+    void discard(const std::vector<std::filesystem::path>& destination_files);
+
+    // Waits for all submitted files. Returns false if some transform failed.
+    bool wait();
+
+    // Waits for all files and lets the transforms write their results
+    bool finish(const std::vector<std::filesystem::path>& destinations);
+
+private:
+    std::vector<std::shared_ptr<FileTransform>> transforms;
+    std::atomic<bool> failed {false};
+    ThreadPool pool;
+};
+
+#endif // PHCOPY_FILE_TRANSFORM_H
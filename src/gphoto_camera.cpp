@@ -15,18 +15,81 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "gphoto_camera.h"
 
+#include "listing_cache.h"
+#include "object_pool.h"
+#include "session_trace.h"
+#include "trace.h"
+#include "transfer_events.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+namespace {
+
+constexpr size_t TRANSFER_BUFFER_SIZE = 4 * 1024 * 1024;
+constexpr size_t MAX_IDLE_OBJECTS = 8;
+
+template<class T>
+T* gp_create(int (*create)(T**)) {
+    T* object = nullptr;
+    int ret = create(&object);
+    if (ret < GP_OK) {
+        std::cerr << "libgphoto2 object creation failed: " << gp_result_as_string(ret) << std::endl;
+        return nullptr;
+    }
+    return object;
+}
+
+// Writes the whole buffer, retrying short and interrupted writes
+bool write_all(int fd, const char* data, uint64_t size) {
+    for (uint64_t written = 0; written < size;) {
+        ssize_t ret = write(fd, data + written, size - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += static_cast<uint64_t>(ret);
+    }
+    return true;
+}
+
+std::chrono::microseconds elapsed_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
+} // namespace
+
+struct GPhotoCamera::Pools {
+    ObjectPool<CameraList> lists {[]() { return gp_create(gp_list_new); },
+                                  [](CameraList* list) { gp_list_reset(list); },
+                                  [](CameraList* list) { gp_list_free(list); },
+                                  MAX_IDLE_OBJECTS};
+    ObjectPool<CameraFile> files {[]() { return gp_create(gp_file_new); },
+                                  [](CameraFile* file) { gp_file_clean(file); },
+                                  [](CameraFile* file) { gp_file_free(file); },
+                                  MAX_IDLE_OBJECTS};
+    ObjectPool<std::vector<char>> buffers {[]() { return new std::vector<char>(TRANSFER_BUFFER_SIZE); },
+                                           [](std::vector<char>*) {},
+                                           [](std::vector<char>* buffer) { delete buffer; },
+                                           MAX_IDLE_OBJECTS};
+    std::atomic<bool> partial_reads {true};
+};
+
 GPhotoCamera::GPhotoCamera(const char* model, const char* port, Context context, const GPhotoInfo& info)
-  : context(context), camera(nullptr) {
-    CameraAbilities camera_abilities;
+  : context(context), camera(nullptr), pools(std::make_shared<Pools>()) {
     int ret = GP_OK;
     GPPortInfo port_info;
 
@@ -39,11 +102,11 @@ GPhotoCamera::GPhotoCamera(const char* model, const char* port, Context context,
         camera = std::shared_ptr<Camera>(ptr, gp_camera_free);
     }
 
-    if (!info.lookup_camera_ability(model, camera_abilities)) {
+    if (!info.lookup_camera_ability(model, abilities)) {
         throw std::runtime_error {"Cannot find camera abilities"};
     }
 
-    ret = gp_camera_set_abilities(camera.get(), camera_abilities);
+    ret = gp_camera_set_abilities(camera.get(), abilities);
     if (ret < GP_OK) {
         throw std::runtime_error {std::string {"libgphoto2 gp_camera_set_abilities failed: "} +
                                   gp_result_as_string(ret)};
@@ -60,15 +123,32 @@ GPhotoCamera::GPhotoCamera(const char* model, const char* port, Context context,
     }
 }
 
+GPhotoCamera::GPhotoCamera(std::shared_ptr<SessionReplay> replay)
+  : camera(nullptr), pools(std::make_shared<Pools>()), replay(std::move(replay)) {}
+
 GPhotoCamera::GPhotoCamera(const GPhotoCamera& other) noexcept {
     context = other.context;
     camera = other.camera;
+    abilities = other.abilities;
+    pools = other.pools;
+    recorder = other.recorder;
+    replay = other.replay;
+    cache = other.cache;
+    events = other.events;
+    serial_number = other.serial_number;
 }
 
 GPhotoCamera::GPhotoCamera(GPhotoCamera&& other) noexcept {
     context = std::move(other.context);
     camera = other.camera;
     other.camera = nullptr;
+    abilities = other.abilities;
+    pools = std::move(other.pools);
+    recorder = std::move(other.recorder);
+    replay = std::move(other.replay);
+    cache = std::move(other.cache);
+    events = std::move(other.events);
+    serial_number = std::move(other.serial_number);
 }
 
 GPhotoCamera::~GPhotoCamera() {}
@@ -80,6 +160,13 @@ GPhotoCamera& GPhotoCamera::operator=(const GPhotoCamera& other) noexcept {
 
     context = other.context;
     camera = other.camera;
+    abilities = other.abilities;
+    pools = other.pools;
+    recorder = other.recorder;
+    replay = other.replay;
+    cache = other.cache;
+    events = other.events;
+    serial_number = other.serial_number;
     return *this;
 }
 
@@ -91,9 +178,25 @@ GPhotoCamera& GPhotoCamera::operator=(GPhotoCamera&& other) noexcept {
     context = std::move(other.context);
     camera = other.camera;
     other.camera = nullptr;
+    abilities = other.abilities;
+    pools = std::move(other.pools);
+    recorder = std::move(other.recorder);
+    replay = std::move(other.replay);
+    cache = std::move(other.cache);
+    events = std::move(other.events);
+    serial_number = std::move(other.serial_number);
     return *this;
 }
 
+bool GPhotoCamera::connect() const {
+    PHCOPY_TRACE_SCOPE("connect");
+
+    if (replay) {
+        return true;
+    }
+    return gp_camera_init(camera.get(), context.get_context()) >= GP_OK;
+}
+
 std::vector<std::filesystem::path> GPhotoCamera::list_files(const std::filesystem::path& path) const {
     return list_fs(false, path);
 }
@@ -103,13 +206,70 @@ std::vector<std::filesystem::path> GPhotoCamera::list_folders(const std::filesys
 }
 
 std::vector<std::filesystem::path> GPhotoCamera::list_fs(bool folders, const std::filesystem::path& path) const {
-    // For automatic clean up
-    std::unique_ptr<CameraList, int (*)(CameraList*)> plist(nullptr, gp_list_free);
+    thread_local NameList names;
+    if (!list_names(folders, path, names)) {
+        return {};
+    }
 
-    {
-        CameraList* list = nullptr;
-        gp_list_new(&list);
-        plist.reset(list);
+    std::vector<std::filesystem::path> result;
+    result.reserve(names.size());
+
+    for (size_t i = 0; i < names.size(); i++) {
+        result.emplace_back(path / names[i]);
+    }
+
+    return result;
+}
+
+bool GPhotoCamera::list_names(bool folders, const std::filesystem::path& path, NameList& names) const {
+    PHCOPY_TRACE_SCOPE(folders ? "list_folders" : "list_files", path);
+
+    auto call = folders ? SessionCall::LIST_FOLDERS : SessionCall::LIST_FILES;
+    if (replay) {
+        names.clear();
+        const SessionRecord* record = replay->play(call, path.string());
+        if (record == nullptr || !record->ok) {
+            report_error(path, GP_OK, "Replayed listing of \"" + path.string() + "\" failed");
+            return false;
+        }
+
+        for (const auto& name : record->names) {
+            names.add(name);
+        }
+        return true;
+    }
+
+    if (cache && cache->lookup(folders, path.string(), names)) {
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool result = device_list_names(folders, path, names);
+    if (cache && result) {
+        cache->store(folders, path.string(), names);
+    }
+
+    if (recorder) {
+        SessionRecord record;
+        record.call = call;
+        record.duration = elapsed_since(start);
+        record.ok = result;
+        record.path = path.string();
+        for (size_t i = 0; i < names.size(); i++) {
+            record.names.emplace_back(names[i]);
+        }
+        recorder->record(record);
+    }
+
+    return result;
+}
+
+bool GPhotoCamera::device_list_names(bool folders, const std::filesystem::path& path, NameList& names) const {
+    names.clear();
+
+    auto plist = pools->lists.acquire();
+    if (!plist) {
+        return false;
     }
 
     int ret = 0;
@@ -121,23 +281,88 @@ std::vector<std::filesystem::path> GPhotoCamera::list_fs(bool folders, const std
     }
 
     if (ret < GP_OK) {
-        if (folders) {
-            std::cerr << "libgphoto2 gp_camera_folder_list_folders failed: ";
-        } else {
-            std::cerr << "libgphoto2 gp_camera_folder_list_files failed: ";
-        }
-        std::cerr << gp_result_as_string(ret) << std::endl;
-        return {};
+        report_error(path,
+                     ret,
+                     std::string("libgphoto2 ") +
+                             (folders ? "gp_camera_folder_list_folders" : "gp_camera_folder_list_files") +
+                             " failed: " + gp_result_as_string(ret));
+        return false;
     }
 
     int fs_items_count = gp_list_count(plist.get());
-    std::vector<std::filesystem::path> result;
-    result.reserve(fs_items_count);
+    names.reserve(fs_items_count);
 
     for (int i = 0; i < fs_items_count; i++) {
         const char* item_name;
         gp_list_get_name(plist.get(), i, &item_name);
-        result.emplace_back(path / item_name);
+        names.add(item_name);
+    }
+
+    return true;
+}
+
+std::optional<FileInfo> GPhotoCamera::get_file_info(const std::filesystem::path& file_path) const {
+    PHCOPY_TRACE_SCOPE("get_file_info", file_path);
+
+    if (replay) {
+        const SessionRecord* record = replay->play(SessionCall::FILE_INFO, file_path.string());
+        if (record == nullptr || !record->ok) {
+            return std::nullopt;
+        }
+        return record->info;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = device_get_file_info(file_path);
+
+    if (recorder) {
+        SessionRecord record;
+        record.call = SessionCall::FILE_INFO;
+        record.duration = elapsed_since(start);
+        record.ok = result.has_value();
+        record.path = file_path.string();
+        if (result) {
+            record.info = *result;
+        }
+        recorder->record(record);
+    }
+
+    return result;
+}
+
+std::optional<FileInfo> GPhotoCamera::device_get_file_info(const std::filesystem::path& file_path) const {
+    CameraFileInfo info;
+    auto parent = file_path.parent_path();
+    auto filename = file_path.filename();
+
+    int ret = gp_camera_file_get_info(camera.get(), parent.c_str(), filename.c_str(), &info, context.get_context());
+    if (ret < GP_OK) {
+        report_error(
+                file_path, ret, std::string("libgphoto2 gp_camera_file_get_info failed: ") + gp_result_as_string(ret));
+        return std::nullopt;
+    }
+
+    FileInfo result;
+    if (info.file.fields & GP_FILE_INFO_SIZE) {
+        result.size = info.file.size;
+    }
+    if (info.file.fields & GP_FILE_INFO_MTIME) {
+        result.mtime = info.file.mtime;
+    }
+    if (info.file.fields & GP_FILE_INFO_TYPE) {
+        result.type = info.file.type;
+    }
+
+    return result;
+}
+
+std::vector<std::optional<FileInfo>> GPhotoCamera::get_files_info(
+        const std::vector<std::filesystem::path>& files) const {
+    std::vector<std::optional<FileInfo>> result;
+    result.reserve(files.size());
+
+    for (const auto& file : files) {
+        result.push_back(get_file_info(file));
     }
 
     return result;
@@ -145,38 +370,362 @@ std::vector<std::filesystem::path> GPhotoCamera::list_fs(bool folders, const std
 
 bool GPhotoCamera::get_file(const std::filesystem::path& file_path,
                             const std::filesystem::path& destination_file) const {
-    int fd = open(destination_file.c_str(), O_CREAT | O_WRONLY, 0644);
+    PHCOPY_TRACE_SCOPE("get_file", file_path);
+
+    if (replay) {
+        auto data = get_file_data(file_path);
+        return data && write_file_data(*data, destination_file);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool result = device_get_file(file_path, destination_file);
+
+    if (recorder) {
+        SessionRecord record;
+        record.call = SessionCall::GET_FILE;
+        record.duration = elapsed_since(start);
+        record.ok = result;
+        record.path = file_path.string();
+        if (result) {
+            std::error_code ec;
+            record.info.size = std::filesystem::file_size(destination_file, ec);
+        }
+        recorder->record(record);
+    }
+
+    return result;
+}
+
+bool GPhotoCamera::device_get_file(const std::filesystem::path& file_path,
+                                   const std::filesystem::path& destination_file) const {
+    auto temp_file = partial_file_path(destination_file);
+    int fd = open(temp_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
     if (fd < 0) {
-        std::cerr << "Can't create file " << destination_file << ": " << strerror(errno) << std::endl;
+        report_error(file_path, GP_OK, "Can't create file " + destination_file.string() + ": " + strerror(errno));
         return false;
     }
 
-    CameraFile* file = nullptr;
+    int ret = GP_ERROR_NOT_SUPPORTED;
+    if (pools->partial_reads) {
+        ret = read_file_chunked(file_path, fd);
+        if (ret == GP_ERROR_NOT_SUPPORTED) {
+            // Don't try again for every file
+            pools->partial_reads = false;
+        }
+    }
+
+    if (ret == GP_ERROR_NOT_SUPPORTED) {
+        // A CameraFile can't be rebound to another descriptor, so a pooled memory file receives the data
+        // and it is written out here. This keeps the whole file in memory, but only for drivers without partial reads.
+        auto file = pools->files.acquire();
+        if (!file) {
+            close(fd);
+            remove(temp_file.c_str());
+            return false;
+        }
+
+        auto parent = file_path.parent_path();
+        auto filename = file_path.filename();
+        ret = gp_camera_file_get(
+                camera.get(), parent.c_str(), filename.c_str(), GP_FILE_TYPE_NORMAL, file.get(), context.get_context());
+        if (ret >= GP_OK) {
+            const char* data = nullptr;
+            unsigned long size = 0;
+            int data_ret = gp_file_get_data_and_size(file.get(), &data, &size);
+            if (data_ret < GP_OK) {
+                report_error(file_path,
+                             data_ret,
+                             std::string("libgphoto2 gp_file_get_data_and_size failed: ") +
+                                     gp_result_as_string(data_ret));
+                close(fd);
+                remove(temp_file.c_str());
+                return false;
+            }
+            if (!write_all(fd, data, size)) {
+                report_error(file_path,
+                             GP_ERROR_OS_FAILURE,
+                             "Can't write file " + destination_file.string() + ": " + strerror(errno));
+                close(fd);
+                remove(temp_file.c_str());
+                return false;
+            }
+        }
+    }
 
-    int ret = gp_file_new_from_fd(&file, fd);
     if (ret < GP_OK) {
-        std::cerr << "libgphoto2 gp_file_new_from_fd failed: " << gp_result_as_string(ret) << std::endl;
+        report_error(file_path, ret, std::string("libgphoto2 gp_camera_file_get failed: ") + gp_result_as_string(ret));
+
+        // remove output file
         close(fd);
+        remove(temp_file.c_str());
         return false;
     }
 
+    if (close(fd) < 0 || rename(temp_file.c_str(), destination_file.c_str()) < 0) {
+        report_error(file_path, GP_OK, "Can't write file " + destination_file.string() + ": " + strerror(errno));
+        remove(temp_file.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int GPhotoCamera::read_file_chunked(const std::filesystem::path& file_path, int fd) const {
+    auto buffer = pools->buffers.acquire();
+    if (!buffer) {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+
     auto parent = file_path.parent_path();
     auto filename = file_path.filename();
-    ret = gp_camera_file_get(
-            camera.get(), parent.c_str(), filename.c_str(), GP_FILE_TYPE_NORMAL, file, context.get_context());
+    uint64_t offset = 0;
+
+    // Drivers differ in what they return when reading past the end, so stop at the current size if it's known.
+    // Sizes from an earlier listing or a plan aren't used, a file that grew since would be cut short.
+    CameraFileInfo info;
+    int ret = gp_camera_file_get_info(camera.get(), parent.c_str(), filename.c_str(), &info, context.get_context());
+    bool size_known = ret >= GP_OK && (info.file.fields & GP_FILE_INFO_SIZE);
+    uint64_t expected_size = size_known ? info.file.size : 0;
+
+    while (!size_known || offset < expected_size) {
+        // Stop at the chunk boundary, the caller removes the partial file
+        if (gp_context_cancel(context.get_context()) == GP_CONTEXT_FEEDBACK_CANCEL) {
+            return GP_ERROR_CANCEL;
+        }
 
-    if (ret < GP_OK) {
-        std::cerr << "libgphoto2 gp_file_new_from_fd failed: " << gp_result_as_string(ret) << std::endl;
+        uint64_t size = buffer->size();
+        if (size_known) {
+            size = std::min<uint64_t>(size, expected_size - offset);
+        }
 
-        // remove output file
-        gp_file_free(file);
-        close(fd);
-        remove(destination_file.c_str());
-        return false;
+        ret = gp_camera_file_read(camera.get(),
+                                  parent.c_str(),
+                                  filename.c_str(),
+                                  GP_FILE_TYPE_NORMAL,
+                                  offset,
+                                  buffer->data(),
+                                  &size,
+                                  context.get_context());
+        if (ret < GP_OK) {
+            // Nothing is written yet, the caller may still fall back to the whole file transfer
+            return offset == 0 && ret == GP_ERROR_NOT_SUPPORTED ? GP_ERROR_NOT_SUPPORTED : ret;
+        }
+        if (size == 0 && size_known) {
+            // The driver hit the end before the expected size, the file is shorter than listed
+            report_error(file_path,
+                         GP_ERROR_CORRUPTED_DATA,
+                         "Device returned " + std::to_string(offset) + " of " + std::to_string(expected_size) +
+                                 " bytes");
+            return GP_ERROR_CORRUPTED_DATA;
+        }
+
+        if (!write_all(fd, buffer->data(), size)) {
+            report_error(file_path, GP_ERROR_OS_FAILURE, std::string("Can't write file: ") + strerror(errno));
+            return GP_ERROR_OS_FAILURE;
+        }
+
+        offset += size;
+        if (events) {
+            events->post(TransferEvent::file_progress(file_path.string(), offset, expected_size));
+        }
+        if (!size_known && size < buffer->size()) {
+            break;
+        }
     }
 
-    gp_file_free(file);
-    close(fd);
+    return GP_OK;
+}
+
+std::optional<FileData> GPhotoCamera::get_file_data(const std::filesystem::path& file_path) const {
+    PHCOPY_TRACE_SCOPE("get_file_data", file_path);
+
+    if (replay) {
+        const SessionRecord* record = replay->play(SessionCall::GET_FILE, file_path.string());
+        if (record == nullptr || !record->ok) {
+            report_error(file_path, GP_OK, "Replayed transfer of \"" + file_path.string() + "\" failed");
+            return std::nullopt;
+        }
+
+        // Payload isn't recorded, only its size
+        auto buffer = std::make_shared<std::vector<char>>(record->info.size);
+        FileData result;
+        result.data = buffer->data();
+        result.size = buffer->size();
+        result.owner = std::move(buffer);
+        return result;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto result = device_get_file_data(file_path);
+
+    if (recorder) {
+        SessionRecord record;
+        record.call = SessionCall::GET_FILE;
+        record.duration = elapsed_since(start);
+        record.ok = result.has_value();
+        record.path = file_path.string();
+        if (result) {
+            record.info.size = result->size;
+        }
+        recorder->record(record);
+    }
+
+    return result;
+}
+
+bool GPhotoCamera::delete_file(const std::filesystem::path& file_path) const {
+    PHCOPY_TRACE_SCOPE("delete_file", file_path);
+
+    if (replay) {
+        // Recorded sessions are read only, there is nothing to delete
+        return true;
+    }
+
+    auto parent = file_path.parent_path();
+    auto filename = file_path.filename();
+    int ret = gp_camera_file_delete(camera.get(), parent.c_str(), filename.c_str(), context.get_context());
+    if (ret < GP_OK) {
+        report_error(
+                file_path, ret, std::string("libgphoto2 gp_camera_file_delete failed: ") + gp_result_as_string(ret));
+        return false;
+    }
 
     return true;
 }
+
+std::string GPhotoCamera::get_serial_number() const {
+    if (replay) {
+        return {};
+    }
+    // Opening the camera, the device cache and the listing cache all need it, the summary is a slow device call
+    if (serial_number) {
+        return *serial_number;
+    }
+
+    CameraText summary;
+    int ret = gp_camera_get_summary(camera.get(), &summary, context.get_context());
+    if (ret < GP_OK) {
+        return {};
+    }
+
+    // PTP drivers report a line like "Serial Number: 00008030001A2B3C4D5E6F70"
+    std::istringstream lines(summary.text);
+    std::string line;
+    constexpr std::string_view SERIAL_PREFIX = "Serial Number:";
+    while (std::getline(lines, line)) {
+        auto pos = line.find(SERIAL_PREFIX);
+        if (pos == std::string::npos) {
+            continue;
+        }
+
+        auto value = line.substr(pos + SERIAL_PREFIX.size());
+        auto begin = value.find_first_not_of(" \t");
+        auto end = value.find_last_not_of(" \t\r");
+        serial_number = begin == std::string::npos ? std::string {} : value.substr(begin, end - begin + 1);
+        return *serial_number;
+    }
+    serial_number.emplace();
+    return {};
+}
+
+std::vector<StorageInfo> GPhotoCamera::get_storage_info() const {
+    if (replay) {
+        return {};
+    }
+
+    CameraStorageInformation* storages = nullptr;
+    int count = 0;
+    int ret = gp_camera_get_storageinfo(camera.get(), &storages, &count, context.get_context());
+    if (ret < GP_OK) {
+        report_error({}, ret, std::string("libgphoto2 gp_camera_get_storageinfo failed: ") + gp_result_as_string(ret));
+        return {};
+    }
+
+    std::vector<StorageInfo> result;
+    result.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const auto& storage = storages[i];
+        StorageInfo info;
+        if (storage.fields & GP_STORAGEINFO_BASE) {
+            info.base_dir = storage.basedir;
+        }
+        if (storage.fields & GP_STORAGEINFO_LABEL) {
+            info.label = storage.label;
+        }
+        if (storage.fields & GP_STORAGEINFO_DESCRIPTION) {
+            info.description = storage.description;
+        }
+        if (storage.fields & GP_STORAGEINFO_MAXCAPACITY) {
+            info.capacity_kb = storage.capacitykbytes;
+            info.has_capacity = true;
+        }
+        if (storage.fields & GP_STORAGEINFO_FREESPACEKBYTES) {
+            info.free_kb = storage.freekbytes;
+            info.has_free = true;
+        }
+        result.push_back(std::move(info));
+    }
+    free(storages);
+
+    return result;
+}
+
+const CameraAbilities& GPhotoCamera::get_abilities() const noexcept {
+    return abilities;
+}
+
+void GPhotoCamera::set_recorder(std::shared_ptr<SessionRecorder> session_recorder) {
+    recorder = std::move(session_recorder);
+}
+
+void GPhotoCamera::set_listing_cache(std::shared_ptr<ListingCache> listing_cache) {
+    cache = std::move(listing_cache);
+}
+
+void GPhotoCamera::set_event_queue(std::shared_ptr<EventQueue> event_queue) {
+    events = std::move(event_queue);
+}
+
+void GPhotoCamera::report_error(const std::filesystem::path& path, int gp_error, const std::string& message) const {
+    if (events) {
+        events->post(TransferEvent::error(path.string(), gp_error, message));
+    } else {
+        std::cerr << message << std::endl;
+    }
+}
+
+std::optional<FileData> GPhotoCamera::device_get_file_data(const std::filesystem::path& file_path) const {
+    FileData result;
+
+    // The file goes back to the pool when the last copy of the data is released
+    std::shared_ptr<CameraFile> file(pools->files.acquire());
+    if (!file) {
+        return std::nullopt;
+    }
+    result.owner = file;
+
+    auto parent = file_path.parent_path();
+    auto filename = file_path.filename();
+    int ret = gp_camera_file_get(camera.get(),
+                                 parent.c_str(),
+                                 filename.c_str(),
+                                 GP_FILE_TYPE_NORMAL,
+                                 file.get(),
+                                 context.get_context());
+    if (ret < GP_OK) {
+        report_error(file_path, ret, std::string("libgphoto2 gp_camera_file_get failed: ") + gp_result_as_string(ret));
+        return std::nullopt;
+    }
+
+    unsigned long size = 0;
+    ret = gp_file_get_data_and_size(file.get(), &result.data, &size);
+    if (ret < GP_OK) {
+        report_error(file_path,
+                     ret,
+                     std::string("libgphoto2 gp_file_get_data_and_size failed: ") + gp_result_as_string(ret));
+        return std::nullopt;
+    }
+    result.size = size;
+
+    return result;
+}
@@ -17,15 +17,44 @@
 #define PHCOPY_GPHOTO_CAMERA_H
 
 #include "context.h"
+#include "file_data.h"
 #include "gphoto_info.h"
+#include "name_list.h"
 
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <optional>
+#include <cstdint>
+#include <ctime>
+
+class EventQueue;
+class ListingCache;
+class SessionRecorder;
+class SessionReplay;
+
+struct FileInfo {
+    uint64_t size {0};
+    std::time_t mtime {0};
+    std::string type;
+};
+
+struct StorageInfo {
+    std::string base_dir; // Folder of the storage, e.g. /store_00010001
+    std::string label;
+    std::string description;
+    uint64_t capacity_kb {0};
+    uint64_t free_kb {0};
+    // Whether the device reported the capacity and the free space, not every device does
+    bool has_capacity {false};
+    bool has_free {false};
+};
 
 class GPhotoCamera {
 public:
     GPhotoCamera(const char* model, const char* port, Context context, const GPhotoInfo& info);
+    // Camera which serves all calls from a recorded session instead of a device
+    explicit GPhotoCamera(std::shared_ptr<SessionReplay> replay);
     GPhotoCamera(const GPhotoCamera& other) noexcept;
     GPhotoCamera(GPhotoCamera&& other) noexcept;
     ~GPhotoCamera();
@@ -33,16 +62,60 @@ public:
     GPhotoCamera& operator=(const GPhotoCamera& other) noexcept;
     GPhotoCamera& operator=(GPhotoCamera&& other) noexcept;
 
+    // Connects to the device, which libgphoto2 otherwise does on the first call. Returns false without
+    // reporting an error if no device answers, so callers can try other ports.
+    bool connect() const;
+
     std::vector<std::filesystem::path> list_files(const std::filesystem::path& path) const;
     std::vector<std::filesystem::path> list_folders(const std::filesystem::path& path) const;
 
+    std::optional<FileInfo> get_file_info(const std::filesystem::path& file_path) const;
+    // Info for files of one folder. libgphoto2 has no bulk request, but drivers like ptp2 fill their
+    // object info cache while listing the folder, so querying the whole folder at once avoids extra round trips.
+    std::vector<std::optional<FileInfo>> get_files_info(const std::vector<std::filesystem::path>& files) const;
+
     bool get_file(const std::filesystem::path& file_path, const std::filesystem::path& destination_file) const;
+    std::optional<FileData> get_file_data(const std::filesystem::path& file_path) const;
+
+    bool delete_file(const std::filesystem::path& file_path) const;
+
+    // Serial number from the camera summary, empty if the driver doesn't report it. The summary is read once.
+    std::string get_serial_number() const;
+    std::vector<StorageInfo> get_storage_info() const;
+
+    // Abilities the camera was opened with. Zeroed for replayed sessions.
+    const CameraAbilities& get_abilities() const noexcept;
+
+    // Records every call with its timing and payload size
+    void set_recorder(std::shared_ptr<SessionRecorder> session_recorder);
+    // Serves listings from the cache and stores fetched ones into it
+    void set_listing_cache(std::shared_ptr<ListingCache> listing_cache);
+    // Errors and transfer progress are posted to the queue instead of printed to stderr
+    void set_event_queue(std::shared_ptr<EventQueue> event_queue);
 
 private:
+    struct Pools;
+
     std::vector<std::filesystem::path> list_fs(bool folders, const std::filesystem::path& path) const;
+    bool list_names(bool folders, const std::filesystem::path& path, NameList& names) const;
+    bool device_list_names(bool folders, const std::filesystem::path& path, NameList& names) const;
+    std::optional<FileInfo> device_get_file_info(const std::filesystem::path& file_path) const;
+    bool device_get_file(const std::filesystem::path& file_path, const std::filesystem::path& destination_file) const;
+    std::optional<FileData> device_get_file_data(const std::filesystem::path& file_path) const;
+    // Transfer through a reusable buffer with partial reads. Returns GP_ERROR_NOT_SUPPORTED if the driver can't do it.
+    int read_file_chunked(const std::filesystem::path& file_path, int fd) const;
+    void report_error(const std::filesystem::path& path, int gp_error, const std::string& message) const;
 
     Context context; // For holding reference
     std::shared_ptr<Camera> camera;
+    CameraAbilities abilities {};
+    // CameraList, CameraFile and transfer buffers reused across calls. Shared by copies of the camera.
+    std::shared_ptr<Pools> pools;
+    std::shared_ptr<SessionRecorder> recorder;
+    std::shared_ptr<SessionReplay> replay;
+    std::shared_ptr<ListingCache> cache;
+    std::shared_ptr<EventQueue> events;
+    mutable std::optional<std::string> serial_number;
 };
 
 
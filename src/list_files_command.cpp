@@ -17,15 +17,33 @@
 
 #include <iostream>
 
-ListFilesCommand::ListFilesCommand(size_t device_idx, std::filesystem::path path, bool recursive)
-  : device_idx(device_idx), path(std::move(path)), recursive(recursive) {}
+ListFilesCommand::ListFilesCommand(
+        size_t device_idx, std::filesystem::path path, bool recursive, ListingFormat format, bool all_storages)
+  : device_idx(device_idx), path(std::move(path)), recursive(recursive), format(format), all_storages(all_storages) {}
 
 void ListFilesCommand::execute() {
     try {
         Command::execute();
 
         GPhotoCamera camera = open_camera(device_idx);
-        print_folder_structure(camera, path, recursive);
+        ListingWriter writer(std::cout, format);
+        if (!all_storages) {
+            print_folder_structure(camera, path, recursive, writer);
+            return;
+        }
+
+        // The report goes to stderr, so the listing itself stays machine readable
+        auto storages = camera.get_storage_info();
+        if (storages.empty()) {
+            std::cerr << "The device doesn't report its storages" << std::endl;
+            return;
+        }
+        print_storages(storages, std::cerr);
+
+        // Storages of one device share a single connection, so they are listed one after another
+        for (const auto& storage : storages) {
+            print_folder_structure(camera, storage_path(storage, path), recursive, writer);
+        }
     } catch (std::runtime_error& e) {
         std::cerr << e.what() << std::endl;
     }
@@ -33,18 +51,33 @@ void ListFilesCommand::execute() {
 
 void ListFilesCommand::print_folder_structure(const GPhotoCamera& camera,
                                               const std::filesystem::path& path,
-                                              bool recursive) {
+                                              bool recursive,
+                                              ListingWriter& writer) {
     auto folders = camera.list_folders(path);
     auto files = camera.list_files(path);
 
+    // Entries of the folder are emitted before descending, so the output streams while the tree is walked
     for (const auto& folder : folders) {
-        if (recursive) {
-            print_folder_structure(camera, folder, true);
-        } else {
-            std::cout << folder << std::endl;
+        if (!recursive || format != ListingFormat::TEXT) {
+            writer.write_folder(folder);
         }
     }
-    for (const auto& file : files) {
-        std::cout << file << std::endl;
+
+    if (writer.needs_file_info()) {
+        auto files_info = camera.get_files_info(files);
+        for (size_t i = 0; i < files.size(); i++) {
+            writer.write_file(files[i], files_info[i]);
+        }
+    } else {
+        for (const auto& file : files) {
+            writer.write_file(file, std::nullopt);
+        }
+    }
+    writer.finish_folder();
+
+    if (recursive) {
+        for (const auto& folder : folders) {
+            print_folder_structure(camera, folder, true, writer);
+        }
     }
 }
@@ -17,21 +17,32 @@
 #define PHCOPY_LIST_FILES_COMMAND_H
 
 #include "command.h"
+#include "listing_writer.h"
 
 #include <filesystem>
 
 class ListFilesCommand : public Command {
 public:
-    ListFilesCommand(size_t device_idx, std::filesystem::path path, bool recursive);
+    // With all_storages the path is looked up in every storage of the device
+    ListFilesCommand(size_t device_idx,
+                     std::filesystem::path path,
+                     bool recursive,
+                     ListingFormat format,
+                     bool all_storages);
 
     void execute() override;
 
 private:
-    void print_folder_structure(const GPhotoCamera& camera, const std::filesystem::path& path, bool recursive);
+    void print_folder_structure(const GPhotoCamera& camera,
+                                const std::filesystem::path& path,
+                                bool recursive,
+                                ListingWriter& writer);
 
     size_t device_idx;
     std::filesystem::path path;
     bool recursive;
+    ListingFormat format;
+    bool all_storages;
 };
 
 #endif // PHCOPY_LIST_FILES_COMMAND_H
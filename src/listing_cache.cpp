@@ -0,0 +1,236 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "listing_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+constexpr const char* CACHE_MAGIC = "PHCACHE1";
+
+std::vector<std::string> split_fields(const std::string& line) {
+    std::vector<std::string> fields;
+    std::string field;
+    std::istringstream in(line);
+    while (std::getline(in, field, '\t')) {
+        fields.push_back(std::move(field));
+    }
+    return fields;
+}
+
+bool is_storable(std::string_view value) {
+    return value.find_first_of("\t\n") == std::string_view::npos;
+}
+
+} // namespace
+
+std::filesystem::path user_cache_folder() {
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg != '\0') {
+        return std::filesystem::path {xdg} / "phcopy";
+    }
+    if (const char* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        return std::filesystem::path {home} / ".cache" / "phcopy";
+    }
+    return {};
+}
+
+ListingCache::ListingCache(std::filesystem::path file, std::vector<StorageInfo> storages)
+  : file(std::move(file)), storages(std::move(storages)) {}
+
+ListingCache::~ListingCache() {
+    if (hits > 0) {
+        std::cerr << hits << " folder listings were taken from the cache " << file << std::endl;
+    }
+    save();
+}
+
+std::shared_ptr<ListingCache> ListingCache::open(const std::string& serial, std::vector<StorageInfo> storages) {
+    auto folder = user_cache_folder();
+    // Without storage state there is no way to tell whether the listings are still valid
+    if (folder.empty() || serial.empty() || storages.empty()) {
+        return nullptr;
+    }
+    // Storages without the free space or capacity would keep stale listings forever
+    for (const auto& storage : storages) {
+        if (!storage.has_capacity || !storage.has_free) {
+            std::cerr << "Listing cache is not used: storage " << storage.base_dir
+                      << " doesn't report its free space" << std::endl;
+            return nullptr;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(folder, ec);
+    if (ec) {
+        return nullptr;
+    }
+
+    std::string name;
+    for (char c : serial) {
+        name += std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' ? c : '_';
+    }
+
+    std::shared_ptr<ListingCache> cache(new ListingCache(folder / (name + ".listing"), std::move(storages)));
+    cache->load();
+    return cache;
+}
+
+bool ListingCache::lookup(bool folders, const std::string& path, NameList& names) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pos = entries.find(make_key(folders, path));
+    if (pos == entries.end()) {
+        return false;
+    }
+
+    hits++;
+    names.clear();
+    names.reserve(pos->second.size());
+    for (const auto& name : pos->second) {
+        names.add(name);
+    }
+    return true;
+}
+
+void ListingCache::store(bool folders, const std::string& path, const NameList& names) {
+    if (!is_storable(path)) {
+        return;
+    }
+
+    std::vector<std::string> values;
+    values.reserve(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!is_storable(names[i])) {
+            return;
+        }
+        values.emplace_back(names[i]);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[make_key(folders, path)] = std::move(values);
+    modified = true;
+}
+
+bool ListingCache::save() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!modified) {
+        return true;
+    }
+
+    // Written aside and renamed, so an interrupted run can't leave a truncated cache
+    auto temp_file = file;
+    temp_file += ".tmp";
+    std::ofstream out(temp_file, std::ios::trunc);
+    out << CACHE_MAGIC << '\n';
+    for (const auto& storage : storages) {
+        out << "S\t" << storage.base_dir << '\t' << storage.capacity_kb << '\t' << storage.free_kb << '\n';
+    }
+    for (const auto& [key, names] : entries) {
+        out << key;
+        for (const auto& name : names) {
+            out << '\t' << name;
+        }
+        out << '\n';
+    }
+    out.close();
+
+    std::error_code ec;
+    if (!out || (std::filesystem::rename(temp_file, file, ec), ec)) {
+        std::cerr << "Can't write listing cache " << file << std::endl;
+        std::filesystem::remove(temp_file, ec);
+        return false;
+    }
+
+    modified = false;
+    return true;
+}
+
+void ListingCache::load() {
+    std::ifstream in(file);
+    std::string line;
+    if (!std::getline(in, line) || line != CACHE_MAGIC) {
+        return;
+    }
+
+    std::vector<StorageInfo> cached_storages;
+    while (std::getline(in, line)) {
+        auto fields = split_fields(line);
+        if (fields.size() < 2) {
+            continue;
+        }
+
+        if (fields[0] == "S" && fields.size() == 4) {
+            StorageInfo storage;
+            storage.base_dir = fields[1];
+            storage.capacity_kb = std::strtoull(fields[2].c_str(), nullptr, 10);
+            storage.free_kb = std::strtoull(fields[3].c_str(), nullptr, 10);
+            cached_storages.push_back(std::move(storage));
+            continue;
+        }
+        if (fields[0] != "F" && fields[0] != "D") {
+            continue;
+        }
+
+        // Listings above the storages are valid while the set of storages is the same,
+        // listings inside a storage while its free space is the same
+        const StorageInfo* current = find_storage(fields[1]);
+        bool valid = false;
+        if (current == nullptr) {
+            valid = cached_storages.size() == storages.size() &&
+                    std::equal(storages.begin(), storages.end(), cached_storages.begin(), [](auto& a, auto& b) {
+                        return a.base_dir == b.base_dir;
+                    });
+        } else {
+            for (const auto& cached : cached_storages) {
+                if (cached.base_dir == current->base_dir) {
+                    valid = cached.capacity_kb == current->capacity_kb && cached.free_kb == current->free_kb;
+                    break;
+                }
+            }
+        }
+
+        if (valid) {
+            std::string key = fields[0] + '\t' + fields[1];
+            entries[key].assign(std::make_move_iterator(fields.begin() + 2), std::make_move_iterator(fields.end()));
+        } else {
+            // Dropped entries have to be removed from the file as well
+            modified = true;
+        }
+    }
+
+    // Storage states are rewritten with the current ones
+    if (cached_storages.size() != storages.size()) {
+        modified = true;
+    }
+}
+
+const StorageInfo* ListingCache::find_storage(const std::string& path) const {
+    for (const auto& storage : storages) {
+        const auto& base = storage.base_dir;
+        if (path.compare(0, base.size(), base) == 0 && (path.size() == base.size() || path[base.size()] == '/')) {
+            return &storage;
+        }
+    }
+    return nullptr;
+}
+
+std::string ListingCache::make_key(bool folders, const std::string& path) {
+    return (folders ? "D\t" : "F\t") + path;
+}
@@ -0,0 +1,68 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_LISTING_CACHE_H
+#define PHCOPY_LISTING_CACHE_H
+
+#include "gphoto_camera.h"
+#include "name_list.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// $XDG_CACHE_HOME/phcopy or ~/.cache/phcopy, empty if neither is set
+std::filesystem::path user_cache_folder();
+
+// Folder listings of one device kept between runs in the user cache folder, keyed by the device serial number.
+// Free space of every storage is stored with the listings. Adding or removing photos changes it, so listings
+// under a storage whose free space changed are dropped and fetched again, the rest is served from the cache.
+class ListingCache {
+public:
+    // Returns nullptr if the cache folder can't be used or a storage doesn't report its free space and capacity
+    static std::shared_ptr<ListingCache> open(const std::string& serial, std::vector<StorageInfo> storages);
+    ~ListingCache();
+
+    ListingCache(const ListingCache&) = delete;
+    ListingCache& operator=(const ListingCache&) = delete;
+
+    bool lookup(bool folders, const std::string& path, NameList& names);
+    void store(bool folders, const std::string& path, const NameList& names);
+
+    bool save();
+
+private:
+    ListingCache(std::filesystem::path file, std::vector<StorageInfo> storages);
+
+    void load();
+
+    // Storage the path belongs to, nullptr for the paths above the storages
+    const StorageInfo* find_storage(const std::string& path) const;
+
+    static std::string make_key(bool folders, const std::string& path);
+
+    std::filesystem::path file;
+    std::vector<StorageInfo> storages;
+    std::unordered_map<std::string, std::vector<std::string>> entries;
+    bool modified {false};
+    size_t hits {0};
+    std::mutex mutex;
+};
+
+#endif // PHCOPY_LISTING_CACHE_H
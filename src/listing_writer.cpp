@@ -0,0 +1,197 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "listing_writer.h"
+
+#include <cstdio>
+
+namespace {
+
+constexpr size_t BUFFER_FLUSH_SIZE = 64 * 1024;
+
+} // namespace
+
+ListingWriter::ListingWriter(std::ostream& out, ListingFormat format) : out(out), format(format) {
+    buffer.reserve(BUFFER_FLUSH_SIZE * 2);
+    if (format == ListingFormat::CSV) {
+        buffer += "path,kind,size,mtime,type\n";
+    }
+}
+
+ListingWriter::~ListingWriter() {
+    finish_folder();
+}
+
+bool ListingWriter::needs_file_info() const noexcept {
+    return format == ListingFormat::JSONL || format == ListingFormat::CSV;
+}
+
+void ListingWriter::write_folder(const std::filesystem::path& folder) {
+    switch (format) {
+        case ListingFormat::TEXT:
+            append_escaped(folder.string());
+            buffer += '\n';
+            break;
+        case ListingFormat::JSONL:
+            buffer += "{\"path\":\"";
+            append_escaped(folder.string());
+            buffer += "\",\"kind\":\"folder\"}\n";
+            break;
+        case ListingFormat::CSV:
+            append_escaped(folder.string());
+            buffer += ",folder,,,\n";
+            break;
+        case ListingFormat::NONE:
+            return;
+    }
+
+    if (buffer.size() >= BUFFER_FLUSH_SIZE) {
+        write_buffer();
+    }
+}
+
+void ListingWriter::write_file(const std::filesystem::path& file, const std::optional<FileInfo>& info) {
+    char numbers[64];
+
+    switch (format) {
+        case ListingFormat::TEXT:
+            append_escaped(file.string());
+            buffer += '\n';
+            break;
+        case ListingFormat::JSONL:
+            buffer += "{\"path\":\"";
+            append_escaped(file.string());
+            buffer += "\",\"kind\":\"file\"";
+            if (info) {
+                snprintf(numbers,
+                         sizeof(numbers),
+                         ",\"size\":%llu,\"mtime\":%lld,\"type\":\"",
+                         static_cast<unsigned long long>(info->size),
+                         static_cast<long long>(info->mtime));
+                buffer += numbers;
+                append_escaped(info->type);
+                buffer += '"';
+            }
+            buffer += "}\n";
+            break;
+        case ListingFormat::CSV:
+            append_escaped(file.string());
+            buffer += ",file,";
+            if (info) {
+                snprintf(numbers,
+                         sizeof(numbers),
+                         "%llu,%lld,",
+                         static_cast<unsigned long long>(info->size),
+                         static_cast<long long>(info->mtime));
+                buffer += numbers;
+                append_escaped(info->type);
+            } else {
+                buffer += ",,";
+            }
+            buffer += '\n';
+            break;
+        case ListingFormat::NONE:
+            return;
+    }
+
+    if (buffer.size() >= BUFFER_FLUSH_SIZE) {
+        write_buffer();
+    }
+}
+
+void ListingWriter::finish_folder() {
+    write_buffer();
+    out.flush();
+}
+
+bool ListingWriter::parse_format(const std::string& name, ListingFormat& format_out) noexcept {
+    if (name == "text") {
+        format_out = ListingFormat::TEXT;
+    } else if (name == "jsonl") {
+        format_out = ListingFormat::JSONL;
+    } else if (name == "csv") {
+        format_out = ListingFormat::CSV;
+    } else if (name == "null") {
+        format_out = ListingFormat::NONE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+void ListingWriter::append_escaped(const std::string& str) {
+    // Quoted as std::quoted does, like paths written to a stream
+    if (format == ListingFormat::TEXT) {
+        buffer += '"';
+        for (char c : str) {
+            if (c == '"' || c == '\\') {
+                buffer += '\\';
+            }
+            buffer += c;
+        }
+        buffer += '"';
+        return;
+    }
+
+    if (format == ListingFormat::CSV) {
+        if (str.find_first_of(",\"\n") == std::string::npos) {
+            buffer += str;
+            return;
+        }
+
+        buffer += '"';
+        for (char c : str) {
+            if (c == '"') {
+                buffer += '"';
+            }
+            buffer += c;
+        }
+        buffer += '"';
+        return;
+    }
+
+    for (char c : str) {
+        switch (c) {
+            case '"':
+                buffer += "\\\"";
+                break;
+            case '\\':
+                buffer += "\\\\";
+                break;
+            case '\n':
+                buffer += "\\n";
+                break;
+            case '\t':
+                buffer += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    buffer += escaped;
+                } else {
+                    buffer += c;
+                }
+        }
+    }
+}
+
+void ListingWriter::write_buffer() {
+    if (!buffer.empty()) {
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+}
@@ -0,0 +1,55 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_LISTING_WRITER_H
+#define PHCOPY_LISTING_WRITER_H
+
+#include "gphoto_camera.h"
+
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+
+enum class ListingFormat { TEXT, JSONL, CSV, NONE };
+
+// Formats listing entries into an internal buffer and hands it to the stream in big chunks.
+// Nothing is flushed per line, the stream is flushed only when a folder is completed.
+class ListingWriter {
+public:
+    ListingWriter(std::ostream& out, ListingFormat format);
+    ~ListingWriter();
+
+    ListingWriter(const ListingWriter&) = delete;
+    ListingWriter& operator=(const ListingWriter&) = delete;
+
+    bool needs_file_info() const noexcept;
+
+    void write_folder(const std::filesystem::path& folder);
+    void write_file(const std::filesystem::path& file, const std::optional<FileInfo>& info);
+    void finish_folder();
+
+    static bool parse_format(const std::string& name, ListingFormat& format_out) noexcept;
+
+private:
+    void append_escaped(const std::string& str);
+    void write_buffer();
+
+    std::ostream& out;
+    ListingFormat format;
+    std::string buffer;
+};
+
+#endif // PHCOPY_LISTING_WRITER_H
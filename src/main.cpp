@@ -13,18 +13,25 @@
 //
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "diff_command.h"
 #include "download_command.h"
+#include "extract_command.h"
 #include "list_devices_command.h"
 #include "list_files_command.h"
+#include "query_command.h"
+#include "snapshot_command.h"
+#include "trace.h"
 
 #include <boost/program_options.hpp>
 #include <iomanip>
 #include <iostream>
+#include <optional>
+#include <sstream>
 #include <variant>
 
 namespace po = boost::program_options;
 
-enum class command { LIST_DEVICES, LIST_FILES, DOWNLOAD_FILES };
+enum class command { LIST_DEVICES, LIST_FILES, DOWNLOAD_FILES, SNAPSHOT, DIFF, EXTRACT, QUERY };
 
 struct ListDevicesCommandParameters {};
 
@@ -32,27 +39,69 @@ struct ListFilesCommandParameters {
     int device_index {-1};
     std::filesystem::path path;
     bool recursive {false};
+    ListingFormat format {ListingFormat::TEXT};
+    bool all_storages {false};
 };
 
 struct DownloadCommandParameters {
     int device_index {-1};
     std::filesystem::path source;
     std::filesystem::path destination;
-    bool recursive {false};
-    bool skip {false};
+    DownloadOptions options;
+};
+
+struct SnapshotCommandParameters {
+    int device_index {-1};
+    std::filesystem::path path;
+    std::filesystem::path snapshot_file;
+};
+
+struct DiffCommandParameters {
+    int device_index {-1};
+    std::filesystem::path old_snapshot;
+    std::filesystem::path new_snapshot;
 };
 
-using Options = std::variant<ListDevicesCommandParameters, ListFilesCommandParameters, DownloadCommandParameters>;
+struct ExtractCommandParameters {
+    std::filesystem::path pack_folder;
+    std::string path;
+    std::filesystem::path destination;
+};
+
+struct QueryCommandParameters {
+    std::filesystem::path folder;
+    MetadataQuery query;
+    ListingFormat format {ListingFormat::TEXT};
+};
+
+using Options = std::variant<ListDevicesCommandParameters,
+                             ListFilesCommandParameters,
+                             DownloadCommandParameters,
+                             SnapshotCommandParameters,
+                             DiffCommandParameters,
+                             ExtractCommandParameters,
+                             QueryCommandParameters>;
 
 namespace {
 
+constexpr double BYTES_IN_MEGABYTE = 1024 * 1024;
+constexpr double BYTES_IN_GIGABYTE = 1024 * BYTES_IN_MEGABYTE;
+
 inline const char* LIST_DEVICES_COMMAND = "list";
 inline const char* LIST_FILES_COMMAND = "list-files";
 inline const char* DOWNLOAD_FILES_COMMAND = "download";
+inline const char* SNAPSHOT_COMMAND = "snapshot";
+inline const char* DIFF_COMMAND = "diff";
+inline const char* EXTRACT_COMMAND = "extract";
+inline const char* QUERY_COMMAND = "query";
 
 const std::pair<const char*, command> SUPPORTED_COMMANDS[] = {{LIST_DEVICES_COMMAND, command::LIST_DEVICES},
                                                               {LIST_FILES_COMMAND, command::LIST_FILES},
-                                                              {DOWNLOAD_FILES_COMMAND, command::DOWNLOAD_FILES}};
+                                                              {DOWNLOAD_FILES_COMMAND, command::DOWNLOAD_FILES},
+                                                              {SNAPSHOT_COMMAND, command::SNAPSHOT},
+                                                              {DIFF_COMMAND, command::DIFF},
+                                                              {EXTRACT_COMMAND, command::EXTRACT},
+                                                              {QUERY_COMMAND, command::QUERY}};
 
 // clang-format off
 inline const char* HELP_STRING = ""
@@ -62,17 +111,124 @@ inline const char* HELP_STRING = ""
 "        list                          Display connected devices\n"
 "        list-files PATH               Display files on the device located in\n"
 "                                      the specific path\n"
-"        download SOURCE DESTINATION   Download files from SOURCE on\n"
+"        download SOURCE DESTINATION [DESTINATION...]\n"
+"                                      Download files from SOURCE on\n"
 "                                      the device to DESTINATION\n"
-"                                      DESTINATION folder must exists\n"
+"                                      DESTINATION folder must exists.\n"
+"                                      With several destinations every\n"
+"                                      file is fetched once and written\n"
+"                                      to all of them\n"
+"        snapshot PATH FILE            Save names, sizes and modification\n"
+"                                      times of all files under PATH on\n"
+"                                      the device to FILE\n"
+"        diff SNAPSHOT [SNAPSHOT]      Print files that are new or changed\n"
+"                                      since the first snapshot, either on\n"
+"                                      the device or in the second snapshot.\n"
+"                                      The output can be used with\n"
+"                                      download --files-from\n"
+"        extract PACKS PATH DESTINATION\n"
+"                                      Extract file or folder PATH from\n"
+"                                      packs in PACKS folder written by\n"
+"                                      download --pack to DESTINATION\n"
+"        query FOLDER                  Print files of FOLDER with capture\n"
+"                                      time, location and camera model\n"
+"                                      from the index written by\n"
+"                                      download --transform metadata\n"
 "\n"
 "Parameters:\n"
 "        -d, --device NUMBER           Use device NUMBER. Default is 0\n"
+"        --device-port PORT            Use the device at PORT, e.g.\n"
+"                                      usb:001,005 (see list)\n"
+"        --device-serial SERIAL        Use the device with serial number\n"
+"                                      SERIAL. Devices used before are\n"
+"                                      opened without probing all ports\n"
 "        -h, --help                    Print this help\n"
 "        -r, --recursive               Recursive traverse directories\n"
 "                                      (applies for list-files and\n"
 "                                      download commands)\n"
-"        -s, --skip                    Don't overwrite files\n";
+"        -s, --skip                    Don't overwrite files\n"
+"        -f, --format FORMAT           Output format of list-files: text\n"
+"                                      (default), jsonl, csv or null.\n"
+"                                      jsonl and csv include size, mtime\n"
+"                                      and type of every file. query\n"
+"                                      supports text, jsonl and null\n"
+"        -x, --exclude KIND[,KIND...]  Don't download files of the given kind\n"
+"                                      from photo assets. KIND is one of:\n"
+"                                      live (Live Photo videos), edited\n"
+"                                      (IMG_E* copies), sidecar (.AAE)\n"
+"                                      (applies for download command)\n"
+"        --files-from FILE             Download only files listed in FILE,\n"
+"                                      one path per line, instead of\n"
+"                                      enumerating SOURCE\n"
+"        --limit-rate MB               Limit total transfer speed to MB\n"
+"                                      megabytes per second\n"
+"        --limit-iops NUMBER           Limit total destination writes to\n"
+"                                      NUMBER operations per second\n"
+"        --device-limit-rate MB        Limit transfer speed of the device\n"
+"        --device-limit-iops NUMBER    Limit destination writes of the device\n"
+"        -t, --transform NAME[,NAME...]\n"
+"                                      Process downloaded files while they\n"
+"                                      are in memory. NAME is one of:\n"
+"                                      sha256 (write FILE.sha256),\n"
+"                                      metadata (index EXIF, HEIF and\n"
+"                                      QuickTime capture time, location\n"
+"                                      and camera in DESTINATION)\n"
+"        --pack                        Append downloaded files to tar packs\n"
+"                                      with offset indexes in DESTINATION\n"
+"                                      instead of writing separate files\n"
+"        --pack-size GB                Start a new pack after GB gigabytes.\n"
+"                                      Default is 4\n"
+"        --manifest FILE               Write every downloaded file with\n"
+"                                      the result for each destination\n"
+"                                      to FILE\n"
+"        --all-storages                Use PATH or SOURCE in every storage\n"
+"                                      of the device and report their free\n"
+"                                      space. download writes each storage\n"
+"                                      to its own folder in DESTINATION\n"
+"        --dry-run                     Only enumerate and report number of\n"
+"                                      files, total size, estimated time\n"
+"                                      and free space of DESTINATION\n"
+"        --plan FILE                   Save the plan of --dry-run to FILE,\n"
+"                                      or download files of the saved plan\n"
+"                                      without enumerating the device\n"
+"        --incremental                 Download files of every folder as\n"
+"                                      soon as it's listed instead of\n"
+"                                      planning the whole transfer first,\n"
+"                                      not with --pack, --all-storages and\n"
+"                                      --files-from. Runs on one worker\n"
+"                                      (TaskScheduler(1)), so there is no\n"
+"                                      work stealing\n"
+"        --async-write                 Write files in the background while\n"
+"                                      the next ones are transferred\n"
+"                                      (io_uring if available)\n"
+"        --delete-after-verify         Delete downloaded files from the\n"
+"                                      device once size and checksum of\n"
+"                                      every copy are verified\n"
+"        --control-socket FILE         Accept pause, resume, cancel and\n"
+"                                      prioritize FOLDER commands on unix\n"
+"                                      socket FILE during download.\n"
+"                                      SIGINT cancels, SIGUSR1 pauses and\n"
+"                                      SIGUSR2 resumes download as well\n"
+"        --no-cache                    Don't reuse folder listings of the\n"
+"                                      device cached by previous runs\n"
+"        --record FILE                 Record all device calls with their\n"
+"                                      timings to FILE\n"
+"        --replay FILE                 Serve device calls from a session\n"
+"                                      recorded with --record instead of\n"
+"                                      a connected device\n"
+"        --trace FILE                  Write timeline of device calls and\n"
+"                                      transfer stages to FILE in Chrome\n"
+"                                      trace event format (Perfetto)\n"
+"        --replay-speed N              Replay N times faster than recorded,\n"
+"                                      0 for no delays. Default is 1\n"
+"        --from DATE, --to DATE        Only files captured in the range,\n"
+"                                      YYYY-MM-DD [HH:MM:SS] local time\n"
+"                                      of the capture (applies for query)\n"
+"        --model TEXT                  Only files of cameras whose make\n"
+"                                      and model contain TEXT (applies\n"
+"                                      for query)\n"
+"        --with-location               Only files with GPS position\n"
+"                                      (applies for query)\n";
 // clang-format on
 } // namespace
 
@@ -80,7 +236,10 @@ void print_help() {
     std::cout << HELP_STRING << std::endl;
 }
 
-std::optional<Options> parse_options(int argc, char* argv[]) {
+std::optional<Options> parse_options(int argc,
+                                     char* argv[],
+                                     SessionTraceOptions& session_trace,
+                                     DeviceSelection& device_selection) {
     po::options_description desc("All options");
 
     // clang-format off
@@ -88,9 +247,38 @@ std::optional<Options> parse_options(int argc, char* argv[]) {
             ("command", po::value<std::string>()->required(), "")
             ("help,h", "")
             ("device,d", po::value<int>()->default_value(0), "")
+            ("device-port", po::value<std::string>(), "")
+            ("device-serial", po::value<std::string>(), "")
             ("subargs", po::value<std::vector<std::string> >(), "")
             ("recursive,r", "")
-            ("skip,s", "");
+            ("skip,s", "")
+            ("format,f", po::value<std::string>()->default_value("text"), "")
+            ("exclude,x", po::value<std::vector<std::string>>()->composing(), "")
+            ("files-from", po::value<std::string>(), "")
+            ("limit-rate", po::value<double>()->default_value(0), "")
+            ("limit-iops", po::value<int64_t>()->default_value(0), "")
+            ("device-limit-rate", po::value<double>()->default_value(0), "")
+            ("device-limit-iops", po::value<int64_t>()->default_value(0), "")
+            ("transform,t", po::value<std::vector<std::string>>()->composing(), "")
+            ("pack", "")
+            ("pack-size", po::value<double>()->default_value(4), "")
+            ("manifest", po::value<std::string>(), "")
+            ("all-storages", "")
+            ("dry-run", "")
+            ("plan", po::value<std::string>(), "")
+            ("incremental", "")
+            ("async-write", "")
+            ("delete-after-verify", "")
+            ("control-socket", po::value<std::string>(), "")
+            ("no-cache", "")
+            ("record", po::value<std::string>(), "")
+            ("replay", po::value<std::string>(), "")
+            ("replay-speed", po::value<double>()->default_value(1), "")
+            ("trace", po::value<std::string>(), "")
+            ("from", po::value<std::string>(), "")
+            ("to", po::value<std::string>(), "")
+            ("model", po::value<std::string>(), "")
+            ("with-location", "");
     // clang-format on
 
     po::positional_options_description positional;
@@ -113,6 +301,7 @@ std::optional<Options> parse_options(int argc, char* argv[]) {
     }
 
     const auto& command = vm["command"].as<std::string>();
+    std::filesystem::path path, destination;
 
     auto pos = std::find_if(std::begin(SUPPORTED_COMMANDS), std::end(SUPPORTED_COMMANDS), [&](const auto& elem) {
         return elem.first == command;
@@ -141,17 +330,85 @@ std::optional<Options> parse_options(int argc, char* argv[]) {
             std::cerr << "Path is missing" << std::endl;
             return std::nullopt;
         }
+    } else if (command == SNAPSHOT_COMMAND || command == DIFF_COMMAND) {
+        po::options_description ls_desc("snapshot options");
+        // clang-format off
+        ls_desc.add_options()
+                ("path", po::value<std::string>()->required(), "Path to snapshot")
+                ("destination", po::value<std::string>(), "Snapshot file");
+        // clang-format on
+
+        po::positional_options_description snapshot_positional;
+        snapshot_positional.add("path", 1);
+        snapshot_positional.add("destination", 1);
+
+        std::vector<std::string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+        opts.erase(opts.begin());
+
+        po::store(po::command_line_parser(opts).options(ls_desc).positional(snapshot_positional).run(), vm);
+
+        if (vm.count("path") == 0) {
+            std::cerr << (command == SNAPSHOT_COMMAND ? "Path is missing" : "Snapshot is missing") << std::endl;
+            return std::nullopt;
+        }
+
+        if (command == SNAPSHOT_COMMAND && vm.count("destination") == 0) {
+            std::cerr << "Snapshot file is missing" << std::endl;
+            return std::nullopt;
+        }
+    } else if (command == EXTRACT_COMMAND) {
+        po::options_description ls_desc("extract options");
+        // clang-format off
+        ls_desc.add_options()
+                ("packs", po::value<std::string>()->required(), "Folder with packs")
+                ("path", po::value<std::string>()->required(), "Path to extract")
+                ("destination", po::value<std::string>()->required(), "Destination folder");
+        // clang-format on
+
+        po::positional_options_description extract_positional;
+        extract_positional.add("packs", 1);
+        extract_positional.add("path", 1);
+        extract_positional.add("destination", 1);
+
+        std::vector<std::string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+        opts.erase(opts.begin());
+
+        po::store(po::command_line_parser(opts).options(ls_desc).positional(extract_positional).run(), vm);
+
+        if (vm.count("packs") == 0 || vm.count("path") == 0 || vm.count("destination") == 0) {
+            std::cerr << "Usage: phcopy extract PACKS PATH DESTINATION" << std::endl;
+            return std::nullopt;
+        }
+    } else if (command == QUERY_COMMAND) {
+        po::options_description ls_desc("query options");
+        // clang-format off
+        ls_desc.add_options()
+                ("path", po::value<std::string>()->required(), "Download folder");
+        // clang-format on
+
+        po::positional_options_description query_positional;
+        query_positional.add("path", 1);
+
+        std::vector<std::string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
+        opts.erase(opts.begin());
+
+        po::store(po::command_line_parser(opts).options(ls_desc).positional(query_positional).run(), vm);
+
+        if (vm.count("path") == 0) {
+            std::cerr << "Folder is missing" << std::endl;
+            return std::nullopt;
+        }
     } else if (command == DOWNLOAD_FILES_COMMAND) {
         po::options_description ls_desc("download options");
         // clang-format off
         ls_desc.add_options()
                 ("path", po::value<std::string>()->required(), "Path to list")
-                ("destination", po::value<std::string>()->required(), "Path to list");
+                ("destinations", po::value<std::vector<std::string>>()->required(), "Destination folders");
         // clang-format on
 
         po::positional_options_description list_files_positional;
         list_files_positional.add("path", 1);
-        list_files_positional.add("destination", 1);
+        list_files_positional.add("destinations", -1);
 
         std::vector<std::string> opts = po::collect_unrecognized(parsed.options, po::include_positional);
         opts.erase(opts.begin());
@@ -163,13 +420,13 @@ std::optional<Options> parse_options(int argc, char* argv[]) {
             return std::nullopt;
         }
 
-        if (vm.count("destination") == 0) {
+        if (vm.count("destinations") == 0) {
             std::cerr << "Destination is missing" << std::endl;
             return std::nullopt;
         }
+        destination = vm["destinations"].as<std::vector<std::string>>().front();
     }
 
-    std::filesystem::path path, destination;
     if (vm.count("path") > 0) {
         path = vm["path"].as<std::string>();
     }
@@ -181,12 +438,181 @@ std::optional<Options> parse_options(int argc, char* argv[]) {
     bool recursive = vm.count("recursive") > 0;
     bool skip = vm.count("skip") > 0;
 
+    if (vm.count("record") > 0) {
+        session_trace.record_file = vm["record"].as<std::string>();
+    }
+    if (vm.count("replay") > 0) {
+        session_trace.replay_file = vm["replay"].as<std::string>();
+    }
+    session_trace.replay_speed = vm["replay-speed"].as<double>();
+    session_trace.listing_cache = vm.count("no-cache") == 0;
+    if (vm.count("device-port") > 0) {
+        device_selection.port = vm["device-port"].as<std::string>();
+    }
+    if (vm.count("device-serial") > 0) {
+        device_selection.serial = vm["device-serial"].as<std::string>();
+    }
+    if (vm.count("trace") > 0) {
+        session_trace.trace_file = vm["trace"].as<std::string>();
+    }
+
     if (command == LIST_DEVICES_COMMAND) {
         return ListDevicesCommandParameters {};
     } else if (command == LIST_FILES_COMMAND) {
-        return ListFilesCommandParameters {vm["device"].as<int>(), path, recursive};
+        ListingFormat format;
+        if (!ListingWriter::parse_format(vm["format"].as<std::string>(), format)) {
+            std::cerr << "Unknown output format: " << vm["format"].as<std::string>() << std::endl;
+            return std::nullopt;
+        }
+
+        return ListFilesCommandParameters {
+                vm["device"].as<int>(), path, recursive, format, vm.count("all-storages") > 0};
+    } else if (command == SNAPSHOT_COMMAND) {
+        return SnapshotCommandParameters {vm["device"].as<int>(), path, destination};
+    } else if (command == DIFF_COMMAND) {
+        return DiffCommandParameters {vm["device"].as<int>(), path, destination};
+    } else if (command == EXTRACT_COMMAND) {
+        return ExtractCommandParameters {vm["packs"].as<std::string>(), vm["path"].as<std::string>(), destination};
+    } else if (command == QUERY_COMMAND) {
+        QueryCommandParameters params;
+        params.folder = path;
+        if (!ListingWriter::parse_format(vm["format"].as<std::string>(), params.format) ||
+            params.format == ListingFormat::CSV) {
+            std::cerr << "Unsupported output format of query: " << vm["format"].as<std::string>() << std::endl;
+            return std::nullopt;
+        }
+        if (vm.count("from") > 0 &&
+            !MetadataQuery::parse_time(vm["from"].as<std::string>(), false, params.query.from)) {
+            std::cerr << "Invalid date: " << vm["from"].as<std::string>() << std::endl;
+            return std::nullopt;
+        }
+        if (vm.count("to") > 0 && !MetadataQuery::parse_time(vm["to"].as<std::string>(), true, params.query.to)) {
+            std::cerr << "Invalid date: " << vm["to"].as<std::string>() << std::endl;
+            return std::nullopt;
+        }
+        if (vm.count("model") > 0) {
+            params.query.model = vm["model"].as<std::string>();
+        }
+        params.query.with_location = vm.count("with-location") > 0;
+        return params;
     } else {
-        return DownloadCommandParameters {vm["device"].as<int>(), path, destination, recursive, skip};
+        DownloadOptions download_options;
+        download_options.recursive = recursive;
+        download_options.skip_existing = skip;
+        if (vm.count("files-from") > 0) {
+            download_options.files_from = vm["files-from"].as<std::string>();
+        }
+
+        // Converting a negative double to an unsigned integer is undefined
+        for (const char* option : {"limit-rate", "device-limit-rate", "pack-size"}) {
+            if (vm[option].as<double>() < 0) {
+                std::cerr << "--" << option << " can't be negative" << std::endl;
+                return std::nullopt;
+            }
+        }
+        // Parsed as signed, an unsigned value would silently wrap "-1" around to no limit
+        for (const char* option : {"limit-iops", "device-limit-iops"}) {
+            if (vm[option].as<int64_t>() < 0) {
+                std::cerr << "--" << option << " can't be negative" << std::endl;
+                return std::nullopt;
+            }
+        }
+
+        std::shared_ptr<RateLimiter> global_bytes, global_write_ops;
+        auto rate = static_cast<uint64_t>(vm["limit-rate"].as<double>() * BYTES_IN_MEGABYTE);
+        auto iops = static_cast<uint64_t>(vm["limit-iops"].as<int64_t>());
+        if (rate > 0) {
+            global_bytes = std::make_shared<RateLimiter>(rate, rate);
+        }
+        if (iops > 0) {
+            global_write_ops = std::make_shared<RateLimiter>(iops, iops);
+        }
+        download_options.throttle.set_global_limits(global_bytes, global_write_ops);
+        download_options.throttle.set_device_limits(
+                static_cast<uint64_t>(vm["device-limit-rate"].as<double>() * BYTES_IN_MEGABYTE),
+                static_cast<uint64_t>(vm["device-limit-iops"].as<int64_t>()));
+
+        if (vm.count("exclude") > 0) {
+            for (const auto& value : vm["exclude"].as<std::vector<std::string>>()) {
+                std::istringstream kinds(value);
+                std::string kind_name;
+                while (std::getline(kinds, kind_name, ',')) {
+                    AssetFileKind kind;
+                    if (!AssetFilter::parse_kind(kind_name, kind)) {
+                        std::cerr << "Unknown asset file kind: " << kind_name << std::endl;
+                        return std::nullopt;
+                    }
+                    download_options.asset_filter.exclude(kind);
+                }
+            }
+        }
+
+        if (vm.count("transform") > 0) {
+            for (const auto& value : vm["transform"].as<std::vector<std::string>>()) {
+                std::istringstream names(value);
+                std::string name;
+                while (std::getline(names, name, ',')) {
+                    auto transform = make_transform(name);
+                    if (!transform) {
+                        std::cerr << "Unknown transform: " << name << std::endl;
+                        return std::nullopt;
+                    }
+                    download_options.transforms.push_back(std::move(transform));
+                }
+            }
+        }
+
+        download_options.pack = vm.count("pack") > 0;
+        download_options.max_pack_size = static_cast<uint64_t>(vm["pack-size"].as<double>() * BYTES_IN_GIGABYTE);
+        if (download_options.pack && !download_options.transforms.empty()) {
+            std::cerr << "Transforms can't be used together with --pack" << std::endl;
+            return std::nullopt;
+        }
+
+        const auto& destinations = vm["destinations"].as<std::vector<std::string>>();
+        download_options.mirrors.assign(destinations.begin() + 1, destinations.end());
+        if (vm.count("manifest") > 0) {
+            download_options.manifest_file = vm["manifest"].as<std::string>();
+        }
+        if (vm.count("control-socket") > 0) {
+            download_options.control_socket = vm["control-socket"].as<std::string>();
+        }
+
+        download_options.delete_after_verify = vm.count("delete-after-verify") > 0;
+        download_options.async_write = vm.count("async-write") > 0;
+        download_options.all_storages = vm.count("all-storages") > 0;
+        download_options.dry_run = vm.count("dry-run") > 0;
+        if (vm.count("plan") > 0) {
+            download_options.plan_file = vm["plan"].as<std::string>();
+        }
+        download_options.incremental = vm.count("incremental") > 0;
+        if (download_options.incremental && (download_options.dry_run || !download_options.plan_file.empty())) {
+            std::cerr << "--incremental can't be used together with --dry-run and --plan" << std::endl;
+            return std::nullopt;
+        }
+
+        if (download_options.all_storages && !download_options.files_from.empty()) {
+            std::cerr << "--all-storages can't be used together with --files-from" << std::endl;
+            return std::nullopt;
+        }
+
+        bool fan_out = !download_options.mirrors.empty() || !download_options.manifest_file.empty();
+        if (download_options.pack && fan_out) {
+            std::cerr << "Several destinations and --manifest can't be used together with --pack" << std::endl;
+            return std::nullopt;
+        }
+        if (download_options.pack && (download_options.delete_after_verify || download_options.async_write)) {
+            std::cerr << "--delete-after-verify and --async-write can't be used together with --pack" << std::endl;
+            return std::nullopt;
+        }
+        if (download_options.incremental &&
+            (download_options.pack || download_options.all_storages || !download_options.files_from.empty())) {
+            std::cerr << "--incremental can't be used together with --pack, --all-storages and --files-from"
+                      << std::endl;
+            return std::nullopt;
+        }
+
+        return DownloadCommandParameters {vm["device"].as<int>(), path, destination, download_options};
     }
 }
 
@@ -198,35 +624,70 @@ template<class... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 
 int main(int argc, char* argv[]) {
-    std::optional<Options> options = parse_options(argc, argv);
+    SessionTraceOptions session_trace;
+    DeviceSelection device_selection;
+    std::optional<Options> options = parse_options(argc, argv, session_trace, device_selection);
     if (!options) {
         return 0;
     }
 
+    if (!session_trace.trace_file.empty()) {
+#ifdef PHCOPY_TRACING
+        if (!Tracer::instance().start(session_trace.trace_file)) {
+            return 1;
+        }
+#else
+        std::cerr << "Tracing is disabled in this build" << std::endl;
+#endif
+    }
+
     try {
         std::unique_ptr<Command> command;
         std::visit(overloaded {[&](const ListDevicesCommandParameters&) {
                                    command = std::make_unique<ListDevicesCommand>();
                                },
                                [&](const ListFilesCommandParameters& params) {
-                                   command = std::make_unique<ListFilesCommand>(
-                                           params.device_index, params.path, params.recursive);
+                                   command = std::make_unique<ListFilesCommand>(params.device_index,
+                                                                                params.path,
+                                                                                params.recursive,
+                                                                                params.format,
+                                                                                params.all_storages);
                                },
                                [&](const DownloadCommandParameters& params) {
                                    command = std::make_unique<DownloadCommand>(params.device_index,
                                                                                params.source,
                                                                                params.destination,
-                                                                               params.recursive,
-                                                                               params.skip);
+                                                                               params.options);
+                               },
+                               [&](const SnapshotCommandParameters& params) {
+                                   command = std::make_unique<SnapshotCommand>(
+                                           params.device_index, params.path, params.snapshot_file);
+                               },
+                               [&](const DiffCommandParameters& params) {
+                                   command = std::make_unique<DiffCommand>(
+                                           params.device_index, params.old_snapshot, params.new_snapshot);
+                               },
+                               [&](const ExtractCommandParameters& params) {
+                                   command = std::make_unique<ExtractCommand>(
+                                           params.pack_folder, params.path, params.destination);
+                               },
+                               [&](const QueryCommandParameters& params) {
+                                   command = std::make_unique<QueryCommand>(params.folder, params.query, params.format);
                                }},
                    *options);
         if (command) {
+            command->set_session_trace(session_trace);
+            command->set_device_selection(device_selection);
+            command->set_event_listener(std::make_shared<ConsoleEventPrinter>());
             command->execute();
         }
     } catch (std::runtime_error& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
+        Tracer::instance().stop();
         return 1;
     }
 
+    Tracer::instance().stop();
+
     return 0;
 }
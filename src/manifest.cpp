@@ -0,0 +1,49 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "manifest.h"
+
+#include <iostream>
+
+Manifest::Manifest(std::ofstream out) : out(std::move(out)) {}
+
+std::shared_ptr<Manifest> Manifest::create(const std::filesystem::path& file,
+                                           const std::vector<std::filesystem::path>& destinations) {
+    std::ofstream out(file, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Can't create manifest " << file << std::endl;
+        return nullptr;
+    }
+
+    out << "# source\tsize";
+    for (const auto& destination : destinations) {
+        out << '\t' << destination.string();
+    }
+    out << '\n';
+
+    return std::shared_ptr<Manifest>(new Manifest(std::move(out)));
+}
+
+void Manifest::add(const std::string& source, uint64_t size, const std::vector<bool>& results) {
+    std::string line = source + '\t' + std::to_string(size);
+    for (bool result : results) {
+        line += result ? "\tOK" : "\tFAILED";
+    }
+    line += '\n';
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << line;
+    out.flush();
+}
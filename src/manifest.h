@@ -0,0 +1,43 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_MANIFEST_H
+#define PHCOPY_MANIFEST_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Tab separated log of transferred files: remote path, size and the result for every destination
+class Manifest {
+public:
+    static std::shared_ptr<Manifest> create(const std::filesystem::path& file,
+                                            const std::vector<std::filesystem::path>& destinations);
+
+    // results[i] is the outcome for destinations[i]
+    void add(const std::string& source, uint64_t size, const std::vector<bool>& results);
+
+private:
+    explicit Manifest(std::ofstream out);
+
+    std::mutex mutex;
+    std::ofstream out;
+};
+
+#endif // PHCOPY_MANIFEST_H
@@ -0,0 +1,527 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "media_metadata.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t TAG_MAKE = 0x010F;
+constexpr uint16_t TAG_MODEL = 0x0110;
+constexpr uint16_t TAG_DATE_TIME = 0x0132;
+constexpr uint16_t TAG_EXIF_IFD = 0x8769;
+constexpr uint16_t TAG_GPS_IFD = 0x8825;
+constexpr uint16_t TAG_DATE_TIME_ORIGINAL = 0x9003;
+constexpr uint16_t TAG_GPS_LATITUDE_REF = 1;
+constexpr uint16_t TAG_GPS_LATITUDE = 2;
+constexpr uint16_t TAG_GPS_LONGITUDE_REF = 3;
+constexpr uint16_t TAG_GPS_LONGITUDE = 4;
+
+constexpr uint16_t TYPE_ASCII = 2;
+constexpr uint16_t TYPE_SHORT = 3;
+constexpr uint16_t TYPE_LONG = 4;
+constexpr uint16_t TYPE_RATIONAL = 5;
+
+// Seconds between 1904-01-01, the QuickTime epoch, and 1970-01-01
+constexpr uint64_t QUICKTIME_EPOCH_OFFSET = 2082844800;
+
+using Bytes = const unsigned char*;
+
+uint16_t read_be16(Bytes p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+uint32_t read_be32(Bytes p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 |
+           p[3];
+}
+
+uint64_t read_be64(Bytes p) {
+    return static_cast<uint64_t>(read_be32(p)) << 32 | read_be32(p + 4);
+}
+
+uint64_t read_be(Bytes p, unsigned size) {
+    uint64_t value = 0;
+    for (unsigned i = 0; i < size; i++) {
+        value = value << 8 | p[i];
+    }
+    return value;
+}
+
+std::string trim(std::string_view value) {
+    auto end = value.find('\0');
+    if (end != std::string_view::npos) {
+        value = value.substr(0, end);
+    }
+    while (!value.empty() && value.back() == ' ') {
+        value.remove_suffix(1);
+    }
+    return std::string(value);
+}
+
+// "YYYY:MM:DD HH:MM:SS" of EXIF or "YYYY-MM-DDTHH:MM:SS..." of ISO 8601, the zone is ignored
+std::time_t parse_date_time(const std::string& value) {
+    std::tm tm {};
+    if (value.size() < 19 || sscanf(value.c_str(),
+                                    "%4d%*c%2d%*c%2d%*c%2d:%2d:%2d",
+                                    &tm.tm_year,
+                                    &tm.tm_mon,
+                                    &tm.tm_mday,
+                                    &tm.tm_hour,
+                                    &tm.tm_min,
+                                    &tm.tm_sec) != 6) {
+        return 0;
+    }
+    if (tm.tm_year == 0) {
+        return 0; // "0000:00:00 00:00:00" of cameras without a clock
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return timegm(&tm);
+}
+
+class TiffReader {
+public:
+    TiffReader(Bytes data, size_t size) : data(data), size(size) {}
+
+    bool parse(MediaMetadata& metadata) const {
+        if (size < 8 || (memcmp(data, "II", 2) != 0 && memcmp(data, "MM", 2) != 0)) {
+            return false;
+        }
+        if (u16(2) != 42) {
+            return false;
+        }
+
+        uint32_t exif_ifd = 0, gps_ifd = 0;
+        std::string date_time;
+        for_each_entry(u32(4), [&](uint16_t tag, uint16_t type, uint32_t count, size_t entry) {
+            if (tag == TAG_MAKE) {
+                metadata.make = ascii(type, count, entry);
+            } else if (tag == TAG_MODEL) {
+                metadata.model = ascii(type, count, entry);
+            } else if (tag == TAG_DATE_TIME) {
+                date_time = ascii(type, count, entry);
+            } else if (tag == TAG_EXIF_IFD) {
+                exif_ifd = integer(type, entry);
+            } else if (tag == TAG_GPS_IFD) {
+                gps_ifd = integer(type, entry);
+            }
+        });
+
+        if (exif_ifd != 0) {
+            for_each_entry(exif_ifd, [&](uint16_t tag, uint16_t type, uint32_t count, size_t entry) {
+                if (tag == TAG_DATE_TIME_ORIGINAL) {
+                    date_time = ascii(type, count, entry);
+                }
+            });
+        }
+        metadata.capture_time = parse_date_time(date_time);
+
+        if (gps_ifd != 0) {
+            std::string latitude_ref, longitude_ref;
+            std::optional<double> latitude, longitude;
+            for_each_entry(gps_ifd, [&](uint16_t tag, uint16_t type, uint32_t count, size_t entry) {
+                if (tag == TAG_GPS_LATITUDE_REF) {
+                    latitude_ref = ascii(type, count, entry);
+                } else if (tag == TAG_GPS_LATITUDE) {
+                    latitude = degrees(type, count, entry);
+                } else if (tag == TAG_GPS_LONGITUDE_REF) {
+                    longitude_ref = ascii(type, count, entry);
+                } else if (tag == TAG_GPS_LONGITUDE) {
+                    longitude = degrees(type, count, entry);
+                }
+            });
+            if (latitude && longitude) {
+                metadata.has_location = true;
+                metadata.latitude = latitude_ref == "S" ? -*latitude : *latitude;
+                metadata.longitude = longitude_ref == "W" ? -*longitude : *longitude;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    bool is_little_endian() const {
+        return data[0] == 'I';
+    }
+
+    uint16_t u16(size_t offset) const {
+        if (offset + 2 > size) {
+            return 0;
+        }
+        return is_little_endian() ? static_cast<uint16_t>(data[offset] | data[offset + 1] << 8)
+                                  : read_be16(data + offset);
+    }
+
+    uint32_t u32(size_t offset) const {
+        if (offset + 4 > size) {
+            return 0;
+        }
+        if (is_little_endian()) {
+            return static_cast<uint32_t>(data[offset]) | static_cast<uint32_t>(data[offset + 1]) << 8 |
+                   static_cast<uint32_t>(data[offset + 2]) << 16 | static_cast<uint32_t>(data[offset + 3]) << 24;
+        }
+        return read_be32(data + offset);
+    }
+
+    // Values up to 4 bytes are stored in the entry itself, larger ones at the offset it holds
+    size_t value_offset(size_t entry, size_t value_size) const {
+        return value_size <= 4 ? entry + 8 : u32(entry + 8);
+    }
+
+    void for_each_entry(size_t ifd, const std::function<void(uint16_t, uint16_t, uint32_t, size_t)>& callback) const {
+        if (ifd == 0 || ifd + 2 > size) {
+            return;
+        }
+        size_t count = u16(ifd);
+        for (size_t i = 0; i < count; i++) {
+            size_t entry = ifd + 2 + i * 12;
+            if (entry + 12 > size) {
+                return;
+            }
+            callback(u16(entry), u16(entry + 2), u32(entry + 4), entry);
+        }
+    }
+
+    std::string ascii(uint16_t type, uint32_t count, size_t entry) const {
+        if (type != TYPE_ASCII) {
+            return {};
+        }
+        size_t offset = value_offset(entry, count);
+        if (offset > size || count > size - offset) {
+            return {};
+        }
+        return trim(std::string_view(reinterpret_cast<const char*>(data + offset), count));
+    }
+
+    uint32_t integer(uint16_t type, size_t entry) const {
+        return type == TYPE_SHORT ? u16(entry + 8) : type == TYPE_LONG ? u32(entry + 8) : 0;
+    }
+
+    // Degrees, minutes and seconds as three rationals
+    std::optional<double> degrees(uint16_t type, uint32_t count, size_t entry) const {
+        if (type != TYPE_RATIONAL || count != 3) {
+            return std::nullopt;
+        }
+        size_t offset = value_offset(entry, 24);
+        if (offset > size || size - offset < 24) {
+            return std::nullopt;
+        }
+
+        double result = 0, scale = 1;
+        for (size_t i = 0; i < 3; i++, scale *= 60) {
+            auto denominator = u32(offset + i * 8 + 4);
+            if (denominator == 0) {
+                continue;
+            }
+            result += static_cast<double>(u32(offset + i * 8)) / denominator / scale;
+        }
+        return result;
+    }
+
+    Bytes data;
+    size_t size;
+};
+
+// Boxes of ISO base media files (HEIF, QuickTime, MP4)
+void for_each_box(Bytes begin, Bytes end, const std::function<bool(std::string_view, Bytes, Bytes)>& callback) {
+    while (end - begin >= 8) {
+        uint64_t box_size = read_be32(begin);
+        std::string_view type(reinterpret_cast<const char*>(begin + 4), 4);
+        size_t header_size = 8;
+        if (box_size == 1) {
+            if (end - begin < 16) {
+                return;
+            }
+            box_size = read_be64(begin + 8);
+            header_size = 16;
+        } else if (box_size == 0) {
+            box_size = static_cast<uint64_t>(end - begin);
+        }
+        if (box_size < header_size || box_size > static_cast<uint64_t>(end - begin)) {
+            return;
+        }
+
+        if (!callback(type, begin + header_size, begin + box_size)) {
+            return;
+        }
+        begin += box_size;
+    }
+}
+
+bool parse_jpeg(Bytes data, size_t size, MediaMetadata& metadata) {
+    size_t pos = 2;
+    while (pos + 4 <= size && data[pos] == 0xFF) {
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++; // Fill byte
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) {
+            break; // Image data starts, no metadata after it
+        }
+
+        size_t length = read_be16(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size) {
+            break;
+        }
+        if (marker == 0xE1 && length >= 8 && memcmp(data + pos + 4, "Exif\0\0", 6) == 0) {
+            return TiffReader(data + pos + 10, length - 8).parse(metadata);
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// The EXIF item of HEIF is located by its id in the item info box and by its extents in the item location box
+bool parse_heif_meta(Bytes file, size_t file_size, Bytes begin, Bytes end, MediaMetadata& metadata) {
+    if (end - begin < 4) {
+        return false;
+    }
+
+    std::optional<uint32_t> exif_item;
+    std::optional<uint64_t> exif_offset;
+    for_each_box(begin + 4, end, [&](std::string_view type, Bytes box, Bytes box_end) {
+        if (type != "iinf" || box_end - box < 6) {
+            return true;
+        }
+        // Version and flags, then the number of entries in 2 bytes, or 4 since version 1
+        ptrdiff_t header_size = box[0] == 0 ? 6 : 8;
+        if (box_end - box < header_size) {
+            return false;
+        }
+        Bytes entries = box + header_size;
+        for_each_box(entries, box_end, [&](std::string_view entry_type, Bytes entry, Bytes entry_end) {
+            if (entry_type != "infe" || entry_end - entry < 12 || entry[0] < 2) {
+                return true;
+            }
+            bool wide_id = entry[0] >= 3;
+            uint32_t item_id = wide_id ? read_be32(entry + 4) : read_be16(entry + 4);
+            Bytes item_type = entry + (wide_id ? 10 : 8);
+            if (item_type + 4 <= entry_end && memcmp(item_type, "Exif", 4) == 0) {
+                exif_item = item_id;
+                return false;
+            }
+            return true;
+        });
+        return false;
+    });
+    if (!exif_item) {
+        return false;
+    }
+
+    for_each_box(begin + 4, end, [&](std::string_view type, Bytes box, Bytes box_end) {
+        // Version and flags, field sizes, then the number of items in 2 bytes, or 4 since version 2
+        if (type != "iloc" || box_end - box < 8) {
+            return true;
+        }
+        unsigned version = box[0];
+        if (version > 2 || (version == 2 && box_end - box < 10)) {
+            return false;
+        }
+        unsigned offset_size = box[4] >> 4, length_size = box[4] & 0x0F;
+        unsigned base_offset_size = box[5] >> 4, index_size = version == 1 || version == 2 ? box[5] & 0x0F : 0;
+        auto valid_size = [](unsigned field_size) { return field_size == 0 || field_size == 4 || field_size == 8; };
+        if (!valid_size(offset_size) || !valid_size(length_size) || !valid_size(base_offset_size) ||
+            !valid_size(index_size)) {
+            return false;
+        }
+        Bytes pos = box + 6;
+        uint32_t items = 0;
+        if (version < 2) {
+            items = read_be16(pos);
+            pos += 2;
+        } else {
+            items = read_be32(pos);
+            pos += 4;
+        }
+
+        for (uint32_t i = 0; i < items; i++) {
+            size_t header_size = (version < 2 ? 2 : 4) + (version == 1 || version == 2 ? 2 : 0) + 2 +
+                                 base_offset_size + 2;
+            if (box_end - pos < static_cast<ptrdiff_t>(header_size)) {
+                return false;
+            }
+            uint32_t item_id = version < 2 ? read_be16(pos) : read_be32(pos);
+            pos += version < 2 ? 2 : 4;
+            if (version == 1 || version == 2) {
+                pos += 2; // Construction method, only offsets in the file are supported
+            }
+            pos += 2; // Data reference index
+            uint64_t base_offset = read_be(pos, base_offset_size);
+            pos += base_offset_size;
+            uint16_t extents = read_be16(pos);
+            pos += 2;
+
+            size_t extent_size = index_size + offset_size + length_size;
+            if (box_end - pos < static_cast<ptrdiff_t>(extent_size * extents)) {
+                return false;
+            }
+            if (item_id == *exif_item && extents > 0) {
+                exif_offset = base_offset + read_be(pos + index_size, offset_size);
+                return false;
+            }
+            pos += extent_size * extents;
+        }
+        return false;
+    });
+    if (!exif_offset || file_size < 4 || *exif_offset > file_size - 4) {
+        return false;
+    }
+
+    // The item starts with the offset of the TIFF header after it, usually skipping "Exif\0\0"
+    uint64_t tiff_offset = *exif_offset + 4 + read_be32(file + *exif_offset);
+    if (tiff_offset >= file_size) {
+        return false;
+    }
+    return TiffReader(file + tiff_offset, file_size - tiff_offset).parse(metadata);
+}
+
+// "+37.7858-122.4064+012.345/"
+bool parse_iso6709(const std::string& value, MediaMetadata& metadata) {
+    const char* begin = value.c_str();
+    char* latitude_end = nullptr;
+    char* longitude_end = nullptr;
+    double latitude = strtod(begin, &latitude_end);
+    if (latitude_end == begin) {
+        return false;
+    }
+    double longitude = strtod(latitude_end, &longitude_end);
+    if (longitude_end == latitude_end) {
+        return false;
+    }
+
+    metadata.has_location = true;
+    metadata.latitude = latitude;
+    metadata.longitude = longitude;
+    return true;
+}
+
+// Apple metadata: key names in the keys box, values in the item list boxes named by 1-based key index
+void parse_quicktime_keys(Bytes begin, Bytes end, MediaMetadata& metadata) {
+    // moov/meta of QuickTime is a plain container, the ISO one is a full box with version and flags
+    if (end - begin >= 4 && read_be32(begin) == 0) {
+        begin += 4;
+    }
+
+    std::vector<std::string> keys;
+    for_each_box(begin, end, [&](std::string_view type, Bytes box, Bytes box_end) {
+        if (type == "keys" && box_end - box >= 8) {
+            uint32_t count = read_be32(box + 4);
+            Bytes pos = box + 8;
+            for (uint32_t i = 0; i < count && box_end - pos >= 8; i++) {
+                uint32_t key_size = read_be32(pos);
+                if (key_size < 8 || key_size > static_cast<uint64_t>(box_end - pos)) {
+                    break;
+                }
+                keys.emplace_back(reinterpret_cast<const char*>(pos + 8), key_size - 8);
+                pos += key_size;
+            }
+        } else if (type == "ilst") {
+            for_each_box(box, box_end, [&](std::string_view item_type, Bytes item, Bytes item_end) {
+                uint32_t key_idx = read_be32(reinterpret_cast<Bytes>(item_type.data()));
+                if (key_idx == 0 || key_idx > keys.size()) {
+                    return true;
+                }
+                const auto& key = keys[key_idx - 1];
+                for_each_box(item, item_end, [&](std::string_view data_type, Bytes value, Bytes value_end) {
+                    // Type indicator and locale precede the value, 1 is UTF-8 text
+                    if (data_type != "data" || value_end - value < 8 || read_be32(value) != 1) {
+                        return true;
+                    }
+                    std::string text(reinterpret_cast<const char*>(value + 8), value_end - value - 8);
+                    if (key == "com.apple.quicktime.make") {
+                        metadata.make = trim(text);
+                    } else if (key == "com.apple.quicktime.model") {
+                        metadata.model = trim(text);
+                    } else if (key == "com.apple.quicktime.creationdate") {
+                        if (auto time = parse_date_time(text); time != 0) {
+                            metadata.capture_time = time;
+                        }
+                    } else if (key == "com.apple.quicktime.location.ISO6709") {
+                        parse_iso6709(text, metadata);
+                    }
+                    return false;
+                });
+                return true;
+            });
+        }
+        return true;
+    });
+}
+
+bool parse_quicktime_movie(Bytes begin, Bytes end, MediaMetadata& metadata) {
+    std::time_t created = 0;
+    for_each_box(begin, end, [&](std::string_view type, Bytes box, Bytes box_end) {
+        if (type == "mvhd" && box_end - box >= 16) {
+            uint64_t time = box[0] == 1 ? read_be64(box + 4) : read_be32(box + 4);
+            if (time > QUICKTIME_EPOCH_OFFSET) {
+                created = static_cast<std::time_t>(time - QUICKTIME_EPOCH_OFFSET);
+            }
+        } else if (type == "meta") {
+            parse_quicktime_keys(box, box_end, metadata);
+        }
+        return true;
+    });
+
+    // The local creation date of the Apple keys wins over the UTC time of the movie header
+    if (metadata.capture_time == 0) {
+        metadata.capture_time = created;
+    }
+    return true;
+}
+
+bool parse_iso_media(Bytes data, size_t size, MediaMetadata& metadata) {
+    bool parsed = false;
+    for_each_box(data, data + size, [&](std::string_view type, Bytes box, Bytes box_end) {
+        if (type == "meta") {
+            parsed = parse_heif_meta(data, size, box, box_end, metadata);
+            return false;
+        }
+        if (type == "moov") {
+            parsed = parse_quicktime_movie(box, box_end, metadata);
+            return false;
+        }
+        // Media data of movies may come before the movie box, it's skipped by its size
+        return true;
+    });
+    return parsed;
+}
+
+} // namespace
+
+std::optional<MediaMetadata> parse_media_metadata(const char* data, size_t size) {
+    auto bytes = reinterpret_cast<Bytes>(data);
+    MediaMetadata metadata;
+
+    bool parsed = false;
+    if (size >= 4 && bytes[0] == 0xFF && bytes[1] == 0xD8) {
+        parsed = parse_jpeg(bytes, size, metadata);
+    } else if (size >= 12 && memcmp(bytes + 4, "ftyp", 4) == 0) {
+        parsed = parse_iso_media(bytes, size, metadata);
+    }
+
+    if (!parsed) {
+        return std::nullopt;
+    }
+    return metadata;
+}
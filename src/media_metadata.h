@@ -0,0 +1,40 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_MEDIA_METADATA_H
+#define PHCOPY_MEDIA_METADATA_H
+
+#include <cstddef>
+#include <ctime>
+#include <optional>
+#include <string>
+
+struct MediaMetadata {
+    // Wall clock time of the capture stored as if it was UTC, 0 if unknown. Files without the local time
+    // (QuickTime without Apple keys) have the UTC time instead.
+    std::time_t capture_time {0};
+    bool has_location {false};
+    double latitude {0};
+    double longitude {0};
+    std::string make;
+    std::string model;
+};
+
+// Reads capture time, GPS position and camera model from EXIF of JPEG, EXIF item of HEIF, and
+// movie header and Apple metadata keys of QuickTime/MP4. Only the headers are walked, the image
+// and media data is skipped. Returns nullopt for other formats and files without metadata.
+std::optional<MediaMetadata> parse_media_metadata(const char* data, size_t size);
+
+#endif // PHCOPY_MEDIA_METADATA_H
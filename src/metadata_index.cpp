@@ -0,0 +1,265 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "metadata_index.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+const char INDEX_MAGIC[8] = {'P', 'H', 'M', 'E', 'T', 'A', '0', '1'};
+
+struct IndexHeader {
+    char magic[8];
+    uint64_t count;
+    uint64_t strings_size;
+};
+
+// Byte offsets of the columns for the number of records
+struct IndexLayout {
+    explicit IndexLayout(uint64_t count)
+      : capture_times(sizeof(IndexHeader)),
+        latitudes(capture_times + count * sizeof(int64_t)),
+        longitudes(latitudes + count * sizeof(double)),
+        paths(longitudes + count * sizeof(double)),
+        makes(paths + count * sizeof(uint32_t)),
+        models(makes + count * sizeof(uint32_t)),
+        strings((models + count * sizeof(uint32_t) + 7) / 8 * 8) {}
+
+    uint64_t capture_times;
+    uint64_t latitudes;
+    uint64_t longitudes;
+    uint64_t paths;
+    uint64_t makes;
+    uint64_t models;
+    uint64_t strings;
+};
+
+// Identical makes and models are stored once
+class StringTable {
+public:
+    StringTable() : data(1, '\0') {}
+
+    uint32_t add(const std::string& value) {
+        if (value.empty()) {
+            return 0;
+        }
+        auto [pos, inserted] = offsets.try_emplace(value, static_cast<uint32_t>(data.size()));
+        if (inserted) {
+            data.append(value);
+            data += '\0';
+        }
+        return pos->second;
+    }
+
+    const std::string& get_data() const noexcept {
+        return data;
+    }
+
+private:
+    std::string data;
+    std::unordered_map<std::string, uint32_t> offsets;
+};
+
+template <typename T>
+void write_column(std::ostream& out, const std::vector<T>& column) {
+    out.write(reinterpret_cast<const char*>(column.data()), static_cast<std::streamsize>(column.size() * sizeof(T)));
+}
+
+} // namespace
+
+std::unique_ptr<MetadataIndex> MetadataIndex::open(const std::filesystem::path& file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Can't open metadata index " << file << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(IndexHeader)) {
+        std::cerr << "Invalid metadata index " << file << std::endl;
+        close(fd);
+        return nullptr;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Can't map metadata index " << file << ": " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    std::unique_ptr<MetadataIndex> index(new MetadataIndex(mapping, size));
+
+    const auto* header = static_cast<const IndexHeader*>(mapping);
+    IndexLayout layout(header->count);
+    // Sizes are checked before the layout is trusted, a corrupted count must not point outside the mapping
+    bool valid = memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                 header->count <= size / (sizeof(int64_t) + 2 * sizeof(double) + 3 * sizeof(uint32_t)) &&
+                 layout.strings <= size && header->strings_size == size - layout.strings &&
+                 header->strings_size > 0;
+    if (valid) {
+        const auto* base = static_cast<const char*>(mapping);
+        index->count = header->count;
+        index->capture_times = reinterpret_cast<const int64_t*>(base + layout.capture_times);
+        index->latitudes = reinterpret_cast<const double*>(base + layout.latitudes);
+        index->longitudes = reinterpret_cast<const double*>(base + layout.longitudes);
+        index->paths = reinterpret_cast<const uint32_t*>(base + layout.paths);
+        index->makes = reinterpret_cast<const uint32_t*>(base + layout.makes);
+        index->models = reinterpret_cast<const uint32_t*>(base + layout.models);
+        index->strings = base + layout.strings;
+
+        valid = index->strings[header->strings_size - 1] == '\0';
+        for (size_t i = 0; valid && i < index->count; i++) {
+            valid = index->paths[i] < header->strings_size && index->makes[i] < header->strings_size &&
+                    index->models[i] < header->strings_size;
+        }
+    }
+    if (!valid) {
+        std::cerr << "Invalid metadata index " << file << std::endl;
+        return nullptr;
+    }
+
+    return index;
+}
+
+bool MetadataIndex::update(const std::filesystem::path& file, std::vector<MetadataRecord> records) {
+    if (std::filesystem::exists(file)) {
+        auto existing = open(file);
+        if (!existing) {
+            return false;
+        }
+        for (size_t i = 0; i < existing->size(); i++) {
+            records.push_back(existing->record(i));
+        }
+    }
+
+    // The new records come first, so they are the ones kept among the duplicates
+    std::stable_sort(records.begin(), records.end(), [](const MetadataRecord& lhs, const MetadataRecord& rhs) {
+        return lhs.path < rhs.path;
+    });
+    auto last = std::unique(records.begin(), records.end(), [](const MetadataRecord& lhs, const MetadataRecord& rhs) {
+        return lhs.path == rhs.path;
+    });
+    records.erase(last, records.end());
+
+    StringTable strings;
+    std::vector<int64_t> capture_times;
+    std::vector<double> latitudes, longitudes;
+    std::vector<uint32_t> paths, makes, models;
+    for (const auto& record : records) {
+        const auto& metadata = record.metadata;
+        capture_times.push_back(metadata.capture_time);
+        latitudes.push_back(metadata.has_location ? metadata.latitude : std::numeric_limits<double>::quiet_NaN());
+        longitudes.push_back(metadata.has_location ? metadata.longitude : std::numeric_limits<double>::quiet_NaN());
+        paths.push_back(strings.add(record.path));
+        makes.push_back(strings.add(metadata.make));
+        models.push_back(strings.add(metadata.model));
+    }
+
+    IndexHeader header {};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.count = records.size();
+    header.strings_size = strings.get_data().size();
+    IndexLayout layout(header.count);
+
+    // Written aside and renamed, so readers never map a partial index
+    auto temp_file = file;
+    temp_file += ".tmp";
+    std::ofstream out(temp_file, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write_column(out, capture_times);
+    write_column(out, latitudes);
+    write_column(out, longitudes);
+    write_column(out, paths);
+    write_column(out, makes);
+    write_column(out, models);
+    auto padding = layout.strings - (layout.models + header.count * sizeof(uint32_t));
+    out.write("\0\0\0\0\0\0\0", static_cast<std::streamsize>(padding));
+    out.write(strings.get_data().data(), static_cast<std::streamsize>(strings.get_data().size()));
+    out.close();
+
+    std::error_code ec;
+    if (!out || (std::filesystem::rename(temp_file, file, ec), ec)) {
+        std::cerr << "Can't write metadata index " << file << std::endl;
+        std::filesystem::remove(temp_file, ec);
+        return false;
+    }
+    return true;
+}
+
+MetadataIndex::MetadataIndex(void* mapping, size_t mapping_size) : mapping(mapping), mapping_size(mapping_size) {}
+
+MetadataIndex::~MetadataIndex() {
+    munmap(mapping, mapping_size);
+}
+
+size_t MetadataIndex::size() const noexcept {
+    return count;
+}
+
+std::string_view MetadataIndex::path(size_t idx) const {
+    return strings + paths[idx];
+}
+
+int64_t MetadataIndex::capture_time(size_t idx) const {
+    return capture_times[idx];
+}
+
+bool MetadataIndex::has_location(size_t idx) const {
+    return !std::isnan(latitudes[idx]);
+}
+
+double MetadataIndex::latitude(size_t idx) const {
+    return latitudes[idx];
+}
+
+double MetadataIndex::longitude(size_t idx) const {
+    return longitudes[idx];
+}
+
+std::string_view MetadataIndex::make(size_t idx) const {
+    return strings + makes[idx];
+}
+
+std::string_view MetadataIndex::model(size_t idx) const {
+    return strings + models[idx];
+}
+
+MetadataRecord MetadataIndex::record(size_t idx) const {
+    MetadataRecord result;
+    result.path = path(idx);
+    result.metadata.capture_time = capture_time(idx);
+    result.metadata.has_location = has_location(idx);
+    if (result.metadata.has_location) {
+        result.metadata.latitude = latitude(idx);
+        result.metadata.longitude = longitude(idx);
+    }
+    result.metadata.make = make(idx);
+    result.metadata.model = model(idx);
+    return result;
+}
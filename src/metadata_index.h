@@ -0,0 +1,78 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_METADATA_INDEX_H
+#define PHCOPY_METADATA_INDEX_H
+
+#include "media_metadata.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+inline const char* METADATA_INDEX_FILE = "metadata.idx";
+
+struct MetadataRecord {
+    std::string path; // Relative to the destination folder
+    MediaMetadata metadata;
+};
+
+// Columnar index of the metadata of downloaded files. The file is mapped into memory as is: a header
+// with the number of records, then fixed width columns of capture times, latitudes, longitudes
+// (NaN without location) and offsets of path, make and model in the string table that follows.
+// Columns use the byte order of the host and are 8 byte aligned.
+class MetadataIndex {
+public:
+    static std::unique_ptr<MetadataIndex> open(const std::filesystem::path& file);
+
+    // Writes the records together with the ones already in the file. Records of the same path are replaced.
+    static bool update(const std::filesystem::path& file, std::vector<MetadataRecord> records);
+
+    ~MetadataIndex();
+
+    MetadataIndex(const MetadataIndex&) = delete;
+    MetadataIndex& operator=(const MetadataIndex&) = delete;
+
+    size_t size() const noexcept;
+
+    std::string_view path(size_t idx) const;
+    int64_t capture_time(size_t idx) const;
+    bool has_location(size_t idx) const;
+    double latitude(size_t idx) const;
+    double longitude(size_t idx) const;
+    std::string_view make(size_t idx) const;
+    std::string_view model(size_t idx) const;
+
+    MetadataRecord record(size_t idx) const;
+
+private:
+    MetadataIndex(void* mapping, size_t mapping_size);
+
+    void* mapping;
+    size_t mapping_size;
+    size_t count {0};
+    const int64_t* capture_times {nullptr};
+    const double* latitudes {nullptr};
+    const double* longitudes {nullptr};
+    const uint32_t* paths {nullptr};
+    const uint32_t* makes {nullptr};
+    const uint32_t* models {nullptr};
+    const char* strings {nullptr};
+};
+
+#endif // PHCOPY_METADATA_INDEX_H
@@ -0,0 +1,61 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_NAME_LIST_H
+#define PHCOPY_NAME_LIST_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Names of a folder listing stored back to back in one buffer. clear keeps the capacity,
+// so a list reused for many folders stops allocating once it has grown to the biggest one.
+class NameList {
+public:
+    void clear() noexcept {
+        arena.clear();
+        spans.clear();
+    }
+
+    void reserve(size_t count) {
+        spans.reserve(count);
+    }
+
+    void add(std::string_view name) {
+        spans.emplace_back(static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(name.size()));
+        arena.append(name.data(), name.size());
+    }
+
+    size_t size() const noexcept {
+        return spans.size();
+    }
+
+    bool empty() const noexcept {
+        return spans.empty();
+    }
+
+    // Views are valid until the next add or clear
+    std::string_view operator[](size_t idx) const noexcept {
+        return std::string_view(arena.data() + spans[idx].first, spans[idx].second);
+    }
+
+private:
+    std::string arena;
+    std::vector<std::pair<uint32_t, uint32_t>> spans;
+};
+
+#endif // PHCOPY_NAME_LIST_H
@@ -0,0 +1,119 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_OBJECT_POOL_H
+#define PHCOPY_OBJECT_POOL_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Keeps released objects for reuse. acquire hands out a unique handle which returns the object to the pool
+// (after calling recycle) when destroyed. Objects outliving the pool are simply destroyed.
+template<class T>
+class ObjectPool {
+public:
+    using Factory = std::function<T*()>;
+    using Recycler = std::function<void(T*)>;
+    using Destroyer = std::function<void(T*)>;
+
+private:
+    struct State;
+
+public:
+    class Releaser {
+    public:
+        Releaser() = default;
+        explicit Releaser(std::shared_ptr<State> state) noexcept : state(std::move(state)) {}
+
+        void operator()(T* object) const {
+            State::release(state, object);
+        }
+
+    private:
+        std::shared_ptr<State> state;
+    };
+
+    using Handle = std::unique_ptr<T, Releaser>;
+
+    ObjectPool(Factory factory, Recycler recycle, Destroyer destroy, size_t max_idle)
+      : state(std::make_shared<State>()) {
+        state->factory = std::move(factory);
+        state->recycle = std::move(recycle);
+        state->destroy = std::move(destroy);
+        state->max_idle = max_idle;
+    }
+
+    ~ObjectPool() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        for (T* object : state->idle) {
+            state->destroy(object);
+        }
+        state->idle.clear();
+        state->closed = true;
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // Returns empty handle if a new object can't be created
+    Handle acquire() {
+        T* object = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->idle.empty()) {
+                object = state->idle.back();
+                state->idle.pop_back();
+            }
+        }
+
+        if (object == nullptr) {
+            object = state->factory();
+            if (object == nullptr) {
+                return nullptr;
+            }
+        }
+
+        return Handle(object, Releaser(state));
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        Factory factory;
+        Recycler recycle;
+        Destroyer destroy;
+        size_t max_idle {0};
+        bool closed {false};
+        std::vector<T*> idle;
+
+        static void release(const std::shared_ptr<State>& state, T* object) {
+            state->recycle(object);
+
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (state->closed || state->idle.size() >= state->max_idle) {
+                lock.unlock();
+                state->destroy(object);
+                return;
+            }
+            state->idle.push_back(object);
+        }
+    };
+
+    std::shared_ptr<State> state;
+};
+
+#endif // PHCOPY_OBJECT_POOL_H
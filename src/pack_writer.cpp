@@ -0,0 +1,433 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "pack_writer.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t TAR_BLOCK_SIZE = 512;
+const char PACK_PREFIX[] = "pack-";
+const char PACK_EXTENSION[] = ".tar";
+const char INDEX_EXTENSION[] = ".idx";
+
+bool write_all(int fd, struct iovec* iov, int iov_count) {
+    while (iov_count > 0) {
+        ssize_t ret = writev(fd, iov, iov_count);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        auto written = static_cast<size_t>(ret);
+        while (iov_count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iov_count--;
+        }
+        if (iov_count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+// Whole range must be a decimal number, which fits the value
+template <typename T>
+bool parse_number(const char* begin, const char* end, T& value) {
+    auto [pos, ec] = std::from_chars(begin, end, value);
+    return begin != end && ec == std::errc() && pos == end;
+}
+
+// Number of the pack from its file name, -1 for other files
+long pack_number(const std::filesystem::path& file) {
+    auto name = file.filename().string();
+    auto prefix_size = sizeof(PACK_PREFIX) - 1;
+    if (name.compare(0, prefix_size, PACK_PREFIX) != 0 || file.extension() != PACK_EXTENSION) {
+        return -1;
+    }
+
+    auto digits = name.substr(prefix_size, name.size() - prefix_size - (sizeof(PACK_EXTENSION) - 1));
+    long number = -1;
+    if (!parse_number(digits.data(), digits.data() + digits.size(), number)) {
+        return -1;
+    }
+    return number;
+}
+
+// Position to split the name into ustar prefix and name fields, npos if the name doesn't fit
+size_t ustar_split(const std::string& path) {
+    if (path.size() <= 100) {
+        return 0;
+    }
+
+    auto split = path.rfind('/', 155);
+    if (split != std::string::npos && split > 0 && path.size() - split - 1 <= 100) {
+        return split;
+    }
+    return std::string::npos;
+}
+
+} // namespace
+
+void write_tar_number(char* field, size_t field_size, uint64_t value) {
+    // Octal digits and a terminating NUL, 8 GiB - 1 at most in the 12 byte size field
+    auto octal_bits = 3 * (field_size - 1);
+    if (octal_bits >= 64 || value < uint64_t {1} << octal_bits) {
+        snprintf(field, field_size, "%0*llo", static_cast<int>(field_size - 1), static_cast<unsigned long long>(value));
+        return;
+    }
+
+    // GNU base-256: 0x80 marker, then the value big-endian in the rest of the field
+    memset(field, 0, field_size);
+    field[0] = static_cast<char>(0x80);
+    for (size_t i = field_size - 1; i > 0 && value > 0; i--, value >>= 8) {
+        field[i] = static_cast<char>(value & 0xFF);
+    }
+}
+
+std::optional<uint64_t> parse_tar_number(const char* field, size_t field_size) {
+    auto bytes = reinterpret_cast<const unsigned char*>(field);
+    if (field_size == 0) {
+        return std::nullopt;
+    }
+
+    if (bytes[0] & 0x80) {
+        // Negative values have all the high bits set, values above 64 bits don't fit
+        if (bytes[0] != 0x80) {
+            return std::nullopt;
+        }
+        uint64_t value = 0;
+        for (size_t i = 1; i < field_size; i++) {
+            if (value >> 56 != 0) {
+                return std::nullopt;
+            }
+            value = value << 8 | bytes[i];
+        }
+        return value;
+    }
+
+    // Octal digits, optionally padded with spaces and terminated by NUL or space
+    size_t begin = 0;
+    while (begin < field_size && field[begin] == ' ') {
+        begin++;
+    }
+    size_t end = begin;
+    while (end < field_size && field[end] >= '0' && field[end] <= '7') {
+        end++;
+    }
+    if (end == begin || (end < field_size && field[end] != '\0' && field[end] != ' ')) {
+        return std::nullopt;
+    }
+
+    uint64_t value = 0;
+    auto [pos, ec] = std::from_chars(field + begin, field + end, value, 8);
+    if (ec != std::errc() || pos != field + end) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::optional<uint64_t> read_tar_size(int fd, uint64_t data_offset) {
+    char header[TAR_BLOCK_SIZE];
+    if (data_offset < TAR_BLOCK_SIZE ||
+        pread(fd, header, sizeof(header), static_cast<off_t>(data_offset - TAR_BLOCK_SIZE)) !=
+                static_cast<ssize_t>(sizeof(header))) {
+        return std::nullopt;
+    }
+    return parse_tar_number(header + 124, 12);
+}
+
+std::optional<std::vector<PackEntry>> load_pack_index(const std::filesystem::path& folder) {
+    std::vector<PackEntry> entries;
+    std::error_code ec;
+
+    for (std::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+        if (pack_number(it->path()) < 0) {
+            continue;
+        }
+
+        auto index_path = it->path();
+        index_path.replace_extension(INDEX_EXTENSION);
+        std::ifstream index(index_path);
+        if (!index) {
+            std::cerr << "Pack index is missing: " << index_path << std::endl;
+            continue;
+        }
+
+        auto pack_size = std::filesystem::file_size(it->path(), ec);
+        if (ec) {
+            std::cerr << "Can't read pack " << it->path() << ": " << ec.message() << std::endl;
+            return std::nullopt;
+        }
+
+        int pack_fd = open(it->path().c_str(), O_RDONLY | O_CLOEXEC);
+        if (pack_fd < 0) {
+            std::cerr << "Can't read pack " << it->path() << ": " << strerror(errno) << std::endl;
+            return std::nullopt;
+        }
+
+        std::string line;
+        while (std::getline(index, line)) {
+            auto first_tab = line.find('\t');
+            auto second_tab = first_tab == std::string::npos ? first_tab : line.find('\t', first_tab + 1);
+
+            // Every entry must lie inside its pack, after a tar header of the same size
+            PackEntry entry;
+            if (second_tab == std::string::npos || second_tab + 1 == line.size() ||
+                !parse_number(line.data(), line.data() + first_tab, entry.offset) ||
+                !parse_number(line.data() + first_tab + 1, line.data() + second_tab, entry.size) ||
+                entry.offset > pack_size || entry.size > pack_size - entry.offset ||
+                read_tar_size(pack_fd, entry.offset) != entry.size) {
+                std::cerr << "Corrupted pack index " << index_path << std::endl;
+                close(pack_fd);
+                return std::nullopt;
+            }
+            entry.path = line.substr(second_tab + 1);
+            entry.pack = it->path();
+            entries.push_back(std::move(entry));
+        }
+        close(pack_fd);
+    }
+
+    if (ec) {
+        std::cerr << "Can't read folder " << folder << ": " << ec.message() << std::endl;
+        return std::nullopt;
+    }
+
+    return entries;
+}
+
+PackWriter::PackWriter(std::filesystem::path folder, uint64_t max_pack_size)
+  : folder(std::move(folder)), max_pack_size(max_pack_size) {}
+
+PackWriter::~PackWriter() {
+    finish();
+}
+
+bool PackWriter::load_existing(std::unordered_set<std::string>& paths) const {
+    auto entries = load_pack_index(folder);
+    if (!entries) {
+        return false;
+    }
+
+    for (auto& entry : *entries) {
+        paths.insert(std::move(entry.path));
+    }
+    return true;
+}
+
+bool PackWriter::begin_group() {
+    if (pack_fd >= 0 && pack_size >= max_pack_size) {
+        if (!close_pack()) {
+            return false;
+        }
+    }
+
+    if (pack_fd < 0 && !open_next_pack()) {
+        return false;
+    }
+
+    group_start = pack_size;
+    pending.clear();
+    return true;
+}
+
+bool PackWriter::add(const std::string& path, const FileData& data, std::time_t mtime) {
+    PHCOPY_TRACE_SCOPE("pack_add", path);
+
+    if (ustar_split(path) == std::string::npos) {
+        // GNU long name: the name goes as the data of a separate entry
+        if (!write_header("././@LongLink", path.size() + 1, 0, 'L')) {
+            return false;
+        }
+
+        std::string name_block(path);
+        name_block.resize((path.size() + TAR_BLOCK_SIZE) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE, '\0');
+        struct iovec iov {name_block.data(), name_block.size()};
+        if (!write_all(pack_fd, &iov, 1)) {
+            std::cerr << "Can't write " << pack_path << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        pack_size += name_block.size();
+    }
+
+    if (!write_header(path, data.size, mtime, '0')) {
+        return false;
+    }
+
+    PackEntry entry;
+    entry.offset = pack_size;
+    entry.size = data.size;
+    entry.path = path;
+
+    static const char padding[TAR_BLOCK_SIZE] = {};
+    size_t padding_size = (TAR_BLOCK_SIZE - data.size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+    struct iovec iov[2] = {{const_cast<char*>(data.data), data.size}, {const_cast<char*>(padding), padding_size}};
+    if (!write_all(pack_fd, iov, 2)) {
+        std::cerr << "Can't write " << pack_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    pack_size += data.size + padding_size;
+    pending.push_back(std::move(entry));
+    return true;
+}
+
+bool PackWriter::commit_group() {
+    if (pending.empty()) {
+        return true;
+    }
+
+    std::string lines;
+    for (const auto& entry : pending) {
+        lines += std::to_string(entry.offset) + '\t' + std::to_string(entry.size) + '\t' + entry.path + '\n';
+    }
+    pending.clear();
+
+    std::ofstream index(index_path, std::ios::app);
+    index << lines;
+    index.flush();
+    if (!index) {
+        std::cerr << "Can't write pack index " << index_path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void PackWriter::rollback_group() {
+    pending.clear();
+    if (pack_fd < 0 || pack_size == group_start) {
+        return;
+    }
+
+    if (ftruncate(pack_fd, static_cast<off_t>(group_start)) < 0 ||
+        lseek(pack_fd, static_cast<off_t>(group_start), SEEK_SET) < 0) {
+        std::cerr << "Can't truncate " << pack_path << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    pack_size = group_start;
+}
+
+bool PackWriter::finish() {
+    if (pack_fd < 0) {
+        return true;
+    }
+
+    commit_group();
+    return close_pack();
+}
+
+bool PackWriter::open_next_pack() {
+    if (!next_pack_number_known) {
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+            long number = pack_number(it->path());
+            if (number >= 0) {
+                next_pack_number = std::max(next_pack_number, static_cast<unsigned>(number) + 1);
+            }
+        }
+        next_pack_number_known = true;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%s%06u", PACK_PREFIX, next_pack_number++);
+    pack_path = folder / (std::string(name) + PACK_EXTENSION);
+    index_path = folder / (std::string(name) + INDEX_EXTENSION);
+
+    pack_fd = open(pack_path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+    if (pack_fd < 0) {
+        std::cerr << "Can't create pack " << pack_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // Index exists even for an empty pack, so readers don't report it as missing
+    std::ofstream index(index_path, std::ios::trunc);
+    pack_size = 0;
+    return true;
+}
+
+bool PackWriter::close_pack() {
+    // End of archive marker
+    static const char end_blocks[TAR_BLOCK_SIZE * 2] = {};
+    struct iovec iov {const_cast<char*>(end_blocks), sizeof(end_blocks)};
+    bool result = write_all(pack_fd, &iov, 1);
+
+    if (close(pack_fd) < 0) {
+        result = false;
+    }
+    pack_fd = -1;
+
+    if (!result) {
+        std::cerr << "Can't write " << pack_path << ": " << strerror(errno) << std::endl;
+    }
+    return result;
+}
+
+bool PackWriter::write_header(const std::string& path, uint64_t size, std::time_t mtime, char type) {
+    char header[TAR_BLOCK_SIZE] = {};
+
+    auto split = ustar_split(path);
+    if (split == 0) {
+        memcpy(header, path.data(), path.size());
+    } else if (split != std::string::npos) {
+        memcpy(header, path.data() + split + 1, path.size() - split - 1);
+        memcpy(header + 345, path.data(), split);
+    } else {
+        // Full name was stored in the preceding long name entry
+        memcpy(header, path.data(), 100);
+    }
+
+    write_tar_number(header + 100, 8, 0644);
+    write_tar_number(header + 108, 8, 0);
+    write_tar_number(header + 116, 8, 0);
+    write_tar_number(header + 124, 12, size);
+    write_tar_number(header + 136, 12, static_cast<uint64_t>(std::max<std::time_t>(mtime, 0)));
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    memset(header + 148, ' ', 8);
+    unsigned checksum = 0;
+    for (auto c : header) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    snprintf(header + 148, 8, "%06o", checksum);
+
+    struct iovec iov {header, sizeof(header)};
+    if (!write_all(pack_fd, &iov, 1)) {
+        std::cerr << "Can't write " << pack_path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    pack_size += sizeof(header);
+    return true;
+}
@@ -0,0 +1,89 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_PACK_WRITER_H
+#define PHCOPY_PACK_WRITER_H
+
+#include "file_data.h"
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Entry of a pack index. Packs are plain tar archives, the index next to each of them
+// (pack-NNNNNN.idx for pack-NNNNNN.tar) holds "offset<TAB>size<TAB>path" lines, where offset points
+// to the file data inside the archive.
+struct PackEntry {
+    uint64_t offset {0};
+    uint64_t size {0};
+    std::string path;
+    std::filesystem::path pack;
+};
+
+// Reads indexes of all packs in the folder
+std::optional<std::vector<PackEntry>> load_pack_index(const std::filesystem::path& folder);
+
+// Numeric field of a tar header. Values which don't fit the octal digits, e.g. sizes of 8 GiB and more,
+// are stored in the GNU base-256 encoding.
+void write_tar_number(char* field, size_t field_size, uint64_t value);
+// nullopt if the field holds neither encoding or the value doesn't fit
+std::optional<uint64_t> parse_tar_number(const char* field, size_t field_size);
+
+// Size in the header of the entry whose data starts at data_offset of the pack
+std::optional<uint64_t> read_tar_size(int fd, uint64_t data_offset);
+
+// Appends files to pack files in a folder. Existing packs are never modified, every writer starts a new one.
+// Files are added in groups: a group always goes to a single pack and appears in the index only when committed.
+class PackWriter {
+public:
+    PackWriter(std::filesystem::path folder, uint64_t max_pack_size);
+    ~PackWriter();
+
+    PackWriter(const PackWriter&) = delete;
+    PackWriter& operator=(const PackWriter&) = delete;
+
+    // Paths already stored in the packs of the folder
+    bool load_existing(std::unordered_set<std::string>& paths) const;
+
+    bool begin_group();
+    bool add(const std::string& path, const FileData& data, std::time_t mtime);
+    bool commit_group();
+    void rollback_group();
+
+    bool finish();
+
+private:
+    bool open_next_pack();
+    bool close_pack();
+    bool write_header(const std::string& path, uint64_t size, std::time_t mtime, char type);
+
+    std::filesystem::path folder;
+    uint64_t max_pack_size;
+    unsigned next_pack_number {0};
+    bool next_pack_number_known {false};
+
+    int pack_fd {-1};
+    std::filesystem::path pack_path;
+    std::filesystem::path index_path;
+    uint64_t pack_size {0};
+    uint64_t group_start {0};
+    std::vector<PackEntry> pending;
+};
+
+#endif // PHCOPY_PACK_WRITER_H
@@ -0,0 +1,139 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "query_command.h"
+
+#include "metadata_index.h"
+
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+
+namespace {
+
+void append_time(std::string& out, int64_t time) {
+    if (time == 0) {
+        return;
+    }
+
+    std::tm tm {};
+    auto value = static_cast<std::time_t>(time);
+    gmtime_r(&value, &tm);
+    char buffer[32];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &tm);
+    out += buffer;
+}
+
+void append_escaped(std::string& out, std::string_view str) {
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+}
+
+} // namespace
+
+bool MetadataQuery::parse_time(const std::string& value, bool range_end, int64_t& time_out) {
+    std::tm tm {};
+    int fields = sscanf(value.c_str(),
+                        "%4d-%2d-%2d %2d:%2d:%2d",
+                        &tm.tm_year,
+                        &tm.tm_mon,
+                        &tm.tm_mday,
+                        &tm.tm_hour,
+                        &tm.tm_min,
+                        &tm.tm_sec);
+    if (fields != 3 && fields != 6) {
+        return false;
+    }
+
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time_out = timegm(&tm);
+    if (fields == 3 && range_end) {
+        time_out += 24 * 60 * 60 - 1;
+    }
+    return true;
+}
+
+QueryCommand::QueryCommand(std::filesystem::path folder, MetadataQuery query, ListingFormat format)
+  : folder(std::move(folder)), query(std::move(query)), format(format) {}
+
+void QueryCommand::execute() {
+    auto index = MetadataIndex::open(folder / METADATA_INDEX_FILE);
+    if (!index) {
+        return;
+    }
+
+    std::string model;
+    std::string line;
+    size_t matched = 0;
+    for (size_t i = 0; i < index->size(); i++) {
+        // Cheap columns are checked first, strings are only touched for candidates
+        auto time = index->capture_time(i);
+        if (time < query.from || time > query.to || (query.with_location && !index->has_location(i))) {
+            continue;
+        }
+
+        auto make = index->make(i);
+        model.assign(make);
+        if (!make.empty() && !index->model(i).empty()) {
+            model += ' ';
+        }
+        model.append(index->model(i));
+        if (!query.model.empty() && model.find(query.model) == std::string::npos) {
+            continue;
+        }
+
+        matched++;
+        line.clear();
+        char location[64] = "";
+        if (index->has_location(i)) {
+            snprintf(location, sizeof(location), "%.6f,%.6f", index->latitude(i), index->longitude(i));
+        }
+
+        if (format == ListingFormat::JSONL) {
+            line += "{\"path\":\"";
+            append_escaped(line, index->path(i));
+            line += "\",\"time\":\"";
+            append_time(line, time);
+            line += "\",\"location\":\"";
+            line += location;
+            line += "\",\"model\":\"";
+            append_escaped(line, model);
+            line += "\"}\n";
+        } else if (format == ListingFormat::TEXT) {
+            line.append(index->path(i));
+            line += '\t';
+            append_time(line, time);
+            line += '\t';
+            line += location;
+            line += '\t';
+            line += model;
+            line += '\n';
+        }
+        std::cout << line;
+    }
+
+    std::cerr << "Matched " << matched << " of " << index->size() << " files" << std::endl;
+}
@@ -0,0 +1,51 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_QUERY_COMMAND_H
+#define PHCOPY_QUERY_COMMAND_H
+
+#include "command.h"
+#include "listing_writer.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+
+struct MetadataQuery {
+    int64_t from {std::numeric_limits<int64_t>::min()}; // Capture time range, inclusive
+    int64_t to {std::numeric_limits<int64_t>::max()};
+    std::string model;         // Substring of "MAKE MODEL"
+    bool with_location {false};
+
+    // "YYYY-MM-DD" or "YYYY-MM-DD HH:MM:SS" in the local time of the capture. A date alone
+    // covers the whole day, its start for the beginning of a range and its end otherwise.
+    static bool parse_time(const std::string& value, bool range_end, int64_t& time_out);
+};
+
+// Prints files from the metadata index of a download folder, built by --transform metadata
+class QueryCommand : public Command {
+public:
+    QueryCommand(std::filesystem::path folder, MetadataQuery query, ListingFormat format);
+
+    void execute() override;
+
+private:
+    std::filesystem::path folder;
+    MetadataQuery query;
+    ListingFormat format;
+};
+
+#endif // PHCOPY_QUERY_COMMAND_H
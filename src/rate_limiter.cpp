@@ -0,0 +1,99 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "rate_limiter.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+// Destination writes are counted as one operation for creating and closing the file
+// plus one for every started mebibyte of data
+constexpr uint64_t WRITE_OP_SIZE = 1024 * 1024;
+
+} // namespace
+
+RateLimiter::RateLimiter(uint64_t rate, uint64_t burst)
+  : rate(static_cast<double>(rate)),
+    burst(std::max<uint64_t>(burst, 1)),
+    burst_time(std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(rate > 0 ? static_cast<double>(this->burst) / rate : 0.0))),
+    next_free(clock::now()) {}
+
+void RateLimiter::acquire(uint64_t amount) {
+    if (rate <= 0) {
+        return;
+    }
+
+    while (amount > 0) {
+        uint64_t piece = std::min(amount, burst);
+        amount -= piece;
+
+        auto start = reserve(piece);
+        std::this_thread::sleep_until(start);
+    }
+}
+
+RateLimiter::clock::time_point RateLimiter::reserve(uint64_t amount) {
+    auto cost = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(amount / rate));
+    auto now = clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // next_free is the moment the bucket becomes full if nothing else is reserved
+    next_free = std::max(next_free, now) + cost;
+
+    // Caller may continue once the debt fits into the bucket capacity
+    return next_free - burst_time;
+}
+
+void TransferThrottle::set_global_limits(std::shared_ptr<RateLimiter> bytes, std::shared_ptr<RateLimiter> write_ops) {
+    global_bytes = std::move(bytes);
+    global_write_ops = std::move(write_ops);
+}
+
+void TransferThrottle::set_device_limits(uint64_t bytes_per_second, uint64_t write_ops_per_second) {
+    device_bytes = bytes_per_second > 0 ? std::make_shared<RateLimiter>(bytes_per_second, bytes_per_second)
+                                        : nullptr;
+    device_write_ops = write_ops_per_second > 0
+                               ? std::make_shared<RateLimiter>(write_ops_per_second, write_ops_per_second)
+                               : nullptr;
+}
+
+bool TransferThrottle::is_enabled() const noexcept {
+    return global_bytes || global_write_ops || device_bytes || device_write_ops;
+}
+
+void TransferThrottle::account_file(uint64_t size) const {
+    PHCOPY_TRACE_SCOPE("throttle");
+
+    uint64_t write_ops = 1 + (size + WRITE_OP_SIZE - 1) / WRITE_OP_SIZE;
+
+    // Device limits go first, so a device waiting for its own budget doesn't hold a slot of the shared one
+    if (device_bytes) {
+        device_bytes->acquire(size);
+    }
+    if (device_write_ops) {
+        device_write_ops->acquire(write_ops);
+    }
+    if (global_bytes) {
+        global_bytes->acquire(size);
+    }
+    if (global_write_ops) {
+        global_write_ops->acquire(write_ops);
+    }
+}
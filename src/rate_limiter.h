@@ -0,0 +1,70 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_RATE_LIMITER_H
+#define PHCOPY_RATE_LIMITER_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Token bucket limiter which may be shared between threads.
+//
+// Every acquire reserves a slot on a common timeline and sleeps until the slot starts, so callers are
+// served in arrival order. Big amounts are reserved in burst sized pieces and other callers can take
+// their share in between, so one fast consumer can't starve slower ones.
+class RateLimiter {
+public:
+    // rate is in units per second, burst is the bucket capacity. Zero rate disables the limiter.
+    RateLimiter(uint64_t rate, uint64_t burst);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    void acquire(uint64_t amount);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point reserve(uint64_t amount);
+
+    std::mutex mutex;
+    double rate;
+    uint64_t burst;
+    clock::duration burst_time;
+    clock::time_point next_free;
+};
+
+// Limits applied to the transfer path: read bandwidth from the device and write operations on the
+// destination. Global limiters are shared by all devices of the run, device ones belong to a single device.
+class TransferThrottle {
+public:
+    void set_global_limits(std::shared_ptr<RateLimiter> bytes, std::shared_ptr<RateLimiter> write_ops);
+    void set_device_limits(uint64_t bytes_per_second, uint64_t write_ops_per_second);
+
+    bool is_enabled() const noexcept;
+
+    // Called when a file of the given size was transferred and written
+    void account_file(uint64_t size) const;
+
+private:
+    std::shared_ptr<RateLimiter> global_bytes;
+    std::shared_ptr<RateLimiter> global_write_ops;
+    std::shared_ptr<RateLimiter> device_bytes;
+    std::shared_ptr<RateLimiter> device_write_ops;
+};
+
+#endif // PHCOPY_RATE_LIMITER_H
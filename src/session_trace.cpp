@@ -0,0 +1,186 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "session_trace.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+const char* call_name(SessionCall call) {
+    switch (call) {
+        case SessionCall::LIST_FILES:
+            return "list_files";
+        case SessionCall::LIST_FOLDERS:
+            return "list_folders";
+        case SessionCall::FILE_INFO:
+            return "info";
+        case SessionCall::GET_FILE:
+            return "get";
+    }
+    return "";
+}
+
+bool parse_call(const std::string& name, SessionCall& call) {
+    for (auto candidate :
+         {SessionCall::LIST_FILES, SessionCall::LIST_FOLDERS, SessionCall::FILE_INFO, SessionCall::GET_FILE}) {
+        if (name == call_name(candidate)) {
+            call = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> split_fields(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        auto tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab - start));
+        if (tab == std::string::npos) {
+            return fields;
+        }
+        start = tab + 1;
+    }
+}
+
+} // namespace
+
+SessionRecorder::SessionRecorder(std::ofstream out) : out(std::move(out)) {}
+
+std::shared_ptr<SessionRecorder> SessionRecorder::create(const std::filesystem::path& file) {
+    std::ofstream out(file, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Can't create session file " << file << std::endl;
+        return nullptr;
+    }
+
+    return std::shared_ptr<SessionRecorder>(new SessionRecorder(std::move(out)));
+}
+
+void SessionRecorder::record(const SessionRecord& record) {
+    std::ostringstream line;
+    write_record(line, record);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    out << line.str();
+    out.flush();
+}
+
+void SessionRecorder::write_record(std::ostream& out, const SessionRecord& record) {
+    out << call_name(record.call) << '\t' << record.duration.count() << '\t' << (record.ok ? 1 : 0) << '\t'
+        << record.path;
+
+    switch (record.call) {
+        case SessionCall::LIST_FILES:
+        case SessionCall::LIST_FOLDERS:
+            for (const auto& name : record.names) {
+                out << '\t' << name;
+            }
+            break;
+        case SessionCall::FILE_INFO:
+            out << '\t' << record.info.size << '\t' << record.info.mtime << '\t' << record.info.type;
+            break;
+        case SessionCall::GET_FILE:
+            out << '\t' << record.info.size;
+            break;
+    }
+    out << '\n';
+}
+
+SessionReplay::SessionReplay(std::vector<SessionRecord> records, double speed) : speed(speed) {
+    for (auto& record : records) {
+        responses[key(record.call, record.path)].records.push_back(std::move(record));
+    }
+}
+
+std::shared_ptr<SessionReplay> SessionReplay::load(const std::filesystem::path& file, double speed) {
+    std::ifstream in(file);
+    if (!in) {
+        std::cerr << "Can't open session file " << file << std::endl;
+        return nullptr;
+    }
+
+    std::vector<SessionRecord> records;
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        if (line.empty()) {
+            continue;
+        }
+
+        auto fields = split_fields(line);
+        SessionRecord record;
+        try {
+            if (fields.size() < 4 || !parse_call(fields[0], record.call)) {
+                throw std::invalid_argument("bad record");
+            }
+
+            record.duration = std::chrono::microseconds(std::stoll(fields[1]));
+            record.ok = fields[2] == "1";
+            record.path = fields[3];
+
+            if (record.call == SessionCall::LIST_FILES || record.call == SessionCall::LIST_FOLDERS) {
+                record.names.assign(fields.begin() + 4, fields.end());
+            } else if (record.call == SessionCall::FILE_INFO && fields.size() >= 7) {
+                record.info.size = std::stoull(fields[4]);
+                record.info.mtime = static_cast<std::time_t>(std::stoll(fields[5]));
+                record.info.type = fields[6];
+            } else if (record.call == SessionCall::GET_FILE && fields.size() >= 5) {
+                record.info.size = std::stoull(fields[4]);
+            } else {
+                throw std::invalid_argument("bad record");
+            }
+        } catch (std::logic_error&) {
+            std::cerr << "Corrupted session file " << file << " at line " << line_number << std::endl;
+            return nullptr;
+        }
+
+        records.push_back(std::move(record));
+    }
+
+    return std::make_shared<SessionReplay>(std::move(records), speed);
+}
+
+const SessionRecord* SessionReplay::play(SessionCall call, const std::string& path) {
+    const SessionRecord* record = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto pos = responses.find(key(call, path));
+        if (pos == responses.end()) {
+            return nullptr;
+        }
+
+        auto& entry = pos->second;
+        record = &entry.records[std::min(entry.next, entry.records.size() - 1)];
+        if (entry.next < entry.records.size()) {
+            entry.next++;
+        }
+    }
+
+    if (speed > 0) {
+        std::this_thread::sleep_for(std::chrono::duration_cast<std::chrono::microseconds>(record->duration / speed));
+    }
+    return record;
+}
+
+std::string SessionReplay::key(SessionCall call, const std::string& path) {
+    return std::string(call_name(call)) + '\t' + path;
+}
@@ -0,0 +1,87 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_SESSION_TRACE_H
+#define PHCOPY_SESSION_TRACE_H
+
+#include "gphoto_camera.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class SessionCall { LIST_FILES, LIST_FOLDERS, FILE_INFO, GET_FILE };
+
+// Single camera call of a recorded session. For GET_FILE only info.size (payload size) is used.
+struct SessionRecord {
+    SessionCall call {SessionCall::LIST_FILES};
+    std::chrono::microseconds duration {0};
+    bool ok {false};
+    std::string path;
+    std::vector<std::string> names;
+    FileInfo info;
+};
+
+// Writes every camera call with its timing into a session file. The file is line based,
+// one call per line with tab separated fields:
+//   list_files|list_folders DURATION_US OK PATH NAME...
+//   info DURATION_US OK PATH SIZE MTIME TYPE
+//   get DURATION_US OK PATH SIZE
+class SessionRecorder {
+public:
+    static std::shared_ptr<SessionRecorder> create(const std::filesystem::path& file);
+
+    void record(const SessionRecord& record);
+
+    static void write_record(std::ostream& out, const SessionRecord& record);
+
+private:
+    explicit SessionRecorder(std::ofstream out);
+
+    std::mutex mutex;
+    std::ofstream out;
+};
+
+// Serves camera calls from a recorded session, sleeping for the recorded time divided by speed.
+// Zero speed replays without delays. Calls repeated in the recording are served in the recorded order,
+// the last response is repeated after that.
+class SessionReplay {
+public:
+    SessionReplay(std::vector<SessionRecord> records, double speed);
+
+    static std::shared_ptr<SessionReplay> load(const std::filesystem::path& file, double speed);
+
+    // Returns nullptr for calls which are not in the recording
+    const SessionRecord* play(SessionCall call, const std::string& path);
+
+private:
+    struct Responses {
+        std::vector<SessionRecord> records;
+        size_t next {0};
+    };
+
+    static std::string key(SessionCall call, const std::string& path);
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Responses> responses;
+    double speed;
+};
+
+#endif // PHCOPY_SESSION_TRACE_H
@@ -0,0 +1,245 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'P', 'H', 'S', 'N', 'A', 'P', '0', '1'};
+
+void write_varint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool read_varint(const std::string& in, size_t& pos, uint64_t& value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size()) {
+            return false;
+        }
+
+        auto byte = static_cast<unsigned char>(in[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void write_string(std::string& out, const std::string& str) {
+    write_varint(out, str.size());
+    out += str;
+}
+
+bool read_string(const std::string& in, size_t& pos, std::string& str) {
+    uint64_t size = 0;
+    if (!read_varint(in, pos, size) || size > in.size() - pos) {
+        return false;
+    }
+
+    str.assign(in, pos, size);
+    pos += size;
+    return true;
+}
+
+} // namespace
+
+Snapshot::Snapshot(std::filesystem::path root) : root(std::move(root)) {}
+
+Snapshot Snapshot::capture(const GPhotoCamera& camera, const std::filesystem::path& root) {
+    Snapshot snapshot(root);
+    capture_folder(camera, root, snapshot);
+    snapshot.sort();
+    return snapshot;
+}
+
+void Snapshot::capture_folder(const GPhotoCamera& camera, const std::filesystem::path& folder, Snapshot& snapshot) {
+    auto files = camera.list_files(folder);
+    auto files_info = camera.get_files_info(files);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        SnapshotEntry entry;
+        entry.path = files[i].string();
+        if (files_info[i]) {
+            entry.size = files_info[i]->size;
+            entry.mtime = files_info[i]->mtime;
+        }
+        snapshot.add(std::move(entry));
+    }
+
+    for (const auto& subfolder : camera.list_folders(folder)) {
+        capture_folder(camera, subfolder, snapshot);
+    }
+}
+
+std::optional<Snapshot> Snapshot::load(const std::filesystem::path& file) {
+    std::ifstream stream(file, std::ios::binary);
+    if (!stream) {
+        std::cerr << "Can't open snapshot " << file << std::endl;
+        return std::nullopt;
+    }
+
+    std::string data {std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+    if (data.size() < sizeof(SNAPSHOT_MAGIC) || memcmp(data.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        std::cerr << "Not a snapshot file: " << file << std::endl;
+        return std::nullopt;
+    }
+
+    size_t pos = sizeof(SNAPSHOT_MAGIC);
+    std::string root;
+    uint64_t count = 0;
+    if (!read_string(data, pos, root) || !read_varint(data, pos, count)) {
+        std::cerr << "Corrupted snapshot " << file << std::endl;
+        return std::nullopt;
+    }
+
+    Snapshot snapshot(root);
+    snapshot.entries.reserve(std::min<uint64_t>(count, data.size()));
+
+    std::string previous;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t shared = 0, size = 0, mtime = 0;
+        std::string suffix;
+        if (!read_varint(data, pos, shared) || shared > previous.size() || !read_string(data, pos, suffix) ||
+            !read_varint(data, pos, size) || !read_varint(data, pos, mtime)) {
+            std::cerr << "Corrupted snapshot " << file << std::endl;
+            return std::nullopt;
+        }
+
+        SnapshotEntry entry;
+        entry.path.reserve(shared + suffix.size());
+        entry.path.append(previous, 0, shared);
+        entry.path += suffix;
+        entry.size = size;
+        entry.mtime = static_cast<std::time_t>(unzigzag(mtime));
+
+        // diff_snapshots merges the entries, so they must be sorted and unique
+        if (i > 0 && entry.path <= previous) {
+            std::cerr << "Corrupted snapshot " << file << ": entries are not sorted" << std::endl;
+            return std::nullopt;
+        }
+
+        previous = entry.path;
+        snapshot.entries.push_back(std::move(entry));
+    }
+
+    return snapshot;
+}
+
+bool Snapshot::save(const std::filesystem::path& file) const {
+    std::string data(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    write_string(data, root.string());
+    write_varint(data, entries.size());
+
+    const std::string* previous = nullptr;
+    for (const auto& entry : entries) {
+        size_t shared = 0;
+        if (previous != nullptr) {
+            auto limit = std::min(previous->size(), entry.path.size());
+            while (shared < limit && (*previous)[shared] == entry.path[shared]) {
+                shared++;
+            }
+        }
+
+        write_varint(data, shared);
+        write_varint(data, entry.path.size() - shared);
+        data.append(entry.path, shared, std::string::npos);
+        write_varint(data, entry.size);
+        write_varint(data, zigzag(entry.mtime));
+        previous = &entry.path;
+    }
+
+    std::ofstream stream(file, std::ios::binary | std::ios::trunc);
+    if (!stream) {
+        std::cerr << "Can't create snapshot " << file << std::endl;
+        return false;
+    }
+
+    stream.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!stream) {
+        std::cerr << "Can't write snapshot " << file << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void Snapshot::add(SnapshotEntry entry) {
+    entries.push_back(std::move(entry));
+}
+
+void Snapshot::sort() {
+    std::sort(entries.begin(), entries.end(), [](const SnapshotEntry& a, const SnapshotEntry& b) {
+        return a.path < b.path;
+    });
+}
+
+const std::filesystem::path& Snapshot::get_root() const noexcept {
+    return root;
+}
+
+const std::vector<SnapshotEntry>& Snapshot::get_entries() const noexcept {
+    return entries;
+}
+
+std::vector<DiffEntry> diff_snapshots(const Snapshot& old_snapshot, const Snapshot& new_snapshot) {
+    std::vector<DiffEntry> result;
+    const auto& old_entries = old_snapshot.get_entries();
+    const auto& new_entries = new_snapshot.get_entries();
+
+    size_t i = 0, j = 0;
+    while (i < old_entries.size() || j < new_entries.size()) {
+        int cmp = 0;
+        if (i == old_entries.size()) {
+            cmp = 1;
+        } else if (j == new_entries.size()) {
+            cmp = -1;
+        } else {
+            cmp = old_entries[i].path.compare(new_entries[j].path);
+        }
+
+        if (cmp < 0) {
+            result.push_back(DiffEntry {DiffKind::REMOVED, &old_entries[i++]});
+        } else if (cmp > 0) {
+            result.push_back(DiffEntry {DiffKind::ADDED, &new_entries[j++]});
+        } else {
+            if (old_entries[i].size != new_entries[j].size || old_entries[i].mtime != new_entries[j].mtime) {
+                result.push_back(DiffEntry {DiffKind::MODIFIED, &new_entries[j]});
+            }
+            i++;
+            j++;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,72 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_SNAPSHOT_H
+#define PHCOPY_SNAPSHOT_H
+
+#include "gphoto_camera.h"
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct SnapshotEntry {
+    std::string path;
+    uint64_t size {0};
+    std::time_t mtime {0};
+};
+
+// Flat listing of all files of a remote tree, sorted by path.
+//
+// On disk it is stored as a magic header followed by the root and the entries. Paths are
+// front-coded against the previous entry and all numbers are varints, so a snapshot of
+// a large library takes a few bytes per file.
+class Snapshot {
+public:
+    Snapshot() = default;
+    explicit Snapshot(std::filesystem::path root);
+
+    static Snapshot capture(const GPhotoCamera& camera, const std::filesystem::path& root);
+    static std::optional<Snapshot> load(const std::filesystem::path& file);
+    bool save(const std::filesystem::path& file) const;
+
+    void add(SnapshotEntry entry);
+    void sort();
+
+    const std::filesystem::path& get_root() const noexcept;
+    const std::vector<SnapshotEntry>& get_entries() const noexcept;
+
+private:
+    static void capture_folder(const GPhotoCamera& camera, const std::filesystem::path& folder, Snapshot& snapshot);
+
+    std::filesystem::path root;
+    std::vector<SnapshotEntry> entries;
+};
+
+enum class DiffKind { ADDED, MODIFIED, REMOVED };
+
+struct DiffEntry {
+    DiffKind kind;
+    const SnapshotEntry* entry;
+};
+
+// Sorted merge of two snapshots. For added and modified files the entry points to new_snapshot,
+// for removed ones to old_snapshot. Both must be sorted, as captured and loaded snapshots are.
+std::vector<DiffEntry> diff_snapshots(const Snapshot& old_snapshot, const Snapshot& new_snapshot);
+
+#endif // PHCOPY_SNAPSHOT_H
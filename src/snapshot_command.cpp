@@ -0,0 +1,37 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "snapshot_command.h"
+
+#include "snapshot.h"
+
+#include <iostream>
+
+SnapshotCommand::SnapshotCommand(size_t device_idx, std::filesystem::path path, std::filesystem::path snapshot_file)
+  : device_idx(device_idx), path(std::move(path)), snapshot_file(std::move(snapshot_file)) {}
+
+void SnapshotCommand::execute() {
+    try {
+        Command::execute();
+
+        GPhotoCamera camera = open_camera(device_idx);
+        Snapshot snapshot = Snapshot::capture(camera, path);
+        if (snapshot.save(snapshot_file)) {
+            std::cout << "Saved " << snapshot.get_entries().size() << " files to " << snapshot_file << std::endl;
+        }
+    } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
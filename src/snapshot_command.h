@@ -0,0 +1,35 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_SNAPSHOT_COMMAND_H
+#define PHCOPY_SNAPSHOT_COMMAND_H
+
+#include "command.h"
+
+#include <filesystem>
+
+class SnapshotCommand : public Command {
+public:
+    SnapshotCommand(size_t device_idx, std::filesystem::path path, std::filesystem::path snapshot_file);
+
+    void execute() override;
+
+private:
+    size_t device_idx;
+    std::filesystem::path path;
+    std::filesystem::path snapshot_file;
+};
+
+#endif // PHCOPY_SNAPSHOT_COMMAND_H
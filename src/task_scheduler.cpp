@@ -0,0 +1,151 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "task_scheduler.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+// Worker the current thread is, so tasks spawned by a task stay on its worker
+thread_local const TaskScheduler* current_scheduler = nullptr;
+thread_local size_t current_worker = 0;
+
+} // namespace
+
+TaskGroup::TaskGroup(bool serial) : serial(serial) {}
+
+void TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return pending == 0; });
+}
+
+void TaskGroup::add_task() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending++;
+}
+
+void TaskGroup::finish_task() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0) {
+        done.notify_all();
+    }
+}
+
+TaskScheduler::TaskScheduler(size_t threads_count) {
+    if (threads_count == 0) {
+        threads_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    worker_tasks.resize(threads_count);
+    threads.reserve(threads_count);
+    for (size_t i = 0; i < threads_count; i++) {
+        threads.emplace_back(&TaskScheduler::worker, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void TaskScheduler::spawn(TaskGroup& group, std::function<void()> task) {
+    group.add_task();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& tasks = current_scheduler == this ? worker_tasks[current_worker] : injected;
+        tasks.push_back({&group, std::move(task)});
+    }
+    task_available.notify_one();
+}
+
+size_t TaskScheduler::size() const noexcept {
+    return threads.size();
+}
+
+void TaskScheduler::worker(size_t idx) {
+    current_scheduler = this;
+    current_worker = idx;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        Task task;
+        task_available.wait(lock, [&]() { return take_task(idx, task) || stopping; });
+        if (!task.run) {
+            // Stopping, tasks of the groups still running serially are left to their workers
+            return;
+        }
+
+        lock.unlock();
+        try {
+            task.run();
+        } catch (std::exception& e) {
+            std::cerr << "Task failed: " << e.what() << std::endl;
+        }
+        lock.lock();
+
+        // The next task of a serial group may be waiting in any deque
+        if (task.group->serial) {
+            task.group->running = false;
+            task_available.notify_all();
+        }
+        task.group->finish_task();
+    }
+}
+
+bool TaskScheduler::take_task(size_t idx, Task& task) {
+    if (take_from(worker_tasks[idx], true, task)) {
+        return true;
+    }
+    for (size_t i = 1; i < worker_tasks.size(); i++) {
+        if (take_from(worker_tasks[(idx + i) % worker_tasks.size()], false, task)) {
+            return true;
+        }
+    }
+    return take_from(injected, false, task);
+}
+
+bool TaskScheduler::take_from(std::deque<Task>& tasks, bool newest, Task& task) {
+    auto runnable = [](const Task& candidate) { return !candidate.group->serial || !candidate.group->running; };
+
+    if (newest) {
+        auto pos = std::find_if(tasks.rbegin(), tasks.rend(), runnable);
+        if (pos == tasks.rend()) {
+            return false;
+        }
+        task = std::move(*pos);
+        tasks.erase(std::next(pos).base());
+    } else {
+        auto pos = std::find_if(tasks.begin(), tasks.end(), runnable);
+        if (pos == tasks.end()) {
+            return false;
+        }
+        task = std::move(*pos);
+        tasks.erase(pos);
+    }
+
+    if (task.group->serial) {
+        task.group->running = true;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_TASK_SCHEDULER_H
+#define PHCOPY_TASK_SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks spawned together, e.g. the folders and files of one download. A serial group runs at most
+// one of its tasks at a time, which is how all work using one device is kept on one connection.
+class TaskGroup {
+public:
+    explicit TaskGroup(bool serial = false);
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // Blocks until all tasks of the group, including the ones they spawned, are finished
+    void wait();
+
+private:
+    friend class TaskScheduler;
+
+    void add_task();
+    void finish_task();
+
+    const bool serial;
+    bool running {false}; // Guarded by the scheduler
+    size_t pending {0};
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+// Work stealing scheduler. Every worker has its own deque: tasks spawned by a task go to the back of
+// the worker's deque and the worker takes the newest one first, so files of a folder are downloaded
+// right after it's listed. Idle workers steal the oldest task of another worker, which is the largest
+// piece of work left: a whole folder or a batch of files. Tasks are coarse (device calls), so the
+// deques share one lock.
+class TaskScheduler {
+public:
+    // Zero threads_count means one thread per core
+    explicit TaskScheduler(size_t threads_count = 0);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    // Called from a task, the task goes to the deque of the current worker
+    void spawn(TaskGroup& group, std::function<void()> task);
+
+    size_t size() const noexcept;
+
+private:
+    struct Task {
+        TaskGroup* group;
+        std::function<void()> run;
+    };
+
+    void worker(size_t idx);
+    // Own newest task, then the oldest one of the other workers, then the ones spawned from outside
+    bool take_task(size_t idx, Task& task);
+    static bool take_from(std::deque<Task>& tasks, bool newest, Task& task);
+
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::vector<std::deque<Task>> worker_tasks;
+    std::deque<Task> injected; // Spawned outside of the workers
+    bool stopping {false};
+    std::vector<std::thread> threads;
+};
+
+#endif // PHCOPY_TASK_SCHEDULER_H
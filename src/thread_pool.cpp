@@ -0,0 +1,85 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads_count, size_t max_pending) {
+    if (threads_count == 0) {
+        threads_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    this->max_pending = max_pending > 0 ? max_pending : threads_count * 2;
+
+    threads.reserve(threads_count);
+    for (size_t i = 0; i < threads_count; i++) {
+        threads.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        task_taken.wait(lock, [this]() { return tasks.size() < max_pending; });
+        tasks.push_back(std::move(task));
+    }
+    task_available.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return tasks.empty() && running == 0; });
+}
+
+size_t ThreadPool::size() const noexcept {
+    return threads.size();
+}
+
+void ThreadPool::worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        task_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+            // stopping and nothing left to do
+            return;
+        }
+
+        auto task = std::move(tasks.front());
+        tasks.pop_front();
+        running++;
+        lock.unlock();
+        task_taken.notify_one();
+
+        task();
+
+        lock.lock();
+        running--;
+        if (tasks.empty() && running == 0) {
+            idle.notify_all();
+        }
+    }
+}
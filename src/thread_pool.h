@@ -0,0 +1,58 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_THREAD_POOL_H
+#define PHCOPY_THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with a bounded queue. submit blocks while the queue is full,
+// so a fast producer can't pile up unlimited work (and memory) in front of the workers.
+class ThreadPool {
+public:
+    // Zero threads_count means one thread per core
+    explicit ThreadPool(size_t threads_count = 0, size_t max_pending = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // Blocks until all submitted tasks are finished
+    void wait();
+
+    size_t size() const noexcept;
+
+private:
+    void worker();
+
+    std::mutex mutex;
+    std::condition_variable task_available;
+    std::condition_variable task_taken;
+    std::condition_variable idle;
+    std::deque<std::function<void()>> tasks;
+    size_t max_pending;
+    size_t running {0};
+    bool stopping {false};
+    std::vector<std::thread> threads;
+};
+
+#endif // PHCOPY_THREAD_POOL_H
@@ -0,0 +1,153 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "trace.h"
+
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+
+// Spans are kept in memory and appended to the file in batches
+constexpr size_t FLUSH_SPANS = 4096;
+
+uint32_t current_thread_id() {
+    static std::atomic<uint32_t> next_id {1};
+    thread_local uint32_t id = next_id++;
+    return id;
+}
+
+void write_json_string(std::ostream& out, const std::string& value) {
+    out << '"';
+    for (char c : value) {
+        switch (c) {
+        case '"':
+            out << "\\\"";
+            break;
+        case '\\':
+            out << "\\\\";
+            break;
+        case '\n':
+            out << "\\n";
+            break;
+        case '\t':
+            out << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                out << ' ';
+            } else {
+                out << c;
+            }
+        }
+    }
+    out << '"';
+}
+
+} // namespace
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+bool Tracer::start(const std::filesystem::path& file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.open(file, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Can't create trace file " << file << std::endl;
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    origin = std::chrono::steady_clock::now();
+    first_event = true;
+    enabled = true;
+    return true;
+}
+
+void Tracer::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled) {
+        return;
+    }
+
+    enabled = false;
+    flush();
+    out << "\n]}\n";
+    out.close();
+}
+
+void Tracer::add_span(const char* name,
+                      std::string detail,
+                      std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end) {
+    auto thread_id = current_thread_id();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled) {
+        return;
+    }
+
+    spans.push_back({name,
+                     std::move(detail),
+                     std::chrono::duration_cast<std::chrono::microseconds>(start - origin).count(),
+                     std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+                     thread_id});
+    if (spans.size() >= FLUSH_SPANS) {
+        flush();
+    }
+}
+
+void Tracer::flush() {
+    static const pid_t pid = getpid();
+
+    for (const auto& span : spans) {
+        out << (first_event ? "\n" : ",\n");
+        first_event = false;
+
+        out << "{\"ph\":\"X\",\"name\":\"" << span.name << "\",\"pid\":" << pid << ",\"tid\":" << span.thread_id
+            << ",\"ts\":" << span.start_us << ",\"dur\":" << span.duration_us;
+        if (!span.detail.empty()) {
+            out << ",\"args\":{\"path\":";
+            write_json_string(out, span.detail);
+            out << '}';
+        }
+        out << '}';
+    }
+    spans.clear();
+    out.flush();
+}
+
+TraceScope::TraceScope(const char* name) noexcept {
+    if (Tracer::instance().is_enabled()) {
+        this->name = name;
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+TraceScope::TraceScope(const char* name, const std::filesystem::path& detail) {
+    if (Tracer::instance().is_enabled()) {
+        this->name = name;
+        this->detail = detail.string();
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (name != nullptr) {
+        Tracer::instance().add_span(name, std::move(detail), start, std::chrono::steady_clock::now());
+    }
+}
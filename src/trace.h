@@ -0,0 +1,90 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_TRACE_H
+#define PHCOPY_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timeline of spans in the Chrome trace event format, viewable in chrome://tracing or Perfetto.
+// Spans are added with PHCOPY_TRACE_SCOPE, which compiles to nothing unless PHCOPY_TRACING is defined.
+class Tracer {
+public:
+    static Tracer& instance();
+
+    bool start(const std::filesystem::path& file);
+    void stop();
+
+    bool is_enabled() const noexcept {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void add_span(const char* name,
+                  std::string detail,
+                  std::chrono::steady_clock::time_point start,
+                  std::chrono::steady_clock::time_point end);
+
+private:
+    struct Span {
+        const char* name;
+        std::string detail;
+        int64_t start_us;
+        int64_t duration_us;
+        uint32_t thread_id;
+    };
+
+    Tracer() = default;
+
+    void flush();
+
+    std::atomic<bool> enabled {false};
+    std::mutex mutex;
+    std::ofstream out;
+    std::vector<Span> spans;
+    std::chrono::steady_clock::time_point origin;
+    bool first_event {true};
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) noexcept;
+    TraceScope(const char* name, const std::filesystem::path& detail);
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name {nullptr}; // Null when tracing is off
+    std::string detail;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef PHCOPY_TRACING
+#define PHCOPY_TRACE_CONCAT_IMPL(a, b) a##b
+#define PHCOPY_TRACE_CONCAT(a, b) PHCOPY_TRACE_CONCAT_IMPL(a, b)
+#define PHCOPY_TRACE_SCOPE(...) TraceScope PHCOPY_TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+#else
+#define PHCOPY_TRACE_SCOPE(...) ((void)0)
+#endif
+
+#endif // PHCOPY_TRACE_H
@@ -0,0 +1,79 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "transfer_control.h"
+
+TransferControl::~TransferControl() {
+    if (attached_context.get_context() != nullptr) {
+        gp_context_set_cancel_func(attached_context.get_context(), nullptr, nullptr);
+    }
+}
+
+void TransferControl::attach(const Context& context) {
+    attached_context = context;
+    gp_context_set_cancel_func(attached_context.get_context(), &TransferControl::cancel_func, this);
+}
+
+void TransferControl::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = true;
+}
+
+void TransferControl::resume() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        paused = false;
+    }
+    state_changed.notify_all();
+}
+
+void TransferControl::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+    }
+    state_changed.notify_all();
+}
+
+bool TransferControl::is_paused() const noexcept {
+    return paused;
+}
+
+bool TransferControl::is_cancelled() const noexcept {
+    return cancelled;
+}
+
+bool TransferControl::wait_if_paused() {
+    std::unique_lock<std::mutex> lock(mutex);
+    state_changed.wait(lock, [this]() { return !paused || cancelled; });
+    return !cancelled;
+}
+
+void TransferControl::prioritize(std::filesystem::path folder) {
+    std::lock_guard<std::mutex> lock(mutex);
+    priorities.push_back(std::move(folder));
+}
+
+std::vector<std::filesystem::path> TransferControl::take_priorities() {
+    std::vector<std::filesystem::path> result;
+    std::lock_guard<std::mutex> lock(mutex);
+    result.swap(priorities);
+    return result;
+}
+
+GPContextFeedback TransferControl::cancel_func(GPContext*, void* data) {
+    auto* control = static_cast<TransferControl*>(data);
+    return control->is_cancelled() ? GP_CONTEXT_FEEDBACK_CANCEL : GP_CONTEXT_FEEDBACK_OK;
+}
@@ -0,0 +1,66 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_TRANSFER_CONTROL_H
+#define PHCOPY_TRANSFER_CONTROL_H
+
+#include "context.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+// State of a running download that can be changed from signal handlers or the control socket:
+// pause between files, cancel at the next chunk boundary and move folders to the front of the queue.
+class TransferControl {
+public:
+    TransferControl() = default;
+    ~TransferControl();
+
+    TransferControl(const TransferControl&) = delete;
+    TransferControl& operator=(const TransferControl&) = delete;
+
+    // Lets libgphoto2 abort the transfer in progress once the download is cancelled
+    void attach(const Context& context);
+
+    void pause();
+    void resume();
+    void cancel();
+
+    bool is_paused() const noexcept;
+    bool is_cancelled() const noexcept;
+
+    // Blocks while paused. Returns false if the download is cancelled.
+    bool wait_if_paused();
+
+    void prioritize(std::filesystem::path folder);
+
+    // Folders prioritized since the previous call, in the order of requests
+    std::vector<std::filesystem::path> take_priorities();
+
+private:
+    static GPContextFeedback cancel_func(GPContext* context, void* data);
+
+    std::mutex mutex;
+    std::condition_variable state_changed;
+    std::atomic<bool> paused {false};
+    std::atomic<bool> cancelled {false};
+    std::vector<std::filesystem::path> priorities;
+    Context attached_context {nullptr};
+};
+
+#endif // PHCOPY_TRANSFER_CONTROL_H
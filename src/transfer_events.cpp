@@ -0,0 +1,181 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "transfer_events.h"
+
+#include <algorithm>
+#include <iostream>
+
+TransferEvent TransferEvent::enumeration(size_t files_count, bool finished) {
+    TransferEvent event;
+    event.kind = TransferEventKind::ENUMERATION;
+    event.files_count = files_count;
+    event.finished = finished;
+    return event;
+}
+
+TransferEvent TransferEvent::file_started(std::string path, size_t file_idx, size_t files_count) {
+    TransferEvent event;
+    event.kind = TransferEventKind::FILE_STARTED;
+    event.path = std::move(path);
+    event.file_idx = file_idx;
+    event.files_count = files_count;
+    return event;
+}
+
+TransferEvent TransferEvent::file_progress(std::string path, uint64_t bytes, uint64_t total) {
+    TransferEvent event;
+    event.kind = TransferEventKind::FILE_PROGRESS;
+    event.path = std::move(path);
+    event.bytes = bytes;
+    event.total = total;
+    return event;
+}
+
+TransferEvent TransferEvent::file_done(std::string path, size_t file_idx, size_t files_count, bool ok, uint64_t bytes) {
+    TransferEvent event;
+    event.kind = TransferEventKind::FILE_DONE;
+    event.path = std::move(path);
+    event.file_idx = file_idx;
+    event.files_count = files_count;
+    event.ok = ok;
+    event.bytes = bytes;
+    return event;
+}
+
+TransferEvent TransferEvent::error(std::string path, int gp_error, std::string message) {
+    TransferEvent event;
+    event.kind = TransferEventKind::ERROR;
+    event.path = std::move(path);
+    event.gp_error = gp_error;
+    event.message = std::move(message);
+    return event;
+}
+
+EventQueue::EventQueue(std::shared_ptr<TransferEventListener> listener, size_t capacity)
+  : listener(std::move(listener)), capacity(std::max<size_t>(capacity, 1)) {
+    pending.reserve(this->capacity);
+    thread = std::thread(&EventQueue::run, this);
+}
+
+EventQueue::~EventQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    has_events.notify_one();
+    thread.join();
+}
+
+void EventQueue::post(TransferEvent event) {
+    bool droppable = event.kind == TransferEventKind::FILE_PROGRESS || event.kind == TransferEventKind::ENUMERATION;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    // Only the latest progress matters, a pending one of the same kind and file is replaced
+    if (droppable && !pending.empty() && pending.back().kind == event.kind && pending.back().path == event.path &&
+        !pending.back().finished) {
+        pending.back() = std::move(event);
+        return;
+    }
+
+    if (pending.size() >= capacity) {
+        if (droppable && !event.finished) {
+            dropped++;
+            return;
+        }
+        has_room.wait(lock, [this]() { return pending.size() < capacity; });
+    }
+
+    pending.push_back(std::move(event));
+    posted++;
+    lock.unlock();
+    has_events.notify_one();
+}
+
+void EventQueue::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    delivered_cv.wait(lock, [this]() { return delivered == posted; });
+}
+
+uint64_t EventQueue::dropped_count() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped;
+}
+
+void EventQueue::run() {
+    std::vector<TransferEvent> batch;
+    batch.reserve(capacity);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        has_events.wait(lock, [this]() { return stopping || !pending.empty(); });
+        if (pending.empty()) {
+            break; // Stopping and everything is delivered
+        }
+
+        batch.swap(pending);
+        lock.unlock();
+        has_room.notify_all();
+
+        listener->on_events(batch);
+        auto batch_size = batch.size();
+        batch.clear();
+
+        lock.lock();
+        delivered += batch_size;
+        delivered_cv.notify_all();
+    }
+}
+
+void ConsoleEventPrinter::on_events(const std::vector<TransferEvent>& events) {
+    for (const auto& event : events) {
+        switch (event.kind) {
+            case TransferEventKind::ENUMERATION:
+                if (line_open) {
+                    std::cout << '\n';
+                    line_open = false;
+                }
+                std::cout << "\rEnumerating files: " << event.files_count << std::flush;
+                if (event.finished) {
+                    std::cout << "\n\n" << std::flush;
+                }
+                break;
+            case TransferEventKind::FILE_STARTED:
+                if (line_open) {
+                    std::cout << '\n';
+                }
+                std::cout << "[" << event.file_idx << "/" << event.files_count << "]: Downloading \"" << event.path
+                          << "\"... " << std::flush;
+                open_line = event.path;
+                line_open = true;
+                break;
+            case TransferEventKind::FILE_PROGRESS:
+                break;
+            case TransferEventKind::FILE_DONE:
+                if (!line_open || open_line != event.path) {
+                    if (line_open) {
+                        std::cout << '\n';
+                    }
+                    std::cout << "[" << event.file_idx << "/" << event.files_count << "]: \"" << event.path << "\" ";
+                }
+                std::cout << (event.ok ? "DONE" : "FAILED") << std::endl;
+                line_open = false;
+                break;
+            case TransferEventKind::ERROR:
+                std::cerr << event.message << std::endl;
+                break;
+        }
+    }
+}
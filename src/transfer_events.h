@@ -0,0 +1,112 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_TRANSFER_EVENTS_H
+#define PHCOPY_TRANSFER_EVENTS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class TransferEventKind {
+    ENUMERATION,   // files_count files found so far, finished is set once the enumeration is done
+    FILE_STARTED,  // Transfer of file file_idx of files_count begins
+    FILE_PROGRESS, // bytes of total received so far, total is 0 if the device doesn't report the size
+    FILE_DONE,     // ok tells the result, bytes is the size of the downloaded file
+    ERROR,         // gp_error is the libgphoto2 result code, GP_OK for failures outside of libgphoto2
+};
+
+struct TransferEvent {
+    TransferEventKind kind {TransferEventKind::ERROR};
+    std::string path; // File or folder on the device, empty if the error isn't related to one
+    size_t file_idx {0};
+    size_t files_count {0};
+    uint64_t bytes {0};
+    uint64_t total {0};
+    bool ok {false};
+    bool finished {false};
+    int gp_error {0};
+    std::string message;
+
+    static TransferEvent enumeration(size_t files_count, bool finished);
+    static TransferEvent file_started(std::string path, size_t file_idx, size_t files_count);
+    static TransferEvent file_progress(std::string path, uint64_t bytes, uint64_t total);
+    static TransferEvent file_done(std::string path, size_t file_idx, size_t files_count, bool ok, uint64_t bytes);
+    static TransferEvent error(std::string path, int gp_error, std::string message);
+};
+
+class TransferEventListener {
+public:
+    virtual ~TransferEventListener() = default;
+
+    // Called from the delivery thread of the queue with events in the order they were posted
+    virtual void on_events(const std::vector<TransferEvent>& events) = 0;
+};
+
+// Delivers events to the listener in batches from its own thread, so a slow listener doesn't hold
+// the transfer. The queue is bounded: while it's full, progress and enumeration events are dropped
+// and only the file results and errors wait for room.
+class EventQueue {
+public:
+    explicit EventQueue(std::shared_ptr<TransferEventListener> listener, size_t capacity = 4096);
+    // Delivers the remaining events
+    ~EventQueue();
+
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    void post(TransferEvent event);
+
+    // Waits until all posted events are delivered
+    void flush();
+
+    // Progress and enumeration events dropped because the queue was full
+    uint64_t dropped_count() const;
+
+private:
+    void run();
+
+    std::shared_ptr<TransferEventListener> listener;
+    size_t capacity;
+    mutable std::mutex mutex;
+    std::condition_variable has_events;
+    std::condition_variable has_room;
+    std::condition_variable delivered_cv;
+    std::vector<TransferEvent> pending;
+    uint64_t posted {0};
+    uint64_t delivered {0};
+    uint64_t dropped {0};
+    bool stopping {false};
+    std::thread thread;
+};
+
+// The command line consumer: progress lines on stdout, errors on stderr.
+// A result is appended to the line of its file only if nothing was printed in between. Background writes finish
+// out of order, so otherwise the result gets a line of its own that names the file.
+class ConsoleEventPrinter : public TransferEventListener {
+public:
+    void on_events(const std::vector<TransferEvent>& events) override;
+
+private:
+    // Path of the file whose line waits for the result
+    std::string open_line;
+    bool line_open {false};
+};
+
+#endif // PHCOPY_TRANSFER_EVENTS_H
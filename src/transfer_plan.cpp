@@ -0,0 +1,185 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "transfer_plan.h"
+
+#include "listing_cache.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unordered_map>
+
+namespace {
+
+constexpr const char* PLAN_MAGIC = "PHPLAN01";
+constexpr const char* THROUGHPUT_FILE = "throughput";
+
+// Weight of the latest measurement, older runs fade out gradually
+constexpr double THROUGHPUT_SMOOTHING = 0.5;
+
+std::mutex history_mutex;
+
+std::unordered_map<std::string, double> load_throughputs(const std::filesystem::path& file) {
+    std::unordered_map<std::string, double> result;
+    std::ifstream in(file);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto tab = line.rfind('\t');
+        if (tab == std::string::npos) {
+            continue;
+        }
+        result[line.substr(0, tab)] = std::strtod(line.c_str() + tab + 1, nullptr);
+    }
+    return result;
+}
+
+bool is_plain_path(const std::filesystem::path& path) {
+    return path.native().find_first_of("\t\n") == std::string::npos;
+}
+
+} // namespace
+
+std::optional<TransferPlan> TransferPlan::load(const std::filesystem::path& file) {
+    std::ifstream in(file);
+    std::string line;
+    if (!std::getline(in, line) || line != PLAN_MAGIC) {
+        std::cerr << "Can't read transfer plan " << file << std::endl;
+        return std::nullopt;
+    }
+
+    TransferPlan plan;
+    while (std::getline(in, line)) {
+        // destination folder \t size \t source
+        auto first = line.find('\t');
+        auto second = first == std::string::npos ? first : line.find('\t', first + 1);
+        if (second == std::string::npos || line.find('\t', second + 1) != std::string::npos) {
+            std::cerr << "Malformed line in transfer plan " << file << ": " << line << std::endl;
+            return std::nullopt;
+        }
+
+        PlannedFile planned;
+        planned.destination_folder = line.substr(0, first);
+        planned.size = std::strtoull(line.c_str() + first + 1, nullptr, 10);
+        planned.source = line.substr(second + 1);
+        plan.add(std::move(planned));
+    }
+
+    return plan;
+}
+
+bool TransferPlan::save(const std::filesystem::path& file) const {
+    // Fields are separated by tabs and files by new lines, paths containing them can't be read back
+    for (const auto& planned : files) {
+        if (!is_plain_path(planned.destination_folder) || !is_plain_path(planned.source)) {
+            std::cerr << "Can't save transfer plan, the path contains a tab or a new line: "
+                      << (is_plain_path(planned.source) ? planned.destination_folder : planned.source) << std::endl;
+            return false;
+        }
+    }
+
+    std::ofstream out(file, std::ios::trunc);
+    out << PLAN_MAGIC << '\n';
+    for (const auto& planned : files) {
+        out << planned.destination_folder.string() << '\t' << planned.size << '\t' << planned.source.string() << '\n';
+    }
+
+    out.close();
+    if (!out) {
+        std::cerr << "Can't write transfer plan " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void TransferPlan::add(PlannedFile file) {
+    size += file.size;
+    files.push_back(std::move(file));
+}
+
+const std::vector<PlannedFile>& TransferPlan::get_files() const noexcept {
+    return files;
+}
+
+uint64_t TransferPlan::total_size() const noexcept {
+    return size;
+}
+
+std::optional<double> ThroughputHistory::load(const std::string& device_key) {
+    auto folder = user_cache_folder();
+    if (folder.empty() || device_key.empty()) {
+        return std::nullopt;
+    }
+
+    std::lock_guard<std::mutex> lock(history_mutex);
+    auto throughputs = load_throughputs(folder / THROUGHPUT_FILE);
+    auto pos = throughputs.find(device_key);
+    if (pos == throughputs.end() || pos->second <= 0) {
+        return std::nullopt;
+    }
+    return pos->second;
+}
+
+void ThroughputHistory::store(const std::string& device_key, double bytes_per_second) {
+    auto folder = user_cache_folder();
+    if (folder.empty() || device_key.empty() || device_key.find_first_of("\t\n") != std::string::npos) {
+        return;
+    }
+
+    // Several downloads may run in one process
+    std::lock_guard<std::mutex> lock(history_mutex);
+
+    std::error_code ec;
+    std::filesystem::create_directories(folder, ec);
+    if (ec) {
+        return;
+    }
+
+    auto file = folder / THROUGHPUT_FILE;
+    auto throughputs = load_throughputs(file);
+    auto [pos, inserted] = throughputs.try_emplace(device_key, bytes_per_second);
+    if (!inserted) {
+        pos->second = pos->second * (1 - THROUGHPUT_SMOOTHING) + bytes_per_second * THROUGHPUT_SMOOTHING;
+    }
+
+    std::ofstream out(file, std::ios::trunc);
+    for (const auto& [key, value] : throughputs) {
+        out << key << '\t' << static_cast<uint64_t>(value) << '\n';
+    }
+}
+
+std::optional<FileSystemSpace> file_system_space(const std::filesystem::path& path) {
+    struct statvfs stats {};
+    if (statvfs(path.c_str(), &stats) < 0) {
+        return std::nullopt;
+    }
+
+    FileSystemSpace space;
+    space.id = stats.f_fsid;
+    space.available = static_cast<uint64_t>(stats.f_bavail) * stats.f_frsize;
+    if (space.id == 0) {
+        // Some file systems leave the id empty, the device number tells them apart as well
+        struct stat file_stats {};
+        if (stat(path.c_str(), &file_stats) < 0) {
+            return std::nullopt;
+        }
+        space.id = file_stats.st_dev;
+    }
+    return space;
+}
@@ -0,0 +1,63 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef PHCOPY_TRANSFER_PLAN_H
+#define PHCOPY_TRANSFER_PLAN_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct PlannedFile {
+    std::filesystem::path source;             // File on the device
+    std::filesystem::path destination_folder; // Folder the file is written to
+    uint64_t size {0};                        // Zero if the device didn't report it
+};
+
+// Files of a download after enumeration, filtering and skip checks. Saved by a dry run and loaded by the real run,
+// so the device isn't enumerated twice.
+class TransferPlan {
+public:
+    static std::optional<TransferPlan> load(const std::filesystem::path& file);
+    bool save(const std::filesystem::path& file) const;
+
+    void add(PlannedFile file);
+
+    const std::vector<PlannedFile>& get_files() const noexcept;
+    uint64_t total_size() const noexcept;
+
+private:
+    std::vector<PlannedFile> files;
+    uint64_t size {0};
+};
+
+// Average transfer speed of every device measured by previous downloads, used to estimate the duration
+class ThroughputHistory {
+public:
+    static std::optional<double> load(const std::string& device_key);
+    static void store(const std::string& device_key, double bytes_per_second);
+};
+
+struct FileSystemSpace {
+    uint64_t id {0};        // Same for all paths on one file system
+    uint64_t available {0}; // Bytes available to unprivileged users
+};
+
+// File system of the path and its free space
+std::optional<FileSystemSpace> file_system_space(const std::filesystem::path& path);
+
+#endif // PHCOPY_TRANSFER_PLAN_H
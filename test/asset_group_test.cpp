@@ -0,0 +1,126 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <gmock/gmock.h>
+
+#include "asset_group.h"
+
+namespace {
+
+using Files = std::vector<std::filesystem::path>;
+
+std::vector<std::pair<std::string, AssetFileKind>> describe(const Asset& asset) {
+    std::vector<std::pair<std::string, AssetFileKind>> result;
+    for (const auto& file : asset.files) {
+        result.emplace_back(file.path.filename().string(), file.kind);
+    }
+    return result;
+}
+
+} // namespace
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+TEST(GroupAssetsTest, GroupsFilesSharingStem) {
+    auto assets = group_assets(Files {"/DCIM/IMG_0001.MOV", "/DCIM/IMG_0001.HEIC", "/DCIM/IMG_0002.JPG"});
+
+    ASSERT_EQ(assets.size(), 2u);
+    EXPECT_EQ(assets[0].key, "IMG_0001");
+    EXPECT_THAT(describe(assets[0]),
+                ElementsAre(Pair("IMG_0001.HEIC", AssetFileKind::PRIMARY),
+                            Pair("IMG_0001.MOV", AssetFileKind::LIVE_VIDEO)));
+    EXPECT_EQ(assets[1].key, "IMG_0002");
+    EXPECT_THAT(describe(assets[1]), ElementsAre(Pair("IMG_0002.JPG", AssetFileKind::PRIMARY)));
+}
+
+TEST(GroupAssetsTest, StemsAreCaseInsensitive) {
+    auto assets = group_assets(Files {"/DCIM/img_0001.heic", "/DCIM/IMG_0001.mov"});
+
+    ASSERT_EQ(assets.size(), 1u);
+    EXPECT_EQ(assets[0].key, "IMG_0001");
+    EXPECT_THAT(describe(assets[0]),
+                ElementsAre(Pair("img_0001.heic", AssetFileKind::PRIMARY),
+                            Pair("IMG_0001.mov", AssetFileKind::LIVE_VIDEO)));
+}
+
+TEST(GroupAssetsTest, EditMarkersJoinOriginal) {
+    auto assets = group_assets(
+            Files {"/DCIM/IMG_E0001.HEIC", "/DCIM/IMG_0001.AAE", "/DCIM/IMG_O0001.AAE", "/DCIM/IMG_0001.HEIC"});
+
+    ASSERT_EQ(assets.size(), 1u);
+    EXPECT_EQ(assets[0].key, "IMG_0001");
+    EXPECT_THAT(describe(assets[0]),
+                ElementsAre(Pair("IMG_0001.HEIC", AssetFileKind::PRIMARY),
+                            Pair("IMG_E0001.HEIC", AssetFileKind::EDITED),
+                            Pair("IMG_0001.AAE", AssetFileKind::SIDECAR),
+                            Pair("IMG_O0001.AAE", AssetFileKind::SIDECAR)));
+}
+
+TEST(GroupAssetsTest, MarkerNeedsDigitsAfterIt) {
+    // Not an edit marker: the letter isn't followed by the sequence number only
+    auto assets = group_assets(Files {"/DCIM/IMG_EXPORT.JPG", "/DCIM/IMG_E.JPG", "/DCIM/IMG_X0001.JPG"});
+
+    ASSERT_EQ(assets.size(), 3u);
+    EXPECT_EQ(assets[0].key, "IMG_EXPORT");
+    EXPECT_EQ(assets[1].key, "IMG_E");
+    EXPECT_EQ(assets[2].key, "IMG_X0001");
+    for (const auto& asset : assets) {
+        EXPECT_THAT(describe(asset), ElementsAre(Pair(::testing::_, AssetFileKind::PRIMARY)));
+    }
+}
+
+TEST(GroupAssetsTest, VideoWithoutStillIsPrimary) {
+    auto assets = group_assets(Files {"/DCIM/IMG_0003.MOV", "/DCIM/IMG_0003.AAE"});
+
+    ASSERT_EQ(assets.size(), 1u);
+    EXPECT_THAT(describe(assets[0]),
+                ElementsAre(Pair("IMG_0003.MOV", AssetFileKind::PRIMARY),
+                            Pair("IMG_0003.AAE", AssetFileKind::SIDECAR)));
+}
+
+TEST(GroupAssetsTest, EditedVideoOfStill) {
+    auto assets = group_assets(Files {"/DCIM/IMG_0004.HEIC", "/DCIM/IMG_E0004.MOV"});
+
+    ASSERT_EQ(assets.size(), 1u);
+    EXPECT_THAT(describe(assets[0]),
+                ElementsAre(Pair("IMG_0004.HEIC", AssetFileKind::PRIMARY),
+                            Pair("IMG_E0004.MOV", AssetFileKind::EDITED)));
+}
+
+TEST(GroupAssetsTest, EmptyList) {
+    EXPECT_TRUE(group_assets(Files {}).empty());
+}
+
+TEST(AssetFilterTest, RemovesExcludedKinds) {
+    auto assets = group_assets(Files {"/DCIM/IMG_0001.HEIC", "/DCIM/IMG_0001.MOV", "/DCIM/IMG_0001.AAE"});
+    ASSERT_EQ(assets.size(), 1u);
+
+    AssetFilter filter;
+    filter.exclude(AssetFileKind::LIVE_VIDEO);
+    filter.exclude(AssetFileKind::SIDECAR);
+    ASSERT_TRUE(filter.apply(assets[0]));
+    EXPECT_THAT(describe(assets[0]), ElementsAre(Pair("IMG_0001.HEIC", AssetFileKind::PRIMARY)));
+}
+
+TEST(AssetFilterTest, EmptyAssetIsDropped) {
+    auto assets = group_assets(Files {"/DCIM/IMG_0001.AAE"});
+    ASSERT_EQ(assets.size(), 1u);
+
+    AssetFilter filter;
+    filter.exclude(AssetFileKind::SIDECAR);
+    EXPECT_FALSE(filter.apply(assets[0]));
+}
@@ -0,0 +1,416 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <gmock/gmock.h>
+
+#include "media_metadata.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+
+// 2021-06-01 10:20:30 as if it was UTC
+constexpr std::time_t CAPTURE_TIME = 1622542830;
+// Seconds between 1904-01-01 and 1970-01-01
+constexpr uint64_t QUICKTIME_EPOCH_OFFSET = 2082844800;
+
+void put_be16(std::string& out, uint16_t value) {
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+void put_be32(std::string& out, uint32_t value) {
+    put_be16(out, static_cast<uint16_t>(value >> 16));
+    put_be16(out, static_cast<uint16_t>(value));
+}
+
+void put_be64(std::string& out, uint64_t value) {
+    put_be32(out, static_cast<uint32_t>(value >> 32));
+    put_be32(out, static_cast<uint32_t>(value));
+}
+
+std::string box(const std::string& type, const std::string& payload) {
+    std::string out;
+    put_be32(out, static_cast<uint32_t>(payload.size() + 8));
+    return out + type + payload;
+}
+
+// TIFF structure of EXIF with IFDs written one after another and the values after them
+class TiffBuilder {
+public:
+    explicit TiffBuilder(bool little_endian) : little_endian(little_endian) {}
+
+    size_t add_ifd() {
+        ifds.emplace_back();
+        return ifds.size() - 1;
+    }
+
+    void ascii(size_t ifd, uint16_t tag, const std::string& value) {
+        ifds[ifd].push_back({tag, TYPE_ASCII, static_cast<uint32_t>(value.size() + 1), value + '\0', 0});
+    }
+
+    void rationals(size_t ifd, uint16_t tag, const std::vector<std::pair<uint32_t, uint32_t>>& values) {
+        std::string bytes;
+        for (const auto& [numerator, denominator] : values) {
+            put32(bytes, numerator);
+            put32(bytes, denominator);
+        }
+        ifds[ifd].push_back({tag, TYPE_RATIONAL, static_cast<uint32_t>(values.size()), bytes, 0});
+    }
+
+    void pointer(size_t ifd, uint16_t tag, size_t target) {
+        ifds[ifd].push_back({tag, TYPE_LONG, 1, {}, target});
+    }
+
+    std::string build() const {
+        std::vector<uint32_t> offsets;
+        uint32_t offset = 8;
+        for (const auto& ifd : ifds) {
+            offsets.push_back(offset);
+            offset += static_cast<uint32_t>(2 + ifd.size() * 12 + 4);
+        }
+
+        std::string out = little_endian ? "II" : "MM";
+        put16(out, 42);
+        put32(out, offsets.front());
+        std::string values;
+        for (const auto& ifd : ifds) {
+            put16(out, static_cast<uint16_t>(ifd.size()));
+            for (const auto& entry : ifd) {
+                put16(out, entry.tag);
+                put16(out, entry.type);
+                put32(out, entry.count);
+                if (entry.type == TYPE_LONG) {
+                    put32(out, offsets[entry.target]);
+                } else if (entry.value.size() <= 4) {
+                    out += entry.value + std::string(4 - entry.value.size(), '\0');
+                } else {
+                    put32(out, static_cast<uint32_t>(offset + values.size()));
+                    values += entry.value;
+                }
+            }
+            put32(out, 0); // Next IFD
+        }
+        return out + values;
+    }
+
+private:
+    static constexpr uint16_t TYPE_ASCII = 2;
+    static constexpr uint16_t TYPE_LONG = 4;
+    static constexpr uint16_t TYPE_RATIONAL = 5;
+
+    struct Entry {
+        uint16_t tag;
+        uint16_t type;
+        uint32_t count;
+        std::string value;
+        size_t target; // IFD the pointer entries refer to
+    };
+
+    void put16(std::string& out, uint16_t value) const {
+        if (little_endian) {
+            out += static_cast<char>(value);
+            out += static_cast<char>(value >> 8);
+        } else {
+            put_be16(out, value);
+        }
+    }
+
+    void put32(std::string& out, uint32_t value) const {
+        if (little_endian) {
+            put16(out, static_cast<uint16_t>(value));
+            put16(out, static_cast<uint16_t>(value >> 16));
+        } else {
+            put_be32(out, value);
+        }
+    }
+
+    bool little_endian;
+    std::vector<std::vector<Entry>> ifds;
+};
+
+// Make, model, capture time and position of 37°46'30" N 122°25'12" W
+std::string exif_sample(bool little_endian) {
+    TiffBuilder tiff(little_endian);
+    auto main = tiff.add_ifd();
+    auto exif = tiff.add_ifd();
+    auto gps = tiff.add_ifd();
+    tiff.ascii(main, 0x010F, "Apple");
+    tiff.ascii(main, 0x0110, "iPhone 12");
+    tiff.ascii(main, 0x0132, "2021:06:02 00:00:00");
+    tiff.pointer(main, 0x8769, exif);
+    tiff.pointer(main, 0x8825, gps);
+    tiff.ascii(exif, 0x9003, "2021:06:01 10:20:30");
+    tiff.ascii(gps, 1, "N");
+    tiff.rationals(gps, 2, {{37, 1}, {46, 1}, {3000, 100}});
+    tiff.ascii(gps, 3, "W");
+    tiff.rationals(gps, 4, {{122, 1}, {25, 1}, {1200, 100}});
+    return tiff.build();
+}
+
+std::string jpeg_sample() {
+    std::string out = "\xFF\xD8";
+    // JFIF segment before the EXIF one
+    out += "\xFF\xE0";
+    put_be16(out, 16);
+    out += std::string("JFIF\0\x01\x01\0\0\x01\0\x01\0\0", 14);
+
+    auto exif = std::string("Exif\0\0", 6) + exif_sample(true);
+    out += "\xFF\xE1";
+    put_be16(out, static_cast<uint16_t>(exif.size() + 2));
+    out += exif;
+
+    out += "\xFF\xDA";
+    put_be16(out, 8);
+    out += std::string(6, '\x11');
+    out += "\xFF\xD9";
+    return out;
+}
+
+struct HeifOptions {
+    unsigned iloc_version {1};
+    unsigned base_offset_size {0};
+    uint64_t base_offset {0};
+    std::optional<uint64_t> exif_offset; // Extent offset of the EXIF item, where it is written by default
+};
+
+std::string heif_ftyp() {
+    return box("ftyp", "heic" + std::string(4, '\0') + "mif1heic");
+}
+
+// Image item 1 and EXIF item 2
+std::string heif_iinf() {
+    std::string iinf = std::string(4, '\0');
+    put_be16(iinf, 2);
+    for (auto [id, type] : {std::pair<uint16_t, const char*> {1, "hvc1"}, {2, "Exif"}}) {
+        std::string infe = std::string("\x02\0\0\0", 4);
+        put_be16(infe, id);
+        put_be16(infe, 0);
+        infe += type;
+        infe += '\0';
+        iinf += box("infe", infe);
+    }
+    return box("iinf", iinf);
+}
+
+std::string heif_sample(const HeifOptions& options = {}) {
+    std::string ftyp = heif_ftyp();
+    std::string item = std::string("\0\0\0\x06", 4) + "Exif" + std::string(2, '\0') + exif_sample(false);
+
+    // The item is written at the start of the media data, right after the meta box
+    auto build_meta = [&](uint64_t item_offset) {
+        std::string iloc;
+        iloc += static_cast<char>(options.iloc_version);
+        iloc += std::string(3, '\0');
+        iloc += static_cast<char>(0x44);
+        iloc += static_cast<char>(options.base_offset_size << 4);
+        if (options.iloc_version < 2) {
+            put_be16(iloc, 1);
+            put_be16(iloc, 2);
+        } else {
+            put_be32(iloc, 1);
+            put_be32(iloc, 2);
+        }
+        if (options.iloc_version > 0) {
+            put_be16(iloc, 0); // Construction method
+        }
+        put_be16(iloc, 0); // Data reference index
+        if (options.base_offset_size == 8) {
+            put_be64(iloc, options.base_offset);
+        } else if (options.base_offset_size == 4) {
+            put_be32(iloc, static_cast<uint32_t>(options.base_offset));
+        }
+        put_be16(iloc, 1);
+        put_be32(iloc, static_cast<uint32_t>(options.exif_offset.value_or(item_offset - options.base_offset)));
+        put_be32(iloc, static_cast<uint32_t>(item.size()));
+        return box("meta", std::string(4, '\0') + heif_iinf() + box("iloc", iloc));
+    };
+
+    auto meta_size = build_meta(0).size();
+    auto meta = build_meta(ftyp.size() + meta_size + 8);
+    return ftyp + meta + box("mdat", item);
+}
+
+struct QuickTimeOptions {
+    bool apple_keys {true};
+    uint64_t creation_time {CAPTURE_TIME - 7200 + QUICKTIME_EPOCH_OFFSET}; // UTC time of the movie header
+};
+
+std::string quicktime_sample(const QuickTimeOptions& options = {}) {
+    std::string ftyp = box("ftyp", "qt  " + std::string(4, '\0') + "qt  ");
+    // Media data before the movie box is skipped by its size
+    std::string mdat = box("mdat", std::string(64, '\x22'));
+
+    std::string mvhd = std::string(4, '\0');
+    put_be32(mvhd, static_cast<uint32_t>(options.creation_time));
+    put_be32(mvhd, static_cast<uint32_t>(options.creation_time));
+    put_be32(mvhd, 600);
+    put_be32(mvhd, 6000);
+    std::string moov = box("mvhd", mvhd);
+
+    if (options.apple_keys) {
+        const std::vector<std::pair<std::string, std::string>> values = {
+                {"com.apple.quicktime.make", "Apple"},
+                {"com.apple.quicktime.model", "iPhone 12"},
+                {"com.apple.quicktime.creationdate", "2021-06-01T10:20:30+0200"},
+                {"com.apple.quicktime.location.ISO6709", "+37.7750-122.4200+012.345/"},
+        };
+        std::string keys = std::string(4, '\0');
+        put_be32(keys, static_cast<uint32_t>(values.size()));
+        std::string ilst;
+        for (size_t i = 0; i < values.size(); i++) {
+            put_be32(keys, static_cast<uint32_t>(values[i].first.size() + 8));
+            keys += "mdta" + values[i].first;
+
+            std::string data;
+            put_be32(data, 1);
+            put_be32(data, 0);
+            std::string item = box("data", data + values[i].second);
+            std::string index;
+            put_be32(index, static_cast<uint32_t>(i + 1));
+            ilst += box(index, item);
+        }
+        moov += box("meta", box("hdlr", std::string(24, '\0')) + box("keys", keys) + box("ilst", ilst));
+    }
+
+    return ftyp + mdat + box("moov", moov);
+}
+
+std::optional<MediaMetadata> parse(const std::string& data) {
+    // Exactly sized copy, so reads past the end are caught by the sanitizers
+    std::vector<char> copy(data.begin(), data.end());
+    return parse_media_metadata(copy.data(), copy.size());
+}
+
+} // namespace
+
+using ::testing::AnyOf;
+using ::testing::DoubleNear;
+using ::testing::Eq;
+
+TEST(MediaMetadataTest, Jpeg) {
+    auto metadata = parse(jpeg_sample());
+    ASSERT_TRUE(metadata.has_value());
+    EXPECT_EQ(metadata->make, "Apple");
+    EXPECT_EQ(metadata->model, "iPhone 12");
+    EXPECT_EQ(metadata->capture_time, CAPTURE_TIME);
+    EXPECT_TRUE(metadata->has_location);
+    EXPECT_THAT(metadata->latitude, DoubleNear(37.775, 1e-9));
+    EXPECT_THAT(metadata->longitude, DoubleNear(-122.42, 1e-9));
+}
+
+TEST(MediaMetadataTest, JpegWithoutExif) {
+    std::string data = "\xFF\xD8\xFF\xDA";
+    put_be16(data, 4);
+    data += "\x11\x11\xFF\xD9";
+    EXPECT_FALSE(parse(data).has_value());
+}
+
+TEST(MediaMetadataTest, Heif) {
+    for (unsigned version : {0U, 1U, 2U}) {
+        HeifOptions options;
+        options.iloc_version = version;
+        auto metadata = parse(heif_sample(options));
+        ASSERT_TRUE(metadata.has_value()) << "iloc version " << version;
+        EXPECT_EQ(metadata->make, "Apple");
+        EXPECT_EQ(metadata->model, "iPhone 12");
+        EXPECT_EQ(metadata->capture_time, CAPTURE_TIME);
+        EXPECT_THAT(metadata->latitude, DoubleNear(37.775, 1e-9));
+        EXPECT_THAT(metadata->longitude, DoubleNear(-122.42, 1e-9));
+    }
+}
+
+TEST(MediaMetadataTest, HeifBaseOffset) {
+    HeifOptions options;
+    options.base_offset_size = 4;
+    options.base_offset = 100;
+    auto metadata = parse(heif_sample(options));
+    ASSERT_TRUE(metadata.has_value());
+    EXPECT_EQ(metadata->model, "iPhone 12");
+}
+
+TEST(MediaMetadataTest, HeifExifOffsetOutsideFile) {
+    HeifOptions options;
+    options.exif_offset = 0xFFFFFFFF;
+    EXPECT_FALSE(parse(heif_sample(options)).has_value());
+
+    // Sums close to the maximum must not wrap around into the file
+    options.base_offset_size = 8;
+    options.base_offset = UINT64_MAX - 1;
+    options.exif_offset = 0;
+    EXPECT_FALSE(parse(heif_sample(options)).has_value());
+}
+
+TEST(MediaMetadataTest, HeifTruncatedIloc) {
+    // Version 2 location box ending before its 4 byte item count, at the very end of the file
+    std::string iloc = std::string("\x02\0\0\0\x44\0\0\0", 8);
+    EXPECT_FALSE(parse(heif_ftyp() + box("meta", std::string(4, '\0') + heif_iinf() + box("iloc", iloc))).has_value());
+}
+
+TEST(MediaMetadataTest, QuickTime) {
+    auto metadata = parse(quicktime_sample());
+    ASSERT_TRUE(metadata.has_value());
+    EXPECT_EQ(metadata->make, "Apple");
+    EXPECT_EQ(metadata->model, "iPhone 12");
+    // Local time of the Apple keys is preferred to the UTC time of the movie header
+    EXPECT_EQ(metadata->capture_time, CAPTURE_TIME);
+    EXPECT_TRUE(metadata->has_location);
+    EXPECT_THAT(metadata->latitude, DoubleNear(37.775, 1e-9));
+    EXPECT_THAT(metadata->longitude, DoubleNear(-122.42, 1e-9));
+}
+
+TEST(MediaMetadataTest, QuickTimeMovieHeaderOnly) {
+    QuickTimeOptions options;
+    options.apple_keys = false;
+    auto metadata = parse(quicktime_sample(options));
+    ASSERT_TRUE(metadata.has_value());
+    EXPECT_EQ(metadata->capture_time, CAPTURE_TIME - 7200);
+    EXPECT_FALSE(metadata->has_location);
+    EXPECT_TRUE(metadata->make.empty());
+}
+
+TEST(MediaMetadataTest, UnknownFormat) {
+    EXPECT_FALSE(parse("").has_value());
+    EXPECT_FALSE(parse("\x89PNG\r\n\x1a\n").has_value());
+    EXPECT_FALSE(parse(std::string(64, '\0')).has_value());
+}
+
+TEST(MediaMetadataTest, Truncated) {
+    for (const auto& sample : {jpeg_sample(), heif_sample(), heif_sample({2}), quicktime_sample()}) {
+        for (size_t size = 0; size < sample.size(); size++) {
+            auto metadata = parse(sample.substr(0, size));
+            if (metadata) {
+                // Whatever is read from a prefix must be complete, values are never cut
+                EXPECT_THAT(metadata->model, AnyOf(Eq(""), Eq("iPhone 12"))) << "size " << size;
+            }
+        }
+    }
+}
+
+TEST(MediaMetadataTest, Corrupted) {
+    for (const auto& sample : {jpeg_sample(), heif_sample(), heif_sample({2}), quicktime_sample()}) {
+        for (size_t pos = 0; pos < sample.size(); pos++) {
+            for (char value : {'\0', '\x7F', '\xFF'}) {
+                auto corrupted = sample;
+                corrupted[pos] = value;
+                parse(corrupted);
+            }
+        }
+    }
+}
@@ -0,0 +1,128 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <gmock/gmock.h>
+
+#include "metadata_index.h"
+
+#include <fstream>
+#include <unistd.h>
+
+namespace {
+
+class MetadataIndexTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        file = std::filesystem::temp_directory_path() / ("phcopy-metadata-index-test-" + std::to_string(getpid()));
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+    }
+
+    std::filesystem::path file;
+};
+
+MetadataRecord make_record(std::string path, std::time_t capture_time, std::string model) {
+    MetadataRecord record;
+    record.path = std::move(path);
+    record.metadata.capture_time = capture_time;
+    record.metadata.make = "Apple";
+    record.metadata.model = std::move(model);
+    return record;
+}
+
+std::vector<std::string> paths(const MetadataIndex& index) {
+    std::vector<std::string> result;
+    for (size_t i = 0; i < index.size(); i++) {
+        result.emplace_back(index.path(i));
+    }
+    return result;
+}
+
+} // namespace
+
+using ::testing::ElementsAre;
+
+TEST_F(MetadataIndexTest, RoundTrip) {
+    auto located = make_record("100APPLE/IMG_0002.HEIC", 1622542830, "iPhone 12");
+    located.metadata.has_location = true;
+    located.metadata.latitude = 37.775;
+    located.metadata.longitude = -122.42;
+    ASSERT_TRUE(MetadataIndex::update(
+            file, {located, make_record("100APPLE/IMG_0001.JPG", -86'400, ""), make_record("IMG_0003.MOV", 0, "")}));
+
+    auto index = MetadataIndex::open(file);
+    ASSERT_NE(index, nullptr);
+    // Records are sorted by path
+    EXPECT_THAT(paths(*index), ElementsAre("100APPLE/IMG_0001.JPG", "100APPLE/IMG_0002.HEIC", "IMG_0003.MOV"));
+
+    EXPECT_EQ(index->capture_time(0), -86'400);
+    EXPECT_FALSE(index->has_location(0));
+    EXPECT_EQ(index->make(0), "Apple");
+    EXPECT_EQ(index->model(0), "");
+
+    auto record = index->record(1);
+    EXPECT_EQ(record.path, "100APPLE/IMG_0002.HEIC");
+    EXPECT_EQ(record.metadata.capture_time, 1622542830);
+    EXPECT_TRUE(record.metadata.has_location);
+    EXPECT_DOUBLE_EQ(record.metadata.latitude, 37.775);
+    EXPECT_DOUBLE_EQ(record.metadata.longitude, -122.42);
+    EXPECT_EQ(record.metadata.make, "Apple");
+    EXPECT_EQ(record.metadata.model, "iPhone 12");
+}
+
+TEST_F(MetadataIndexTest, UpdateReplacesSamePath) {
+    ASSERT_TRUE(MetadataIndex::update(file,
+                                      {make_record("IMG_0001.JPG", 1, "old"), make_record("IMG_0002.JPG", 2, "")}));
+    ASSERT_TRUE(MetadataIndex::update(file,
+                                      {make_record("IMG_0001.JPG", 10, "new"), make_record("IMG_0000.JPG", 0, "")}));
+
+    auto index = MetadataIndex::open(file);
+    ASSERT_NE(index, nullptr);
+    EXPECT_THAT(paths(*index), ElementsAre("IMG_0000.JPG", "IMG_0001.JPG", "IMG_0002.JPG"));
+    EXPECT_EQ(index->capture_time(1), 10);
+    EXPECT_EQ(index->model(1), "new");
+    EXPECT_EQ(index->capture_time(2), 2);
+}
+
+TEST_F(MetadataIndexTest, Empty) {
+    ASSERT_TRUE(MetadataIndex::update(file, {}));
+    auto index = MetadataIndex::open(file);
+    ASSERT_NE(index, nullptr);
+    EXPECT_EQ(index->size(), 0U);
+}
+
+TEST_F(MetadataIndexTest, RejectsCorrupted) {
+    ASSERT_TRUE(MetadataIndex::update(file, {make_record("IMG_0001.JPG", 1, "iPhone 12")}));
+    auto size = std::filesystem::file_size(file);
+
+    // Truncated strings
+    std::filesystem::resize_file(file, size - 1);
+    EXPECT_EQ(MetadataIndex::open(file), nullptr);
+
+    // Not an index
+    {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        out << std::string(size, 'x');
+    }
+    EXPECT_EQ(MetadataIndex::open(file), nullptr);
+
+    // Too short for the header
+    std::filesystem::resize_file(file, 4);
+    EXPECT_EQ(MetadataIndex::open(file), nullptr);
+}
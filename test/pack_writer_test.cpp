@@ -0,0 +1,145 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <gmock/gmock.h>
+
+#include "pack_writer.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint64_t GIB = uint64_t {1} << 30;
+
+class PackWriterTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        folder = std::filesystem::temp_directory_path() / ("phcopy-pack-test-" + std::to_string(getpid()));
+        std::filesystem::create_directories(folder);
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        std::filesystem::remove_all(folder, ec);
+    }
+
+    std::filesystem::path folder;
+};
+
+FileData make_data(const std::string& contents) {
+    auto buffer = std::make_shared<std::string>(contents);
+    FileData data;
+    data.owner = buffer;
+    data.data = buffer->data();
+    data.size = buffer->size();
+    return data;
+}
+
+std::string field(uint64_t value, size_t size = 12) {
+    std::string result(size, 'x');
+    write_tar_number(result.data(), size, value);
+    return result;
+}
+
+} // namespace
+
+using ::testing::Optional;
+
+TEST(TarNumberTest, Octal) {
+    EXPECT_EQ(field(0), std::string("00000000000\0", 12));
+    EXPECT_EQ(field(01750), std::string("00000001750\0", 12));
+    EXPECT_EQ(field(8 * GIB - 1), std::string("77777777777\0", 12));
+    EXPECT_EQ(field(0644, 8), std::string("0000644\0", 8));
+
+    EXPECT_THAT(parse_tar_number(field(8 * GIB - 1).data(), 12), Optional(8 * GIB - 1));
+    // Other writers pad with spaces or end the digits with a space
+    EXPECT_THAT(parse_tar_number("   1750 \0\0\0\0", 12), Optional(01750U));
+    EXPECT_THAT(parse_tar_number("0000644 ", 8), Optional(0644U));
+}
+
+TEST(TarNumberTest, Base256) {
+    // 8 GiB doesn't fit the octal digits of the size field
+    EXPECT_EQ(field(8 * GIB), std::string("\x80\0\0\0\0\0\0\x02\0\0\0\0", 12));
+    for (uint64_t value : {8 * GIB, 100 * GIB + 12345, UINT64_MAX}) {
+        EXPECT_THAT(parse_tar_number(field(value).data(), 12), Optional(value)) << value;
+    }
+    EXPECT_THAT(parse_tar_number(field(UINT64_MAX, 8).data(), 8), Optional(UINT64_MAX >> 8));
+}
+
+TEST(TarNumberTest, Malformed) {
+    EXPECT_EQ(parse_tar_number("", 0), std::nullopt);
+    EXPECT_EQ(parse_tar_number("           \0", 12), std::nullopt);
+    EXPECT_EQ(parse_tar_number("0000009\0", 8), std::nullopt);
+    EXPECT_EQ(parse_tar_number("00001x0\0", 8), std::nullopt);
+    // Negative base-256 value
+    EXPECT_EQ(parse_tar_number("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF", 12), std::nullopt);
+    // More than 64 bits
+    EXPECT_EQ(parse_tar_number("\x80\0\x01\0\0\0\0\0\0\0\0\0", 12), std::nullopt);
+}
+
+TEST_F(PackWriterTest, RoundTrip) {
+    {
+        PackWriter writer(folder, GIB);
+        ASSERT_TRUE(writer.begin_group());
+        ASSERT_TRUE(writer.add("100APPLE/IMG_0001.HEIC", make_data("still"), 1'600'000'000));
+        ASSERT_TRUE(writer.add("100APPLE/IMG_0001.MOV", make_data(std::string(1000, 'v')), 1'600'000'000));
+        ASSERT_TRUE(writer.commit_group());
+        ASSERT_TRUE(writer.begin_group());
+        ASSERT_TRUE(writer.add(std::string(120, 'd') + "/" + std::string(120, 'n') + ".JPG", make_data(""), 0));
+        ASSERT_TRUE(writer.commit_group());
+        ASSERT_TRUE(writer.finish());
+    }
+
+    auto entries = load_pack_index(folder);
+    ASSERT_TRUE(entries.has_value());
+    ASSERT_EQ(entries->size(), 3U);
+    EXPECT_EQ((*entries)[0].path, "100APPLE/IMG_0001.HEIC");
+    EXPECT_EQ((*entries)[0].size, 5U);
+    EXPECT_EQ((*entries)[1].size, 1000U);
+    EXPECT_EQ((*entries)[2].size, 0U);
+
+    std::ifstream pack((*entries)[1].pack, std::ios::binary);
+    pack.seekg(static_cast<std::streamoff>((*entries)[1].offset));
+    std::string contents(1000, '\0');
+    pack.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+    EXPECT_EQ(contents, std::string(1000, 'v'));
+}
+
+TEST_F(PackWriterTest, RejectsHeaderNotMatchingIndex) {
+    {
+        PackWriter writer(folder, GIB);
+        ASSERT_TRUE(writer.begin_group());
+        ASSERT_TRUE(writer.add("IMG_0001.JPG", make_data("jpeg"), 0));
+        ASSERT_TRUE(writer.commit_group());
+        ASSERT_TRUE(writer.finish());
+    }
+    auto entries = load_pack_index(folder);
+    ASSERT_TRUE(entries.has_value());
+    ASSERT_EQ(entries->size(), 1U);
+
+    // Size field of the header preceding the data
+    int fd = open((*entries)[0].pack.c_str(), O_WRONLY);
+    ASSERT_GE(fd, 0);
+    auto size_field = field(5);
+    ASSERT_EQ(pwrite(fd, size_field.data(), size_field.size(), static_cast<off_t>((*entries)[0].offset - 512 + 124)),
+              static_cast<ssize_t>(size_field.size()));
+    close(fd);
+
+    EXPECT_EQ(load_pack_index(folder), std::nullopt);
+}
@@ -0,0 +1,291 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// End-to-end throughput of list-files and download against libgphoto2's directory camera driver.
+// The fixture is generated, the first run records the throughput to the baseline file and the later
+// runs fail if they are slower than the baseline by more than the tolerance. Built with BUILD_PERF_TESTS,
+// the baseline is machine specific and kept in the build folder unless PHCOPY_PERF_BASELINE is configured.
+//
+// PHCOPY_PERF_TOLERANCE  allowed slowdown, 0.3 by default
+// PHCOPY_PERF_UPDATE     set to 1 to record the measured throughput as the new baseline
+
+#include <gmock/gmock.h>
+
+#include "device_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t TOP_FOLDERS = 8;
+constexpr size_t FILES_PER_FOLDER = 200;
+constexpr size_t NESTED_FOLDERS = 2;
+constexpr size_t FILES_PER_NESTED_FOLDER = 25;
+constexpr uint32_t FIXTURE_SEED = 20201;
+constexpr size_t LIST_RUNS = 3;
+constexpr size_t DOWNLOAD_RUNS = 2;
+constexpr double DEFAULT_TOLERANCE = 0.3;
+constexpr double BYTES_IN_MEGABYTE = 1024 * 1024;
+const char DIRECTORY_CAMERA_MODEL[] = "Directory Browse";
+
+// Files of the camera, the key is the path on the device
+using FixtureFiles = std::map<std::string, uint64_t>;
+
+class Fixture {
+public:
+    Fixture() {
+        root = std::filesystem::temp_directory_path() / ("phcopy-perf-" + std::to_string(getpid()));
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(camera_folder());
+
+        // Every command uses the cache of the test, which knows the directory camera
+        setenv("XDG_CACHE_HOME", (root / "cache").c_str(), 1);
+        DeviceCache::store({"", DIRECTORY_CAMERA_MODEL, port()});
+
+        // std::mt19937 output is the same everywhere, the distributions of the standard library are not
+        std::mt19937 random(FIXTURE_SEED);
+        size_t file_number = 0;
+        auto add_files = [&](const std::filesystem::path& folder, size_t count) {
+            std::filesystem::create_directories(camera_folder() / folder);
+            for (size_t i = 0; i < count; i++, file_number++) {
+                auto kind = random() % 100;
+                uint64_t size;
+                std::string extension;
+                if (kind < 75) {
+                    size = 4 * 1024 + random() % (28 * 1024);
+                    extension = ".JPG";
+                } else if (kind < 98) {
+                    size = 64 * 1024 + random() % (192 * 1024);
+                    extension = ".HEIC";
+                } else {
+                    size = 1024 * 1024 + random() % (1024 * 1024);
+                    extension = ".MOV";
+                }
+
+                std::ostringstream name;
+                name << "IMG_" << std::setw(5) << std::setfill('0') << file_number << extension;
+                auto path = folder / name.str();
+
+                std::string data(size, '\0');
+                for (auto& c : data) {
+                    c = static_cast<char>(random());
+                }
+                std::ofstream out(camera_folder() / path, std::ios::binary);
+                out.write(data.data(), static_cast<std::streamsize>(data.size()));
+
+                files["/" + path.generic_string()] = size;
+                total_size += size;
+            }
+        };
+
+        for (size_t i = 0; i < TOP_FOLDERS; i++) {
+            auto folder = std::filesystem::path("DCIM") / (std::to_string(100 + i) + "PHCPY");
+            add_files(folder, FILES_PER_FOLDER);
+            for (size_t j = 0; j < NESTED_FOLDERS; j++) {
+                add_files(folder / ("BURST" + std::to_string(j + 1)), FILES_PER_NESTED_FOLDER);
+            }
+        }
+    }
+
+    ~Fixture() {
+        std::error_code ec;
+        std::filesystem::remove_all(root, ec);
+    }
+
+    std::filesystem::path camera_folder() const {
+        return root / "camera";
+    }
+
+    std::string port() const {
+        return "disk:" + camera_folder().string();
+    }
+
+    std::filesystem::path root;
+    FixtureFiles files;
+    uint64_t total_size {0};
+};
+
+const Fixture& fixture() {
+    static Fixture instance;
+    return instance;
+}
+
+std::string quote(const std::string& value) {
+    std::string quoted = "'";
+    for (char c : value) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+// Runs phcopy with the directory camera and returns the duration in seconds, or a negative value on failure
+double run_phcopy(const std::string& arguments, const std::filesystem::path& output) {
+    auto command = quote(PHCOPY_BINARY) + " " + arguments + " --device-port " + quote(fixture().port()) +
+                   " --no-cache > " + quote(output.string()) + " 2>&1";
+
+    auto start = std::chrono::steady_clock::now();
+    int status = std::system(command.c_str());
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::ifstream log(output);
+        std::cerr << "Failed: " << command << "\n" << log.rdbuf() << std::endl;
+        return -1;
+    }
+    return elapsed.count();
+}
+
+// "key value" lines
+class Baseline {
+public:
+    Baseline() : file(PHCOPY_PERF_BASELINE) {
+        std::ifstream in(file);
+        std::string key;
+        double value;
+        while (in >> key >> value) {
+            values[key] = value;
+        }
+    }
+
+    void check(const std::string& key, double measured) {
+        std::cout << key << ": " << measured << std::endl;
+
+        auto update = std::getenv("PHCOPY_PERF_UPDATE");
+        auto pos = values.find(key);
+        if (pos == values.end() || (update != nullptr && std::string(update) == "1")) {
+            values[key] = measured;
+            save();
+            std::cout << "Baseline of " << key << " recorded to " << file << std::endl;
+            return;
+        }
+
+        double tolerance = DEFAULT_TOLERANCE;
+        if (auto value = std::getenv("PHCOPY_PERF_TOLERANCE")) {
+            tolerance = std::atof(value);
+        }
+        EXPECT_GE(measured, pos->second * (1 - tolerance))
+                << key << " is slower than the baseline " << pos->second << " by more than " << tolerance * 100
+                << "%";
+    }
+
+private:
+    void save() const {
+        std::ofstream out(file, std::ios::trunc);
+        for (const auto& [key, value] : values) {
+            out << key << ' ' << value << '\n';
+        }
+    }
+
+    std::filesystem::path file;
+    std::map<std::string, double> values;
+};
+
+FixtureFiles parse_csv_listing(const std::filesystem::path& listing) {
+    FixtureFiles files;
+    std::ifstream in(listing);
+    std::string line;
+    std::getline(in, line); // Header
+    while (std::getline(in, line)) {
+        // Fixture names have no commas, so no field is quoted
+        std::istringstream fields(line);
+        std::string path, kind, size;
+        std::getline(fields, path, ',');
+        std::getline(fields, kind, ',');
+        std::getline(fields, size, ',');
+        if (kind == "file") {
+            files[path] = std::stoull(size);
+        }
+    }
+    return files;
+}
+
+bool same_content(const std::filesystem::path& first, const std::filesystem::path& second) {
+    std::ifstream first_in(first, std::ios::binary), second_in(second, std::ios::binary);
+    std::istreambuf_iterator<char> first_it(first_in), second_it(second_in), end;
+    return first_in && second_in && std::equal(first_it, end, second_it, end);
+}
+
+} // namespace
+
+TEST(PerfTest, ListFiles) {
+    const auto& camera = fixture();
+    auto listing = camera.root / "listing.csv";
+
+    double best = 0;
+    for (size_t run = 0; run < LIST_RUNS; run++) {
+        double seconds = run_phcopy("list-files -r -f csv /", listing);
+        ASSERT_GE(seconds, 0);
+        ASSERT_EQ(parse_csv_listing(listing), camera.files);
+        best = std::max(best, static_cast<double>(camera.files.size()) / seconds);
+    }
+
+    Baseline().check("list_files_per_second", best);
+}
+
+TEST(PerfTest, Download) {
+    const auto& camera = fixture();
+    auto log = camera.root / "download.log";
+
+    double best_files = 0, best_bytes = 0;
+    for (size_t run = 0; run < DOWNLOAD_RUNS; run++) {
+        auto destination = camera.root / ("download-" + std::to_string(run));
+        std::filesystem::create_directories(destination);
+
+        double seconds = run_phcopy("download -r -s / " + quote(destination.string()), log);
+        ASSERT_GE(seconds, 0);
+        best_files = std::max(best_files, static_cast<double>(camera.files.size()) / seconds);
+        best_bytes = std::max(best_bytes, static_cast<double>(camera.total_size) / BYTES_IN_MEGABYTE / seconds);
+
+        size_t downloaded = 0;
+        std::map<std::string, std::filesystem::file_time_type> times;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(destination)) {
+            if (entry.is_regular_file()) {
+                downloaded++;
+                times[entry.path().string()] = entry.last_write_time();
+            }
+        }
+        ASSERT_EQ(downloaded, camera.files.size());
+        for (const auto& [path, size] : camera.files) {
+            auto source = camera.camera_folder() / path.substr(1);
+            auto target = destination / path.substr(1);
+            ASSERT_TRUE(same_content(source, target)) << target;
+        }
+
+        // Nothing is fetched again once all files are there
+        ASSERT_GE(run_phcopy("download -r -s / " + quote(destination.string()), log), 0);
+        for (const auto& [path, time] : times) {
+            ASSERT_EQ(std::filesystem::last_write_time(path), time) << path;
+        }
+        std::filesystem::remove_all(destination);
+    }
+
+    Baseline baseline;
+    baseline.check("download_files_per_second", best_files);
+    baseline.check("download_mb_per_second", best_bytes);
+}
@@ -0,0 +1,192 @@
+// phcopy
+// Copyright (C) 2020 Konstantin Zhukov
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <gmock/gmock.h>
+
+#include "snapshot.h"
+
+#include <fstream>
+#include <unistd.h>
+
+namespace {
+
+class SnapshotTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        file = std::filesystem::temp_directory_path() / ("phcopy-snapshot-test-" + std::to_string(getpid()));
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+    }
+
+    std::string read_file() const {
+        std::ifstream in(file, std::ios::binary);
+        return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    }
+
+    void write_file(const std::string& data) const {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    std::filesystem::path file;
+};
+
+Snapshot make_snapshot(std::vector<SnapshotEntry> entries) {
+    Snapshot snapshot("/store_00010001/DCIM");
+    for (auto& entry : entries) {
+        snapshot.add(std::move(entry));
+    }
+    snapshot.sort();
+    return snapshot;
+}
+
+std::vector<std::pair<DiffKind, std::string>> describe(const std::vector<DiffEntry>& diff) {
+    std::vector<std::pair<DiffKind, std::string>> result;
+    for (const auto& entry : diff) {
+        result.emplace_back(entry.kind, entry.entry->path);
+    }
+    return result;
+}
+
+} // namespace
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+TEST_F(SnapshotTest, RoundTrip) {
+    auto snapshot = make_snapshot({
+            {"/DCIM/100APPLE/IMG_0002.HEIC", 3'000'000, 1'600'000'000},
+            {"/DCIM/100APPLE/IMG_0001.HEIC", 0, 0},
+            {"/DCIM/101APPLE/IMG_0100.MOV", UINT64_MAX, -86'400},
+            {"/DCIM/100APPLE/IMG_0001.MOV", 128, 1},
+    });
+    ASSERT_TRUE(snapshot.save(file));
+
+    auto loaded = Snapshot::load(file);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded->get_root(), snapshot.get_root());
+    ASSERT_EQ(loaded->get_entries().size(), snapshot.get_entries().size());
+    for (size_t i = 0; i < snapshot.get_entries().size(); i++) {
+        const auto& expected = snapshot.get_entries()[i];
+        const auto& actual = loaded->get_entries()[i];
+        EXPECT_EQ(actual.path, expected.path);
+        EXPECT_EQ(actual.size, expected.size);
+        EXPECT_EQ(actual.mtime, expected.mtime);
+    }
+}
+
+TEST_F(SnapshotTest, EmptyRoundTrip) {
+    ASSERT_TRUE(Snapshot("/").save(file));
+
+    auto loaded = Snapshot::load(file);
+    ASSERT_TRUE(loaded);
+    EXPECT_EQ(loaded->get_root(), "/");
+    EXPECT_TRUE(loaded->get_entries().empty());
+}
+
+TEST_F(SnapshotTest, PathsAreFrontCoded) {
+    std::vector<SnapshotEntry> entries;
+    for (int i = 0; i < 1000; i++) {
+        entries.push_back({"/DCIM/100APPLE/IMG_" + std::to_string(1000 + i) + ".HEIC", 2'000'000, 1'600'000'000});
+    }
+    ASSERT_TRUE(make_snapshot(std::move(entries)).save(file));
+
+    // The shared folder is stored once, the rest is a few bytes per file
+    EXPECT_LT(read_file().size(), 1000u * 20);
+}
+
+TEST_F(SnapshotTest, RejectsUnsortedEntries) {
+    Snapshot snapshot("/");
+    snapshot.add({"/b", 1, 1});
+    snapshot.add({"/a", 1, 1});
+    ASSERT_TRUE(snapshot.save(file));
+
+    EXPECT_FALSE(Snapshot::load(file));
+}
+
+TEST_F(SnapshotTest, RejectsDuplicateEntries) {
+    Snapshot snapshot("/");
+    snapshot.add({"/a", 1, 1});
+    snapshot.add({"/a", 2, 2});
+    ASSERT_TRUE(snapshot.save(file));
+
+    EXPECT_FALSE(Snapshot::load(file));
+}
+
+TEST_F(SnapshotTest, RejectsTruncatedFile) {
+    ASSERT_TRUE(make_snapshot({{"/DCIM/IMG_0001.JPG", 1000, 1}, {"/DCIM/IMG_0002.JPG", 2000, 2}}).save(file));
+    auto data = read_file();
+
+    for (size_t size = 0; size < data.size(); size++) {
+        write_file(data.substr(0, size));
+        EXPECT_FALSE(Snapshot::load(file)) << "size " << size;
+    }
+}
+
+TEST_F(SnapshotTest, RejectsOtherFiles) {
+    write_file("PHSNAP02");
+    EXPECT_FALSE(Snapshot::load(file));
+
+    std::error_code ec;
+    std::filesystem::remove(file, ec);
+    EXPECT_FALSE(Snapshot::load(file));
+}
+
+TEST(DiffSnapshotsTest, ReportsChangesInPathOrder) {
+    auto old_snapshot = make_snapshot({
+            {"/DCIM/IMG_0001.JPG", 100, 1},
+            {"/DCIM/IMG_0002.JPG", 200, 2},
+            {"/DCIM/IMG_0003.JPG", 300, 3},
+            {"/DCIM/IMG_0004.JPG", 400, 4},
+    });
+    auto new_snapshot = make_snapshot({
+            {"/DCIM/IMG_0000.JPG", 50, 1},
+            {"/DCIM/IMG_0002.JPG", 200, 2},
+            {"/DCIM/IMG_0003.JPG", 301, 3},
+            {"/DCIM/IMG_0004.JPG", 400, 5},
+            {"/DCIM/IMG_0005.JPG", 500, 5},
+    });
+
+    EXPECT_THAT(describe(diff_snapshots(old_snapshot, new_snapshot)),
+                ElementsAre(Pair(DiffKind::ADDED, "/DCIM/IMG_0000.JPG"),
+                            Pair(DiffKind::REMOVED, "/DCIM/IMG_0001.JPG"),
+                            Pair(DiffKind::MODIFIED, "/DCIM/IMG_0003.JPG"),
+                            Pair(DiffKind::MODIFIED, "/DCIM/IMG_0004.JPG"),
+                            Pair(DiffKind::ADDED, "/DCIM/IMG_0005.JPG")));
+}
+
+TEST(DiffSnapshotsTest, IdenticalAndEmptySnapshots) {
+    auto snapshot = make_snapshot({{"/DCIM/IMG_0001.JPG", 100, 1}});
+
+    EXPECT_TRUE(diff_snapshots(snapshot, snapshot).empty());
+    EXPECT_THAT(describe(diff_snapshots(Snapshot("/"), snapshot)),
+                ElementsAre(Pair(DiffKind::ADDED, "/DCIM/IMG_0001.JPG")));
+    EXPECT_THAT(describe(diff_snapshots(snapshot, Snapshot("/"))),
+                ElementsAre(Pair(DiffKind::REMOVED, "/DCIM/IMG_0001.JPG")));
+}
+
+TEST_F(SnapshotTest, DiffOfLoadedSnapshots) {
+    auto old_snapshot = make_snapshot({{"/DCIM/B.JPG", 1, 1}, {"/DCIM/A.JPG", 1, 1}});
+    ASSERT_TRUE(old_snapshot.save(file));
+    auto loaded = Snapshot::load(file);
+    ASSERT_TRUE(loaded);
+
+    auto new_snapshot = make_snapshot({{"/DCIM/A.JPG", 1, 1}, {"/DCIM/C.JPG", 1, 1}, {"/DCIM/B.JPG", 1, 1}});
+    EXPECT_THAT(describe(diff_snapshots(*loaded, new_snapshot)), ElementsAre(Pair(DiffKind::ADDED, "/DCIM/C.JPG")));
+}